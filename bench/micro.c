@@ -0,0 +1,429 @@
+/*
+ * micro.c
+ * microbenchmarks of the hot routines of libpkgconf
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/libpkgconf.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Usage: bench-micro [-j] [-t milliseconds] [benchmark...]
+ *
+ * Runs each benchmark whose name contains one of the given strings, or all of them, in a loop
+ * for at least the given time (100ms by default), and reports the time and the number of
+ * C library allocations per call.  -j reports one JSON object per line instead of a table.
+ *
+ * Allocations are counted by wrapping the allocation functions of the C library at link time,
+ * which the build system only does if the linker supports it and then defines BENCH_WRAP_MALLOC.
+ * libpkgconf is linked into this program statically for the wrapping to cover it.
+ */
+
+#define BENCH_BUFSIZE		65536
+
+static size_t bench_allocations;
+
+#ifdef BENCH_WRAP_MALLOC
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_reallocarray(void *ptr, size_t nmemb, size_t size);
+char *__real_strdup(const char *str);
+char *__real_strndup(const char *str, size_t len);
+
+void *
+__wrap_malloc(size_t size)
+{
+	bench_allocations++;
+	return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+	bench_allocations++;
+	return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+	bench_allocations++;
+	return __real_realloc(ptr, size);
+}
+
+void *
+__wrap_reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+	bench_allocations++;
+	return __real_reallocarray(ptr, nmemb, size);
+}
+
+char *
+__wrap_strdup(const char *str)
+{
+	bench_allocations++;
+	return __real_strdup(str);
+}
+
+char *
+__wrap_strndup(const char *str, size_t len)
+{
+	bench_allocations++;
+	return __real_strndup(str, len);
+}
+#endif
+
+typedef struct {
+	const char *name;
+	/* the input of the benchmark, and a second one for routines comparing two inputs */
+	const char *input;
+	const char *input2;
+	void (*run)(const char *input, const char *input2);
+} micro_bench_t;
+
+static pkgconf_client_t *client;
+static pkgconf_list_t vars = PKGCONF_LIST_INITIALIZER;
+static pkgconf_list_t fragments = PKGCONF_LIST_INITIALIZER;
+
+/* defeats dead code elimination of the results of pure routines */
+static volatile int bench_sink;
+
+static void
+run_compare_version(const char *a, const char *b)
+{
+	bench_sink += pkgconf_compare_version(a, b);
+}
+
+static void
+run_fragment_parse(const char *value, const char *unused)
+{
+	pkgconf_list_t list = PKGCONF_LIST_INITIALIZER;
+	(void) unused;
+
+	pkgconf_fragment_parse(client, &list, &vars, value, 0);
+	pkgconf_fragment_free(&list);
+}
+
+static void
+run_fragment_copy(const char *unused, const char *unused2)
+{
+	pkgconf_list_t list = PKGCONF_LIST_INITIALIZER;
+	(void) unused;
+	(void) unused2;
+
+	pkgconf_fragment_copy_list(client, &list, &fragments);
+	pkgconf_fragment_free(&list);
+}
+
+static void
+run_tuple_parse(const char *value, const char *unused)
+{
+	(void) unused;
+
+	free(pkgconf_tuple_parse(client, &vars, value, 0));
+}
+
+static void
+run_argv_split(const char *src, const char *unused)
+{
+	char **argv;
+	int argc;
+	(void) unused;
+
+	if (pkgconf_argv_split(src, &argc, &argv) == 0)
+		pkgconf_argv_free(argv);
+}
+
+static void
+run_fgetline(const char *text, const char *unused)
+{
+	char line[BENCH_BUFSIZE];
+	FILE *f;
+	(void) unused;
+
+	/* the stream is set up in a buffer of its own, so opening it does not allocate per line */
+	if ((f = fmemopen((void *) text, strlen(text), "r")) == NULL)
+		return;
+
+	while (pkgconf_fgetline(line, sizeof line, f) != NULL)
+		bench_sink++;
+
+	fclose(f);
+}
+
+static void
+run_dependency_parse_str(const char *depends, const char *unused)
+{
+	pkgconf_list_t list = PKGCONF_LIST_INITIALIZER;
+	(void) unused;
+
+	pkgconf_dependency_parse_str(client, &list, depends, 0);
+	pkgconf_dependency_free(&list);
+}
+
+static void
+run_path_relocate(const char *path, const char *unused)
+{
+	char buf[BENCH_BUFSIZE];
+	(void) unused;
+
+	pkgconf_strlcpy(buf, path, sizeof buf);
+	bench_sink += pkgconf_path_relocate(buf, sizeof buf);
+}
+
+/* adversarial inputs are built at startup */
+static char *long_version, *long_version2, *many_fragments, *many_references, *many_args;
+static char *long_lines, *many_dependencies, *long_path;
+
+static micro_bench_t benches[] = {
+	{"compare_version/simple", "1.2.3", "1.2.4", run_compare_version},
+	{"compare_version/prerelease", "1.0.0~rc1", "1.0.0", run_compare_version},
+	{"compare_version/alnum", "2.4.1a", "2.4.1b", run_compare_version},
+	{"compare_version/leading-zeroes", "000000000000000000000000000001.0", "1.000000000000000000000000000", run_compare_version},
+	{"compare_version/long", NULL, NULL, run_compare_version},
+	{"fragment_parse/simple", "-I${includedir}/foo -DFOO=1 -L${libdir} -lfoo", NULL, run_fragment_parse},
+	{"fragment_parse/unmergeable", "-framework Foo -Wl,--start-group -lfoo -lbar -Wl,--end-group -isystem /usr/include/foo", NULL, run_fragment_parse},
+	{"fragment_parse/many", NULL, NULL, run_fragment_parse},
+	{"fragment_copy/list", "", NULL, run_fragment_copy},
+	{"tuple_parse/simple", "${libdir}/pkgconfig", NULL, run_tuple_parse},
+	{"tuple_parse/deep", "${v31}", NULL, run_tuple_parse},
+	{"tuple_parse/many", NULL, NULL, run_tuple_parse},
+	{"tuple_parse/unterminated", "${prefix${prefix${prefix${prefix", NULL, run_tuple_parse},
+	{"argv_split/simple", "cc -I/usr/include -DFOO=\"bar baz\" 'single quoted' escaped\\ space", NULL, run_argv_split},
+	{"argv_split/many", NULL, NULL, run_argv_split},
+	{"fgetline/pc-file", "prefix=/usr\nlibdir=${prefix}/lib\n\nName: foo\nDescription: a library\nVersion: 1.2.3\n"
+		"Requires: bar >= 1.0, baz\nCflags: -I${prefix}/include\nLibs: -L${libdir} -lfoo\n", NULL, run_fgetline},
+	{"fgetline/continuations", NULL, NULL, run_fgetline},
+	{"dependency_parse_str/simple", "foo >= 1.2, bar, baz < 3.0", NULL, run_dependency_parse_str},
+	{"dependency_parse_str/whitespace", "  foo>=1.2,,,bar   =   1.0 ,\tbaz!=2  ", NULL, run_dependency_parse_str},
+	{"dependency_parse_str/many", NULL, NULL, run_dependency_parse_str},
+	{"path_relocate/simple", "/usr/lib/pkgconfig", NULL, run_path_relocate},
+	{"path_relocate/long", NULL, NULL, run_path_relocate},
+};
+
+static char *
+build_repeated(const char *format, int count)
+{
+	size_t len = 0, size = 256;
+	char *buf = malloc(size);
+	int i;
+
+	buf[0] = '\0';
+
+	for (i = 0; i < count; i++)
+	{
+		int n;
+
+		while ((n = snprintf(buf + len, size - len, format, i, i)) >= (int) (size - len))
+		{
+			size *= 2;
+			buf = realloc(buf, size);
+		}
+
+		len += n;
+	}
+
+	return buf;
+}
+
+static micro_bench_t *
+bench_find(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < PKGCONF_ARRAY_SIZE(benches); i++)
+	{
+		if (!strcmp(benches[i].name, name))
+			return &benches[i];
+	}
+
+	abort();
+}
+
+static void
+bench_setup(void)
+{
+	char key[32], value[32];
+	int i;
+
+	client = pkgconf_client_new(NULL, NULL, pkgconf_cross_personality_default());
+
+	pkgconf_tuple_add(client, &vars, "prefix", "/usr", false, 0);
+	pkgconf_tuple_add(client, &vars, "includedir", "${prefix}/include", false, 0);
+	pkgconf_tuple_add(client, &vars, "libdir", "${prefix}/lib", false, 0);
+
+	pkgconf_tuple_add(client, &vars, "v0", "${prefix}", false, 0);
+	for (i = 1; i < 32; i++)
+	{
+		snprintf(key, sizeof key, "v%d", i);
+		snprintf(value, sizeof value, "${v%d}/d%d", i - 1, i);
+		pkgconf_tuple_add(client, &vars, key, value, false, 0);
+	}
+
+	long_version = build_repeated("%d.%d.", 100);
+	long_version2 = strdup(long_version);
+	long_version2[strlen(long_version2) - 2] = '1';
+	bench_find("compare_version/long")->input = long_version;
+	bench_find("compare_version/long")->input2 = long_version2;
+
+	/* half of the fragments are duplicates of the other half */
+	many_fragments = build_repeated("-I/usr/include/p%d -L/usr/lib -lp%d -lm ", 250);
+	bench_find("fragment_parse/many")->input = many_fragments;
+
+	pkgconf_fragment_parse(client, &fragments, &vars, "-I${includedir}/foo -I${includedir} -DFOO -L${libdir} -lfoo -lbar -lm -lpthread", 0);
+	pkgconf_fragment_parse(client, &fragments, &vars, many_fragments, 0);
+
+	many_references = build_repeated("${libdir}/p%d:${v%d}:", 31);
+	bench_find("tuple_parse/many")->input = many_references;
+
+	many_args = build_repeated("-DARG%d=\"quoted value %d\" ", 1000);
+	bench_find("argv_split/many")->input = many_args;
+
+	long_lines = build_repeated("Libs: -L/usr/lib/p%d \\\n  -lp%d \\\n", 500);
+	bench_find("fgetline/continuations")->input = long_lines;
+
+	many_dependencies = build_repeated("package-%d >= %d.0, ", 500);
+	bench_find("dependency_parse_str/many")->input = many_dependencies;
+
+	long_path = build_repeated("/usr/lib//../lib/./p%d//../d%d", 200);
+	bench_find("path_relocate/long")->input = long_path;
+}
+
+static void
+bench_teardown(void)
+{
+	pkgconf_fragment_free(&fragments);
+	pkgconf_tuple_free(&vars);
+	pkgconf_client_free(client);
+
+	free(long_version);
+	free(long_version2);
+	free(many_fragments);
+	free(many_references);
+	free(many_args);
+	free(long_lines);
+	free(many_dependencies);
+	free(long_path);
+}
+
+/* doubles the number of calls until they take at least min_nsec */
+static void
+bench_run(const micro_bench_t *bench, uint64_t min_nsec, bool json)
+{
+	uint64_t iterations = 1, elapsed;
+	size_t allocations;
+
+	/* warm up the intern table and the caches */
+	bench->run(bench->input, bench->input2);
+
+	for (;;)
+	{
+		uint64_t start, i;
+
+		allocations = bench_allocations;
+		start = pkgconf_stats_clock();
+
+		for (i = 0; i < iterations; i++)
+			bench->run(bench->input, bench->input2);
+
+		elapsed = pkgconf_stats_clock() - start;
+		allocations = bench_allocations - allocations;
+
+		if (elapsed >= min_nsec)
+			break;
+
+		iterations *= 2;
+	}
+
+	if (json)
+	{
+		printf("{\"benchmark\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f, \"allocs_per_op\": ",
+			bench->name, (unsigned long long) iterations, (double) elapsed / iterations);
+#ifdef BENCH_WRAP_MALLOC
+		printf("%.2f}\n", (double) allocations / iterations);
+#else
+		printf("null}\n");
+#endif
+	}
+	else
+	{
+		printf("%-36s %12llu %14.1f", bench->name, (unsigned long long) iterations, (double) elapsed / iterations);
+#ifdef BENCH_WRAP_MALLOC
+		printf(" %12.2f\n", (double) allocations / iterations);
+#else
+		printf(" %12s\n", "-");
+#endif
+	}
+
+	fflush(stdout);
+}
+
+static bool
+bench_selected(const char *name, int argc, char *argv[])
+{
+	int i;
+
+	if (argc == 0)
+		return true;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strstr(name, argv[i]) != NULL)
+			return true;
+	}
+
+	return false;
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t min_nsec = 100 * 1000000;
+	bool json = false;
+	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "jt:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'j':
+			json = true;
+			break;
+		case 't':
+			min_nsec = (uint64_t) atoi(optarg) * 1000000;
+			break;
+		default:
+			fprintf(stderr, "usage: bench-micro [-j] [-t milliseconds] [benchmark...]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	bench_setup();
+
+	if (!json)
+		printf("%-36s %12s %14s %12s\n", "benchmark", "iterations", "ns/op", "allocs/op");
+
+	for (i = 0; i < PKGCONF_ARRAY_SIZE(benches); i++)
+	{
+		if (bench_selected(benches[i].name, argc - optind, argv + optind))
+			bench_run(&benches[i], min_nsec, json);
+	}
+
+	bench_teardown();
+
+	return EXIT_SUCCESS;
+}
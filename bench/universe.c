@@ -0,0 +1,738 @@
+/*
+ * universe.c
+ * benchmarks of pkgconf queries against synthetic package universes
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/libpkgconf.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Usage: bench-universe [-c pkgconf] [-n iterations] [-o results] directory [universe...]
+ *
+ * Generates the package universes below `directory`, unless a previous run already did, and
+ * times each query against them, both through libpkgconf in this process and, if a pkgconf
+ * binary is given, through the CLI.  Each query starts from a fresh client, as a build system
+ * invoking pkgconf would.  Results are written as one JSON object per line.
+ */
+
+extern char **environ;
+
+/* bump whenever the generated universes change, so that stale ones are regenerated */
+#define UNIVERSE_GENERATION	1
+
+#define MAXIMUM_TRAVERSE_DEPTH	2000
+#define BENCH_PATH_SIZE		4096
+
+typedef struct {
+	const char *dir;
+	uint32_t seed;
+} universe_ctx_t;
+
+typedef struct {
+	const char *name;
+	void (*generate)(universe_ctx_t *ctx);
+	/* the number of search directories the universe is spread over, if more than one */
+	int dirs;
+} universe_t;
+
+typedef enum {
+	OP_CFLAGS,
+	OP_LIBS_STATIC,
+	OP_LIST_ALL,
+	OP_EXISTS,
+	OP_PROVIDER,
+} bench_op_t;
+
+static const char *bench_op_names[] = {
+	[OP_CFLAGS] = "cflags",
+	[OP_LIBS_STATIC] = "libs-static",
+	[OP_LIST_ALL] = "list-all",
+	[OP_EXISTS] = "exists",
+	[OP_PROVIDER] = "provider",
+};
+
+typedef struct {
+	const char *universe;
+	bench_op_t op;
+	const char *package;
+} bench_case_t;
+
+static uint32_t
+universe_rand(universe_ctx_t *ctx)
+{
+	ctx->seed = ctx->seed * 1103515245 + 12345;
+	return ctx->seed >> 16;
+}
+
+static void
+universe_mkdir(const char *path)
+{
+	if (mkdir(path, 0755) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "bench-universe: %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static FILE *
+universe_open(const char *dir, const char *name)
+{
+	char path[BENCH_PATH_SIZE];
+	FILE *f;
+
+	snprintf(path, sizeof path, "%s/%s.pc", dir, name);
+
+	if ((f = fopen(path, "w")) == NULL)
+	{
+		fprintf(stderr, "bench-universe: %s: %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	return f;
+}
+
+static void
+universe_header(FILE *f, const char *name, const char *version)
+{
+	fprintf(f, "prefix=/opt/%s\n", name);
+	fprintf(f, "exec_prefix=${prefix}\n");
+	fprintf(f, "libdir=${exec_prefix}/lib\n");
+	fprintf(f, "includedir=${prefix}/include\n\n");
+	fprintf(f, "Name: %s\n", name);
+	fprintf(f, "Description: synthetic package %s\n", name);
+	fprintf(f, "Version: %s\n", version);
+}
+
+/* 10000 packages, each requiring three packages above it, and providing an alias */
+static void
+universe_large(universe_ctx_t *ctx)
+{
+	const int count = 10000;
+	char name[64];
+	int i, j;
+
+	for (i = 0; i < count; i++)
+	{
+		FILE *f;
+
+		snprintf(name, sizeof name, "large-%d", i);
+		f = universe_open(ctx->dir, name);
+		universe_header(f, name, "1.0");
+
+		fprintf(f, "Provides: large-alias-%d = 1.0\n", i);
+
+		if (i < count - 1)
+		{
+			fprintf(f, "Requires:");
+
+			for (j = 0; j < 3; j++)
+				fprintf(f, "%s large-%d", j ? "," : "", i + 1 + (int) (universe_rand(ctx) % (count - 1 - i)));
+
+			fprintf(f, "\n");
+		}
+
+		fprintf(f, "Cflags: -I${includedir}/%s -DHAVE_LARGE_%d\n", name, i);
+		fprintf(f, "Libs: -L${libdir} -l%s\n", name);
+		fclose(f);
+	}
+}
+
+/* a single chain of 300 packages, each requiring a version of the next one */
+static void
+universe_chain(universe_ctx_t *ctx)
+{
+	const int count = 300;
+	char name[64];
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		FILE *f;
+
+		snprintf(name, sizeof name, "chain-%d", i);
+		f = universe_open(ctx->dir, name);
+		universe_header(f, name, "1.2.3");
+
+		if (i < count - 1)
+			fprintf(f, "Requires: chain-%d >= 1.0\n", i + 1);
+
+		fprintf(f, "Cflags: -I${includedir}/%s\n", name);
+		fprintf(f, "Libs: -L${libdir} -l%s\n", name);
+		fclose(f);
+	}
+}
+
+/* a package requiring 200 packages, which share a handful of base packages */
+static void
+universe_fanout(universe_ctx_t *ctx)
+{
+	const int count = 200;
+	char name[64];
+	FILE *f;
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		snprintf(name, sizeof name, "fanout-base-%d", i);
+		f = universe_open(ctx->dir, name);
+		universe_header(f, name, "1.0");
+		fprintf(f, "Cflags: -I${includedir} -DFANOUT_BASE_%d\n", i);
+		fprintf(f, "Libs: -L${libdir} -l%s\n", name);
+		fclose(f);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		snprintf(name, sizeof name, "fanout-leaf-%d", i);
+		f = universe_open(ctx->dir, name);
+		universe_header(f, name, "1.0");
+		fprintf(f, "Requires: fanout-base-%d, fanout-base-%d\n", i % 4, (i + 1) % 4);
+		fprintf(f, "Cflags: -I${includedir}/%s\n", name);
+		fprintf(f, "Libs: -L${libdir} -l%s\n", name);
+		fclose(f);
+	}
+
+	f = universe_open(ctx->dir, "fanout-root");
+	universe_header(f, "fanout-root", "1.0");
+	fprintf(f, "Requires:");
+	for (i = 0; i < count; i++)
+		fprintf(f, "%s fanout-leaf-%d", i ? "," : "", i);
+	fprintf(f, "\nCflags: -I${includedir}\n");
+	fprintf(f, "Libs: -L${libdir} -lfanout-root\n");
+	fclose(f);
+}
+
+/* a chain of 100 packages linked through Requires.private, each with 200 Libs.private entries */
+static void
+universe_private(universe_ctx_t *ctx)
+{
+	const int count = 100;
+	char name[64];
+	int i, j;
+
+	for (i = 0; i < count; i++)
+	{
+		FILE *f;
+
+		snprintf(name, sizeof name, "private-%d", i);
+		f = universe_open(ctx->dir, name);
+		universe_header(f, name, "1.0");
+
+		if (i < count - 1)
+			fprintf(f, "Requires.private: private-%d\n", i + 1);
+
+		fprintf(f, "Cflags: -I${includedir}\n");
+		fprintf(f, "Libs: -L${libdir} -l%s\n", name);
+		fprintf(f, "Libs.private:");
+
+		for (j = 0; j < 200; j++)
+		{
+			if (j % 10 == 0)
+				fprintf(f, " -L/opt/common/lib%d -lm -lpthread", j / 10);
+
+			fprintf(f, " -lpriv-%d-%d", i, j);
+		}
+
+		fprintf(f, "\n");
+		fclose(f);
+	}
+}
+
+/* 200 packages with 50 variables each expanding the previous one, required by a root package */
+static void
+universe_variables(universe_ctx_t *ctx)
+{
+	const int count = 200;
+	char name[64];
+	FILE *f;
+	int i, j;
+
+	for (i = 0; i < count; i++)
+	{
+		snprintf(name, sizeof name, "vars-%d", i);
+		f = universe_open(ctx->dir, name);
+
+		fprintf(f, "prefix=/opt/%s\n", name);
+		fprintf(f, "v0=${prefix}\n");
+		for (j = 1; j < 50; j++)
+			fprintf(f, "v%d=${v%d}/${v%d_leaf}\nv%d_leaf=d%d\n", j, j - 1, j, j, j);
+
+		fprintf(f, "\nName: %s\n", name);
+		fprintf(f, "Description: synthetic package %s\n", name);
+		fprintf(f, "Version: 1.0\n");
+		fprintf(f, "Cflags: -I${v49} -I${v25}/include -DPREFIX=\"${prefix}\"\n");
+		fprintf(f, "Libs: -L${v49}/lib -l%s\n", name);
+		fclose(f);
+	}
+
+	f = universe_open(ctx->dir, "vars-root");
+	universe_header(f, "vars-root", "1.0");
+	fprintf(f, "Requires:");
+	for (i = 0; i < count; i++)
+		fprintf(f, "%s vars-%d", i ? "," : "", i);
+	fprintf(f, "\n");
+	fclose(f);
+}
+
+#define UNIVERSE_DIRS_COUNT	400
+
+/* 400 search directories of 25 packages each, with a root package in the last one */
+static void
+universe_dirs(universe_ctx_t *ctx)
+{
+	const int dirs = UNIVERSE_DIRS_COUNT, count = 25;
+	char subdir[BENCH_PATH_SIZE], name[64];
+	int d, i;
+
+	for (d = 0; d < dirs; d++)
+	{
+		snprintf(subdir, sizeof subdir, "%s/d%03d", ctx->dir, d);
+		universe_mkdir(subdir);
+
+		for (i = 0; i < count; i++)
+		{
+			FILE *f;
+
+			snprintf(name, sizeof name, "dirs-%d-%d", d, i);
+			f = universe_open(subdir, name);
+			universe_header(f, name, "1.0");
+			fprintf(f, "Cflags: -I${includedir}/%s\n", name);
+			fprintf(f, "Libs: -L${libdir} -l%s\n", name);
+			fclose(f);
+		}
+
+		if (d == dirs - 1)
+		{
+			FILE *f = universe_open(subdir, "dirs-root");
+
+			universe_header(f, "dirs-root", "1.0");
+			fprintf(f, "Requires:");
+			for (i = 0; i < dirs; i += 8)
+				fprintf(f, "%s dirs-%d-%d", i ? "," : "", i, i % count);
+			fprintf(f, "\n");
+			fclose(f);
+		}
+	}
+}
+
+static const universe_t universes[] = {
+	{"large", universe_large, 0},
+	{"chain", universe_chain, 0},
+	{"fanout", universe_fanout, 0},
+	{"private", universe_private, 0},
+	{"variables", universe_variables, 0},
+	{"dirs", universe_dirs, UNIVERSE_DIRS_COUNT},
+};
+
+static const bench_case_t cases[] = {
+	{"large", OP_CFLAGS, "large-0"},
+	{"large", OP_LIBS_STATIC, "large-5000"},
+	{"large", OP_LIST_ALL, NULL},
+	{"large", OP_EXISTS, "large-9999"},
+	{"large", OP_PROVIDER, "large-alias-9999"},
+	{"chain", OP_CFLAGS, "chain-0"},
+	{"chain", OP_LIBS_STATIC, "chain-0"},
+	{"chain", OP_EXISTS, "chain-0"},
+	{"fanout", OP_CFLAGS, "fanout-root"},
+	{"fanout", OP_LIBS_STATIC, "fanout-root"},
+	{"fanout", OP_EXISTS, "fanout-root"},
+	{"private", OP_LIBS_STATIC, "private-0"},
+	{"variables", OP_CFLAGS, "vars-root"},
+	{"variables", OP_LIBS_STATIC, "vars-root"},
+	{"dirs", OP_CFLAGS, "dirs-root"},
+	{"dirs", OP_LIST_ALL, NULL},
+	{"dirs", OP_EXISTS, "dirs-399-24"},
+};
+
+/*
+ * generates a universe unless a stamp left by a previous run says it is up to date, and
+ * returns its search path.
+ */
+static char *
+universe_prepare(const char *root, const universe_t *universe)
+{
+	char dir[BENCH_PATH_SIZE], stamp[BENCH_PATH_SIZE + sizeof "/generation"];
+	universe_ctx_t ctx = {.dir = dir, .seed = 1};
+	size_t pathlen;
+	char *path;
+	FILE *f;
+	int generation = 0, d;
+
+	snprintf(dir, sizeof dir, "%s/%s", root, universe->name);
+	snprintf(stamp, sizeof stamp, "%s/generation", dir);
+	universe_mkdir(dir);
+
+	if ((f = fopen(stamp, "r")) != NULL)
+	{
+		if (fscanf(f, "%d", &generation) != 1)
+			generation = 0;
+		fclose(f);
+	}
+
+	if (generation != UNIVERSE_GENERATION)
+	{
+		universe->generate(&ctx);
+
+		if ((f = fopen(stamp, "w")) != NULL)
+		{
+			fprintf(f, "%d\n", UNIVERSE_GENERATION);
+			fclose(f);
+		}
+	}
+
+	if (universe->dirs == 0)
+		return strdup(dir);
+
+	pathlen = (strlen(dir) + 6) * universe->dirs + 1;
+	path = calloc(1, pathlen);
+
+	for (d = 0; d < universe->dirs; d++)
+	{
+		char subdir[BENCH_PATH_SIZE];
+
+		snprintf(subdir, sizeof subdir, "%s%s/d%03d", d ? ":" : "", dir, d);
+		pkgconf_strlcat(path, subdir, pathlen);
+	}
+
+	return path;
+}
+
+static bool
+bench_error_handler(const char *msg, const pkgconf_client_t *client, void *data)
+{
+	(void) msg;
+	(void) client;
+	(void) data;
+
+	return true;
+}
+
+static bool
+bench_apply_cflags(pkgconf_client_t *client, pkgconf_pkg_t *world, void *data, int maxdepth)
+{
+	pkgconf_list_t list = PKGCONF_LIST_INITIALIZER;
+	char *render_buf;
+	(void) data;
+
+	if (pkgconf_pkg_cflags(client, world, &list, maxdepth) != PKGCONF_PKG_ERRF_OK)
+		return false;
+
+	render_buf = pkgconf_fragment_render(&list, true, NULL);
+	free(render_buf);
+	pkgconf_fragment_free(&list);
+
+	return true;
+}
+
+static bool
+bench_apply_libs(pkgconf_client_t *client, pkgconf_pkg_t *world, void *data, int maxdepth)
+{
+	pkgconf_list_t list = PKGCONF_LIST_INITIALIZER;
+	char *render_buf;
+	(void) data;
+
+	if (pkgconf_pkg_libs(client, world, &list, maxdepth) != PKGCONF_PKG_ERRF_OK)
+		return false;
+
+	render_buf = pkgconf_fragment_render(&list, true, NULL);
+	free(render_buf);
+	pkgconf_fragment_free(&list);
+
+	return true;
+}
+
+static bool
+bench_count_package(const pkgconf_pkg_t *pkg, void *data)
+{
+	size_t *count = data;
+	(void) pkg;
+
+	(*count)++;
+
+	return false;
+}
+
+/* answers a query through libpkgconf, with the client flags the CLI would use */
+static bool
+bench_run_library(const bench_case_t *bc, const pkgconf_cross_personality_t *personality)
+{
+	pkgconf_list_t queue = PKGCONF_LIST_INITIALIZER;
+	pkgconf_client_t *client;
+	unsigned int flags = PKGCONF_PKG_PKGF_NONE;
+	size_t count = 0;
+	bool ret;
+
+	switch (bc->op)
+	{
+	case OP_CFLAGS:
+		flags |= PKGCONF_PKG_PKGF_SEARCH_PRIVATE;
+		break;
+	case OP_LIBS_STATIC:
+		flags |= PKGCONF_PKG_PKGF_SEARCH_PRIVATE | PKGCONF_PKG_PKGF_MERGE_PRIVATE_FRAGMENTS;
+		break;
+	default:
+		flags |= PKGCONF_PKG_PKGF_LAZY_PARSE;
+		break;
+	}
+
+	client = pkgconf_client_new(bench_error_handler, NULL, personality);
+	pkgconf_client_set_flags(client, flags);
+	pkgconf_client_dir_list_build(client, personality);
+	pkgconf_client_begin_query(client);
+
+	if (bc->package != NULL)
+		pkgconf_queue_push(&queue, bc->package);
+
+	switch (bc->op)
+	{
+	case OP_CFLAGS:
+		ret = pkgconf_queue_apply(client, &queue, bench_apply_cflags, MAXIMUM_TRAVERSE_DEPTH, NULL);
+		break;
+	case OP_LIBS_STATIC:
+		ret = pkgconf_queue_apply(client, &queue, bench_apply_libs, MAXIMUM_TRAVERSE_DEPTH, NULL);
+		break;
+	case OP_LIST_ALL:
+		pkgconf_scan_all(client, &count, bench_count_package);
+		ret = count > 0;
+		break;
+	default:
+		ret = pkgconf_queue_validate(client, &queue, MAXIMUM_TRAVERSE_DEPTH);
+		break;
+	}
+
+	pkgconf_queue_free(&queue);
+	pkgconf_client_end_query(client);
+	pkgconf_client_free(client);
+
+	return ret;
+}
+
+/* answers a query through the CLI, discarding its output */
+static bool
+bench_run_cli(const bench_case_t *bc, const char *cli)
+{
+	posix_spawn_file_actions_t actions;
+	char *argv[5];
+	int argc = 0, status;
+	pid_t pid;
+
+	argv[argc++] = (char *) cli;
+
+	switch (bc->op)
+	{
+	case OP_CFLAGS:
+		argv[argc++] = "--cflags";
+		break;
+	case OP_LIBS_STATIC:
+		argv[argc++] = "--libs";
+		argv[argc++] = "--static";
+		break;
+	case OP_LIST_ALL:
+		argv[argc++] = "--list-all";
+		break;
+	default:
+		argv[argc++] = "--exists";
+		break;
+	}
+
+	if (bc->package != NULL)
+		argv[argc++] = (char *) bc->package;
+	argv[argc] = NULL;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+	status = posix_spawn(&pid, cli, &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (status != 0)
+	{
+		fprintf(stderr, "bench-universe: %s: %s\n", cli, strerror(status));
+		return false;
+	}
+
+	if (waitpid(pid, &status, 0) != pid)
+		return false;
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int
+bench_compare_sample(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static bool
+bench_run(FILE *out, const bench_case_t *bc, const char *interface, const char *cli,
+	const pkgconf_cross_personality_t *personality, int iterations)
+{
+	uint64_t *samples = calloc(iterations, sizeof(uint64_t));
+	uint64_t sum = 0;
+	bool ok = true;
+	int i;
+
+	/* the first run warms up the page cache, and is not counted */
+	for (i = -1; i < iterations && ok; i++)
+	{
+		uint64_t start = pkgconf_stats_clock();
+
+		if (cli != NULL)
+			ok = bench_run_cli(bc, cli);
+		else
+			ok = bench_run_library(bc, personality);
+
+		if (i >= 0)
+			samples[i] = pkgconf_stats_clock() - start;
+	}
+
+	if (ok)
+	{
+		for (i = 0; i < iterations; i++)
+			sum += samples[i];
+
+		qsort(samples, iterations, sizeof(uint64_t), bench_compare_sample);
+	}
+
+	fprintf(out, "{\"universe\": \"%s\", \"operation\": \"%s\", \"interface\": \"%s\", \"package\": \"%s\", \"ok\": %s",
+		bc->universe, bench_op_names[bc->op], interface, bc->package != NULL ? bc->package : "",
+		ok ? "true" : "false");
+
+	if (ok)
+		fprintf(out, ", \"iterations\": %d, \"min_ns\": %llu, \"median_ns\": %llu, \"mean_ns\": %llu, \"max_ns\": %llu",
+			iterations, (unsigned long long) samples[0], (unsigned long long) samples[iterations / 2],
+			(unsigned long long) (sum / iterations), (unsigned long long) samples[iterations - 1]);
+
+	fprintf(out, "}\n");
+	fflush(out);
+
+	free(samples);
+
+	return ok;
+}
+
+static bool
+universe_selected(const char *name, int argc, char *argv[])
+{
+	int i;
+
+	if (argc == 0)
+		return true;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (!strcmp(argv[i], name))
+			return true;
+	}
+
+	return false;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: bench-universe [-c pkgconf] [-n iterations] [-o results] directory [universe...]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	pkgconf_cross_personality_t *personality;
+	const char *cli = NULL, *output = NULL, *root;
+	FILE *out = stdout;
+	int iterations = 5, opt;
+	bool ok = true;
+	size_t i, j;
+
+	while ((opt = getopt(argc, argv, "c:n:o:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c':
+			cli = optarg;
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind >= argc || iterations < 1)
+		usage();
+
+	root = argv[optind++];
+	universe_mkdir(root);
+
+	if (output != NULL && (out = fopen(output, "w")) == NULL)
+	{
+		fprintf(stderr, "bench-universe: %s: %s\n", output, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	/* only the universe is searched, by the library as well as by the CLI */
+	unsetenv("PKG_CONFIG_PATH");
+	unsetenv("PKG_CONFIG_SERVER");
+	unsetenv("PKG_CONFIG_PARSE_CACHE");
+	unsetenv("PKG_CONFIG_LOG");
+	unsetenv("PKG_CONFIG_TRACE_EVENTS");
+
+	personality = pkgconf_cross_personality_default();
+
+	for (i = 0; i < PKGCONF_ARRAY_SIZE(universes); i++)
+	{
+		char *path;
+
+		if (!universe_selected(universes[i].name, argc - optind, argv + optind))
+			continue;
+
+		path = universe_prepare(root, &universes[i]);
+		setenv("PKG_CONFIG_LIBDIR", path, 1);
+
+		for (j = 0; j < PKGCONF_ARRAY_SIZE(cases); j++)
+		{
+			if (strcmp(cases[j].universe, universes[i].name))
+				continue;
+
+			ok &= bench_run(out, &cases[j], "library", NULL, personality, iterations);
+
+			if (cli != NULL)
+				ok &= bench_run(out, &cases[j], "cli", cli, personality, iterations);
+		}
+
+		free(path);
+	}
+
+	pkgconf_cross_personality_deinit(personality);
+
+	if (out != stdout)
+		fclose(out);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
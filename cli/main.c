@@ -21,6 +21,7 @@
 #ifndef PKGCONF_LITE
 #include "renderer-msvc.h"
 #endif
+#include "serve.h"
 #ifdef _WIN32
 #include <io.h>     /* for _setmode() */
 #include <fcntl.h>
@@ -70,8 +71,23 @@
 #define PKG_INTERNAL_CFLAGS		(((uint64_t) 1) << 42)
 #define PKG_DUMP_PERSONALITY		(((uint64_t) 1) << 43)
 #define PKG_SHARED			(((uint64_t) 1) << 44)
+#define PKG_BATCH			(((uint64_t) 1) << 45)
+#define PKG_JSON			(((uint64_t) 1) << 46)
+#define PKG_STATS			(((uint64_t) 1) << 47)
+
+/* options which change how packages are located or parsed.  batched queries only share
+ * a client (and thus its package cache) if they agree on all of these.
+ */
+#define PKG_CLIENT_OPTIONS		(PKG_ENV_ONLY|PKG_NO_UNINSTALLED|PKG_NO_PROVIDES|PKG_DEFINE_PREFIX|PKG_DONT_DEFINE_PREFIX|PKG_DONT_RELOCATE_PATHS)
+
+/* a shared client keeps every package it parsed and every string it interned until it is
+ * dropped, so once it holds on to this much memory, the next query starts with a fresh one.
+ */
+#define PKG_CLIENT_RETAINED_MAX		((size_t) 64 * 1024 * 1024)
 
 static pkgconf_client_t pkg_client;
+static pkgconf_stats_t pkg_client_stats;
+static pkgconf_counting_allocator_t pkg_client_allocs;
 static const pkgconf_fragment_render_ops_t *want_render_ops = NULL;
 
 static uint64_t want_flags;
@@ -84,6 +100,11 @@ static char *want_fragment_filter = NULL;
 FILE *error_msgout = NULL;
 FILE *logfile_out = NULL;
 
+static bool batch_mode = false;
+static bool serve_mode = false;
+static bool pkg_client_live = false;
+static char *pkg_client_key = NULL;
+
 static bool
 error_handler(const char *msg, const pkgconf_client_t *client, void *data)
 {
@@ -177,10 +198,12 @@ print_variables(pkgconf_pkg_t *pkg)
 }
 
 static void
-print_requires(pkgconf_pkg_t *pkg)
+print_requires(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 {
 	pkgconf_node_t *node;
 
+	pkgconf_pkg_materialize(client, pkg, PKGCONF_PKG_FIELDF_DEPENDENCIES);
+
 	PKGCONF_FOREACH_LIST_ENTRY(pkg->required.head, node)
 	{
 		pkgconf_dependency_t *dep = node->data;
@@ -195,10 +218,12 @@ print_requires(pkgconf_pkg_t *pkg)
 }
 
 static void
-print_requires_private(pkgconf_pkg_t *pkg)
+print_requires_private(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 {
 	pkgconf_node_t *node;
 
+	pkgconf_pkg_materialize(client, pkg, PKGCONF_PKG_FIELDF_DEPENDENCIES);
+
 	PKGCONF_FOREACH_LIST_ENTRY(pkg->requires_private.head, node)
 	{
 		pkgconf_dependency_t *dep = node->data;
@@ -254,9 +279,10 @@ static void
 print_digraph_node(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *unused)
 {
 	pkgconf_node_t *node;
-	(void) client;
 	(void) unused;
 
+	pkgconf_pkg_materialize(client, pkg, PKGCONF_PKG_FIELDF_DEPENDENCIES);
+
 	printf("\"%s\" [fontname=Sans fontsize=8]\n", pkg->id);
 
 	PKGCONF_FOREACH_LIST_ENTRY(pkg->required.head, node)
@@ -369,6 +395,22 @@ apply_variable(pkgconf_client_t *client, pkgconf_pkg_t *world, void *variable, i
 	return true;
 }
 
+static char *
+render_fragments(pkgconf_client_t *client, pkgconf_list_t *list)
+{
+	pkgconf_stats_phase_t phase = pkgconf_client_enter_phase(client, PKGCONF_STATS_PHASE_RENDER);
+	char *render_buf;
+
+	PKGCONF_TRACEEVENT_BEGIN(client, "pkgconf_fragment_render", NULL, NULL);
+
+	render_buf = pkgconf_fragment_render(list, true, want_render_ops);
+
+	PKGCONF_TRACEEVENT_END(client, "pkgconf_fragment_render");
+	pkgconf_client_leave_phase(client, phase);
+
+	return render_buf;
+}
+
 static bool
 apply_env_var(const char *prefix, pkgconf_client_t *client, pkgconf_pkg_t *world, int maxdepth,
 	unsigned int (*collect_fn)(pkgconf_client_t *client, pkgconf_pkg_t *world, pkgconf_list_t *list, int maxdepth),
@@ -388,7 +430,7 @@ apply_env_var(const char *prefix, pkgconf_client_t *client, pkgconf_pkg_t *world
 	if (filtered_list.head == NULL)
 		goto out;
 
-	render_buf = pkgconf_fragment_render(&filtered_list, true, want_render_ops);
+	render_buf = render_fragments(client, &filtered_list);
 	printf("%s='%s'\n", prefix, render_buf);
 	free(render_buf);
 
@@ -438,7 +480,7 @@ apply_cflags(pkgconf_client_t *client, pkgconf_pkg_t *world, void *unused, int m
 	if (filtered_list.head == NULL)
 		goto out;
 
-	render_buf = pkgconf_fragment_render(&filtered_list, true, want_render_ops);
+	render_buf = render_fragments(client, &filtered_list);
 	printf("%s", render_buf);
 	free(render_buf);
 
@@ -467,7 +509,7 @@ apply_libs(pkgconf_client_t *client, pkgconf_pkg_t *world, void *unused, int max
 	if (filtered_list.head == NULL)
 		goto out;
 
-	render_buf = pkgconf_fragment_render(&filtered_list, true, want_render_ops);
+	render_buf = render_fragments(client, &filtered_list);
 	printf("%s", render_buf);
 	free(render_buf);
 
@@ -482,7 +524,6 @@ static bool
 apply_requires(pkgconf_client_t *client, pkgconf_pkg_t *world, void *unused, int maxdepth)
 {
 	pkgconf_node_t *iter;
-	(void) client;
 	(void) unused;
 	(void) maxdepth;
 
@@ -491,7 +532,7 @@ apply_requires(pkgconf_client_t *client, pkgconf_pkg_t *world, void *unused, int
 		pkgconf_dependency_t *dep = iter->data;
 		pkgconf_pkg_t *pkg = dep->match;
 
-		print_requires(pkg);
+		print_requires(client, pkg);
 	}
 
 	return true;
@@ -501,7 +542,6 @@ static bool
 apply_requires_private(pkgconf_client_t *client, pkgconf_pkg_t *world, void *unused, int maxdepth)
 {
 	pkgconf_node_t *iter;
-	(void) client;
 	(void) unused;
 	(void) maxdepth;
 
@@ -510,7 +550,7 @@ apply_requires_private(pkgconf_client_t *client, pkgconf_pkg_t *world, void *unu
 		pkgconf_dependency_t *dep = iter->data;
 		pkgconf_pkg_t *pkg = dep->match;
 
-		print_requires_private(pkg);
+		print_requires_private(client, pkg);
 	}
 	return true;
 }
@@ -544,9 +584,10 @@ print_graph_node(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *data)
 {
 	pkgconf_node_t *n;
 
-	(void) client;
 	(void) data;
 
+	pkgconf_pkg_materialize(client, pkg, PKGCONF_PKG_FIELDF_DEPENDENCIES);
+
 	printf("node '%s' {\n", pkg->id);
 
 	if (pkg->version != NULL)
@@ -584,6 +625,305 @@ apply_simulate(pkgconf_client_t *client, pkgconf_pkg_t *world, void *data, int m
 }
 #endif
 
+/* prints the characters of a string with JSON escapes, but without the surrounding quotes */
+static void
+print_json_chars(const char *str)
+{
+	const unsigned char *p;
+
+	for (p = (const unsigned char *) str; *p != '\0'; p++)
+	{
+		switch (*p)
+		{
+		case '"':
+		case '\\':
+			printf("\\%c", *p);
+			break;
+		case '\n':
+			printf("\\n");
+			break;
+		case '\t':
+			printf("\\t");
+			break;
+		default:
+			if (*p < 0x20)
+				printf("\\u%04x", *p);
+			else
+				putchar(*p);
+			break;
+		}
+	}
+}
+
+static void
+print_json_string(const char *str)
+{
+	if (str == NULL)
+	{
+		printf("null");
+		return;
+	}
+
+	putchar('"');
+	print_json_chars(str);
+	putchar('"');
+}
+
+static void
+print_json_dependencies(const char *key, pkgconf_list_t *list)
+{
+	pkgconf_node_t *node;
+
+	printf(",\n      \"%s\": [", key);
+
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
+	{
+		pkgconf_dependency_t *dep = node->data;
+
+		printf("%s{\"package\": ", node->prev != NULL ? ", " : "");
+		print_json_string(dep->package);
+
+		if (dep->version != NULL)
+		{
+			printf(", \"comparator\": ");
+			print_json_string(pkgconf_pkg_get_comparator(dep));
+			printf(", \"version\": ");
+			print_json_string(dep->version);
+		}
+
+		printf("}");
+	}
+
+	printf("]");
+}
+
+static void
+print_json_variables(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
+{
+	pkgconf_node_t *node;
+
+	printf(",\n      \"variables\": {");
+
+	PKGCONF_FOREACH_LIST_ENTRY(pkg->vars.head, node)
+	{
+		pkgconf_tuple_t *tuple = node->data;
+
+		printf("%s", node->prev != NULL ? ", " : "");
+		print_json_string(tuple->key);
+		printf(": ");
+		print_json_string(pkgconf_tuple_find(client, &pkg->vars, tuple->key));
+	}
+
+	printf("}");
+}
+
+/* fragments are printed as separate, unescaped arguments rather than as a shell command line */
+static bool
+print_json_fragments(pkgconf_client_t *client, pkgconf_pkg_t *root, int maxdepth, unsigned int flags,
+	const char *indent, const char *key,
+	unsigned int (*collect_fn)(pkgconf_client_t *client, pkgconf_pkg_t *world, pkgconf_list_t *list, int maxdepth),
+	bool (*filter_fn)(const pkgconf_client_t *client, const pkgconf_fragment_t *frag, void *data))
+{
+	pkgconf_list_t unfiltered_list = PKGCONF_LIST_INITIALIZER;
+	pkgconf_list_t filtered_list = PKGCONF_LIST_INITIALIZER;
+	pkgconf_node_t *node;
+	unsigned int eflag;
+
+	pkgconf_client_set_flags(client, flags);
+
+	eflag = collect_fn(client, root, &unfiltered_list, maxdepth);
+	if (eflag != PKGCONF_PKG_ERRF_OK)
+	{
+		pkgconf_fragment_free(&unfiltered_list);
+		return false;
+	}
+
+	pkgconf_fragment_filter(client, &filtered_list, &unfiltered_list, filter_fn, NULL);
+
+	printf(",\n%s\"%s\": [", indent, key);
+
+	PKGCONF_FOREACH_LIST_ENTRY(filtered_list.head, node)
+	{
+		const pkgconf_fragment_t *frag = node->data;
+
+		printf("%s", node->prev != NULL ? ", " : "");
+
+		if (frag->type)
+		{
+			char prefix[] = {'-', frag->type, '\0'};
+
+			putchar('"');
+			print_json_chars(prefix);
+			print_json_chars(frag->data != NULL ? frag->data : "");
+			putchar('"');
+		}
+		else
+			print_json_string(frag->data);
+	}
+
+	printf("]");
+
+	pkgconf_fragment_free(&unfiltered_list);
+	pkgconf_fragment_free(&filtered_list);
+
+	return true;
+}
+
+/* the client flags used to collect each kind of fragment list */
+typedef struct {
+	unsigned int cflags;
+	unsigned int libs;
+	unsigned int libs_static;
+
+	/* the queried modules, as opposed to everything they pulled into the solution */
+	const pkgconf_list_t *requested;
+} json_flags_t;
+
+static bool
+print_json_link(pkgconf_client_t *client, pkgconf_pkg_t *root, int maxdepth, const json_flags_t *flags, const char *indent)
+{
+	if (!print_json_fragments(client, root, maxdepth, flags->cflags, indent, "cflags", pkgconf_pkg_cflags, filter_cflags))
+		return false;
+
+	if (!print_json_fragments(client, root, maxdepth, flags->libs, indent, "libs", pkgconf_pkg_libs, filter_libs))
+		return false;
+
+	if (!print_json_fragments(client, root, maxdepth, flags->libs_static, indent, "libs_static", pkgconf_pkg_libs, filter_libs))
+		return false;
+
+	return true;
+}
+
+/*
+ * the solution in world->required also holds the dependencies of the queried modules, so
+ * look up the package each queried module resolved to, once per module
+ */
+static pkgconf_pkg_t *
+json_requested_pkg(const pkgconf_pkg_t *world, const pkgconf_list_t *requested, const pkgconf_node_t *req_node)
+{
+	const pkgconf_dependency_t *req = req_node->data;
+	pkgconf_node_t *iter;
+
+	PKGCONF_FOREACH_LIST_ENTRY(requested->head, iter)
+	{
+		const pkgconf_dependency_t *prev = iter->data;
+
+		if (iter == req_node)
+			break;
+
+		if (!strcmp(prev->package, req->package))
+			return NULL;
+	}
+
+	PKGCONF_FOREACH_LIST_ENTRY(world->required.head, iter)
+	{
+		const pkgconf_dependency_t *dep = iter->data;
+
+		if (!strcmp(dep->package, req->package))
+			return dep->match;
+	}
+
+	return NULL;
+}
+
+static bool
+apply_json(pkgconf_client_t *client, pkgconf_pkg_t *world, void *data, int maxdepth)
+{
+	const json_flags_t *flags = data;
+	pkgconf_node_t *iter;
+	/* the requested packages are one level below the world package */
+	int pkg_maxdepth = maxdepth > 0 ? maxdepth - 1 : maxdepth;
+	bool first = true;
+
+	printf("{\n  \"packages\": [");
+
+	PKGCONF_FOREACH_LIST_ENTRY(flags->requested->head, iter)
+	{
+		pkgconf_pkg_t *pkg = json_requested_pkg(world, flags->requested, iter);
+
+		if (pkg == NULL)
+			continue;
+
+		pkgconf_pkg_materialize(client, pkg, PKGCONF_PKG_FIELDF_ALL);
+
+		printf("%s\n    {\n      \"id\": ", first ? "" : ",");
+		first = false;
+		print_json_string(pkg->id);
+		printf(",\n      \"name\": ");
+		print_json_string(pkg->realname);
+		printf(",\n      \"description\": ");
+		print_json_string(pkg->description);
+		printf(",\n      \"version\": ");
+		print_json_string(pkg->version);
+		printf(",\n      \"path\": ");
+		print_json_string(pkg->filename);
+
+		print_json_dependencies("requires", &pkg->required);
+		print_json_dependencies("requires_private", &pkg->requires_private);
+		print_json_dependencies("provides", &pkg->provides);
+		print_json_variables(client, pkg);
+
+		if (!print_json_link(client, pkg, pkg_maxdepth, flags, "      "))
+			return false;
+
+		printf("\n    }");
+	}
+
+	printf("\n  ]");
+
+	if (!print_json_link(client, world, maxdepth, flags, "  "))
+		return false;
+
+	printf("\n}\n");
+
+	return true;
+}
+
+static void
+print_stats(const pkgconf_client_t *client)
+{
+	pkgconf_stats_t stats;
+	uint64_t total = 0;
+	int i;
+
+	pkgconf_client_get_stats(client, &stats);
+
+	for (i = 0; i < PKGCONF_STATS_PHASE_COUNT; i++)
+	{
+		fprintf(stderr, "stats: %-18s %10.3f ms\n", pkgconf_stats_phase_name(i), stats.phase_nsec[i] / 1e6);
+		total += stats.phase_nsec[i];
+	}
+
+	fprintf(stderr, "stats: %-18s %10.3f ms\n", "total", total / 1e6);
+	fprintf(stderr, "stats: %-18s %10llu\n", "files-opened", (unsigned long long) stats.files_opened);
+	fprintf(stderr, "stats: %-18s %10llu\n", "probes-failed", (unsigned long long) stats.probes_failed);
+	fprintf(stderr, "stats: %-18s %10llu\n", "bytes-parsed", (unsigned long long) stats.bytes_parsed);
+	fprintf(stderr, "stats: %-18s %10llu\n", "cache-hits", (unsigned long long) stats.cache_hits);
+	fprintf(stderr, "stats: %-18s %10llu\n", "cache-misses", (unsigned long long) stats.cache_misses);
+	fprintf(stderr, "stats: %-18s %10llu\n", "parse-cache-hits", (unsigned long long) stats.parse_cache_hits);
+	fprintf(stderr, "stats: %-18s %10llu\n", "parse-cache-misses", (unsigned long long) stats.parse_cache_misses);
+	fprintf(stderr, "stats: %-18s %10llu\n", "tuple-lookups", (unsigned long long) stats.tuple_lookups);
+	fprintf(stderr, "stats: %-18s %10llu\n", "fragment-copies", (unsigned long long) stats.fragment_copies);
+	fprintf(stderr, "stats: %-18s %10llu\n", "fragment-dedups", (unsigned long long) stats.fragment_dedups);
+	fprintf(stderr, "stats: %-18s %10llu\n", "nodes-visited", (unsigned long long) stats.nodes_visited);
+	fprintf(stderr, "stats: %-18s %10llu\n", "provides-names", (unsigned long long) stats.provides_names);
+	fprintf(stderr, "stats: %-18s %10llu\n", "provides-providers", (unsigned long long) stats.provides_providers);
+
+	/* allocations are counted from when the client was set up, which may be an earlier batched query */
+	if (pkgconf_client_get_allocator(client)->data != &pkg_client_allocs)
+		return;
+
+	for (i = 0; i < PKGCONF_ALLOC_SUBSYSTEM_COUNT; i++)
+	{
+		char name[32];
+
+		snprintf(name, sizeof name, "alloc-%s", pkgconf_alloc_subsystem_name(i));
+		fprintf(stderr, "stats: %-18s %10llu\n", name, (unsigned long long) pkg_client_allocs.subsystems[i].allocations);
+	}
+
+	fprintf(stderr, "stats: %-18s %10llu\n", "alloc-peak-bytes", (unsigned long long) pkg_client_allocs.total.peak_bytes);
+}
+
 static void
 version(void)
 {
@@ -629,6 +969,19 @@ usage(void)
 	printf("  --no-cache                        do not cache already seen packages when\n");
 	printf("                                    walking the dependency graph\n");
 	printf("  --log-file=filename               write an audit log to a specified file\n");
+	printf("  --parse-cache=filename            keep parsed .pc files in a persistent cache file\n");
+	printf("  --scan-threads=count              parse .pc files on worker threads when listing\n");
+	printf("                                    all packages\n");
+	printf("  --stats                           print the time spent in each phase of the query\n");
+	printf("                                    and counts of the work done to stderr\n");
+	printf("  --trace-events=filename           write the spans of the query to a file in the\n");
+	printf("                                    Chrome trace-event format\n");
+	printf("  --batch                           read one query per line from stdin and answer\n");
+	printf("                                    each of them using a shared package cache\n");
+#ifdef HAVE_PKGCONF_SERVE
+	printf("  --serve=socket                    answer queries forwarded through PKG_CONFIG_SERVER\n");
+	printf("                                    on a unix socket, keeping parsed packages warm\n");
+#endif
 	printf("  --with-path=path                  adds a directory to the search path\n");
 	printf("  --define-prefix                   override the prefix variable with one that is guessed based on\n");
 	printf("                                    the location of the .pc file\n");
@@ -693,6 +1046,8 @@ usage(void)
 	printf("  --msvc-syntax                     print translatable fragments in MSVC syntax\n");
 #endif
 	printf("  --fragment-filter=types           filter output fragments to the specified types\n");
+	printf("  --json                            print the version, variables, dependencies and\n");
+	printf("                                    fragments of each module as a JSON document\n");
 
 	printf("\nreport bugs to <%s>.\n", PACKAGE_BUGREPORT);
 }
@@ -776,11 +1131,45 @@ deduce_personality(char *argv[])
 }
 #endif
 
-int
-main(int argc, char *argv[])
+static char *
+client_key_append(char *key, const char *name, const char *value)
+{
+	size_t len = key != NULL ? strlen(key) : 0;
+	size_t size = len + strlen(name) + strlen(value) + 3;
+
+	key = realloc(key, size);
+	snprintf(key + len, size - len, "%s=%s\n", name, value);
+
+	return key;
+}
+
+static void
+client_drop(void)
+{
+	pkgconf_error_handler_func_t trace_handler = pkg_client.trace_handler;
+	pkgconf_stats_t *stats = pkg_client.stats;
+
+	if (!pkg_client_live)
+		return;
+
+	pkgconf_client_deinit(&pkg_client);
+	memset(&pkg_client, 0, sizeof pkg_client);
+	pkg_client.trace_handler = trace_handler;
+	pkg_client.stats = stats;
+
+	pkg_client_live = false;
+	free(pkg_client_key);
+	pkg_client_key = NULL;
+}
+
+static int run_batch(int argc, char *argv[]);
+
+static int
+run_query(int argc, char *argv[])
 {
 	int ret;
 	pkgconf_list_t pkgq = PKGCONF_LIST_INITIALIZER;
+	pkgconf_list_t json_requested = PKGCONF_LIST_INITIALIZER;
 	pkgconf_list_t dir_list = PKGCONF_LIST_INITIALIZER;
 	char *builddir;
 	char *sysroot_dir;
@@ -790,22 +1179,36 @@ main(int argc, char *argv[])
 	char *required_max_module_version = NULL;
 	char *required_module_version = NULL;
 	char *logfile_arg = NULL;
+	char *parse_cache_arg = NULL;
+	char *scan_threads_arg = NULL;
+	char *trace_events_arg = NULL;
+	FILE *trace_events_out = NULL;
+	char *serve_arg = NULL;
 	char *want_env_prefix = NULL;
+	char *prefix_varname = NULL;
+	char **defines = NULL;
+	size_t define_count = 0;
+	char *client_key = NULL;
+	char flagbuf[64];
+	bool reuse_client = false;
 	unsigned int want_client_flags = PKGCONF_PKG_PKGF_NONE;
 	pkgconf_cross_personality_t *personality = NULL;
 	bool opened_error_msgout = false;
+	bool want_pure = false;
+	bool want_stats = false;
 
+	/* in batch mode every query starts over from the defaults */
 	want_flags = 0;
+	maximum_traverse_depth = 2000;
+	maximum_package_count = 0;
+	want_variable = NULL;
+	want_fragment_filter = NULL;
+	want_render_ops = NULL;
+	logfile_out = NULL;
+	pkg_optind = 1;
+	pkg_optreset = 1;
 
-#ifdef _WIN32
-	/* When running regression tests in cygwin, and building native
-	 * executable, tests fail unless native executable outputs unix
-	 * line endings.  Come to think of it, this will probably help
-	 * real people who use cygwin build environments but native pkgconf, too.
-	 */
-	_setmode(fileno(stdout), O_BINARY);
-	_setmode(fileno(stderr), O_BINARY);
-#endif
+	defines = calloc(argc, sizeof(char *));
 
 	struct pkg_option options[] = {
 		{ "version", no_argument, &want_flags, PKG_VERSION|PKG_PRINT_ERRORS, },
@@ -869,10 +1272,19 @@ main(int argc, char *argv[])
 		{ "msvc-syntax", no_argument, &want_flags, PKG_MSVC_SYNTAX },
 #endif
 		{ "fragment-filter", required_argument, NULL, 50 },
+		{ "json", no_argument, &want_flags, PKG_JSON|PKG_PRINT_ERRORS },
+		{ "stats", no_argument, &want_flags, PKG_STATS },
 		{ "internal-cflags", no_argument, &want_flags, PKG_INTERNAL_CFLAGS },
 #ifndef PKGCONF_LITE
 		{ "dump-personality", no_argument, &want_flags, PKG_DUMP_PERSONALITY },
 		{ "personality", required_argument, NULL, 53 },
+#endif
+		{ "parse-cache", required_argument, NULL, 54 },
+		{ "scan-threads", required_argument, NULL, 56 },
+		{ "trace-events", required_argument, NULL, 57 },
+		{ "batch", no_argument, &want_flags, PKG_BATCH },
+#ifdef HAVE_PKGCONF_SERVE
+		{ "serve", required_argument, NULL, 55 },
 #endif
 		{ NULL, 0, NULL, 0 }
 	};
@@ -902,7 +1314,8 @@ main(int argc, char *argv[])
 			maximum_traverse_depth = atoi(pkg_optarg);
 			break;
 		case 27:
-			pkgconf_tuple_define_global(&pkg_client, pkg_optarg);
+			defines[define_count++] = pkg_optarg;
+			client_key = client_key_append(client_key, "define-variable", pkg_optarg);
 			break;
 		case 28:
 			required_exact_module_version = pkg_optarg;
@@ -915,13 +1328,16 @@ main(int argc, char *argv[])
 			break;
 		case 42:
 			pkgconf_path_add(pkg_optarg, &dir_list, true);
+			client_key = client_key_append(client_key, "with-path", pkg_optarg);
 			break;
 		case 43:
-			pkgconf_client_set_prefix_varname(&pkg_client, pkg_optarg);
+			prefix_varname = pkg_optarg;
+			client_key = client_key_append(client_key, "prefix-variable", pkg_optarg);
 			break;
 		case 45:
 			relocate_path(pkg_optarg);
-			return EXIT_SUCCESS;
+			ret = EXIT_SUCCESS;
+			goto out;
 		case 48:
 			want_env_prefix = pkg_optarg;
 			break;
@@ -931,8 +1347,22 @@ main(int argc, char *argv[])
 #ifndef PKGCONF_LITE
 		case 53:
 			personality = pkgconf_cross_personality_find(pkg_optarg);
+			client_key = client_key_append(client_key, "personality", pkg_optarg);
 			break;
 #endif
+		case 54:
+			parse_cache_arg = pkg_optarg;
+			client_key = client_key_append(client_key, "parse-cache", pkg_optarg);
+			break;
+		case 55:
+			serve_arg = pkg_optarg;
+			break;
+		case 56:
+			scan_threads_arg = pkg_optarg;
+			break;
+		case 57:
+			trace_events_arg = pkg_optarg;
+			break;
 		case '?':
 		case ':':
 			ret = EXIT_FAILURE;
@@ -942,6 +1372,36 @@ main(int argc, char *argv[])
 		}
 	}
 
+#ifdef HAVE_PKGCONF_SERVE
+	if (!batch_mode && serve_arg == NULL && (want_flags & PKG_BATCH) != PKG_BATCH)
+	{
+		const char *server = getenv("PKG_CONFIG_SERVER");
+
+		/* if no server is running, answer the query ourselves */
+		if (server != NULL && *server != '\0' && serve_forward(server, argc, argv, &ret))
+			goto out;
+	}
+
+	if (serve_arg != NULL && !batch_mode)
+	{
+		pkgconf_path_free(&dir_list);
+		free(defines);
+		free(client_key);
+
+		batch_mode = serve_mode = true;
+		return serve_main(serve_arg, &pkg_client, run_query, client_drop);
+	}
+#endif
+
+	if ((want_flags & PKG_BATCH) == PKG_BATCH && !batch_mode)
+	{
+		pkgconf_path_free(&dir_list);
+		free(defines);
+		free(client_key);
+
+		return run_batch(argc, argv);
+	}
+
 	if (personality == NULL) {
 #ifndef PKGCONF_LITE
 		personality = deduce_personality(argv);
@@ -957,12 +1417,71 @@ main(int argc, char *argv[])
 	if ((want_flags & PKG_DUMP_PERSONALITY) == PKG_DUMP_PERSONALITY)
 	{
 		dump_personality(personality);
-		return EXIT_SUCCESS;
+		ret = EXIT_SUCCESS;
+		goto out;
 	}
 #endif
 
-	/* now, bring up the client.  settings are preserved since the client is prealloced */
-	pkgconf_client_init(&pkg_client, error_handler, NULL, personality);
+	snprintf(flagbuf, sizeof flagbuf, "%llx", (unsigned long long) (want_flags & PKG_CLIENT_OPTIONS));
+	client_key = client_key_append(client_key, "flags", flagbuf);
+
+#ifdef HAVE_PKGCONF_SERVE
+	/* a server answers queries coming from many environments and working directories */
+	if (serve_mode)
+	{
+		char cwd[PKGCONF_ITEM_SIZE];
+		char **env;
+
+		if (getcwd(cwd, sizeof cwd) != NULL)
+			client_key = client_key_append(client_key, "cwd", cwd);
+
+		for (env = environ; *env != NULL; env++)
+		{
+			if (serve_env_forwarded(*env))
+				client_key = client_key_append(client_key, "env", *env);
+		}
+	}
+#endif
+
+	/* statistics are kept per query, and cover setting up the client unless it is reused */
+	want_stats = (want_flags & PKG_STATS) == PKG_STATS;
+	pkgconf_client_set_stats(&pkg_client, want_stats ? &pkg_client_stats : NULL);
+
+	/* a batched query can keep using the previous query's client if it was set up the same way,
+	 * unless that client has grown too large
+	 */
+	if (batch_mode && pkg_client_key != NULL && !strcmp(client_key, pkg_client_key) &&
+	    pkgconf_client_get_retained_bytes(&pkg_client) < PKG_CLIENT_RETAINED_MAX)
+	{
+		reuse_client = true;
+		pkg_client.already_sent_notice = false;
+		pkgconf_cache_reset_hits(&pkg_client);
+
+		pkgconf_client_set_error_handler(&pkg_client, error_handler, NULL);
+		pkgconf_client_set_warn_handler(&pkg_client, NULL, NULL);
+#ifndef PKGCONF_LITE
+		if (!getenv("PKG_CONFIG_EARLY_TRACE"))
+			pkgconf_client_set_trace_handler(&pkg_client, NULL, NULL);
+#endif
+	}
+	else
+	{
+		client_drop();
+
+		/* with --stats, the client's allocations are counted as well */
+		pkgconf_counting_allocator_init(&pkg_client_allocs);
+		pkgconf_client_set_allocator(&pkg_client, want_stats ? &pkg_client_allocs.allocator : NULL);
+
+		for (size_t i = 0; i < define_count; i++)
+			pkgconf_tuple_define_global(&pkg_client, defines[i]);
+
+		if (prefix_varname != NULL)
+			pkgconf_client_set_prefix_varname(&pkg_client, prefix_varname);
+
+		/* now, bring up the client.  settings are preserved since the client is prealloced */
+		pkgconf_client_init(&pkg_client, error_handler, NULL, personality);
+		pkg_client_live = batch_mode;
+	}
 
 #ifndef PKGCONF_LITE
 	if ((want_flags & PKG_MSVC_SYNTAX) == PKG_MSVC_SYNTAX || getenv("PKG_CONFIG_MSVC_SYNTAX") != NULL)
@@ -1049,7 +1568,10 @@ main(int argc, char *argv[])
 	 * --static were disabled.  see <https://github.com/pkgconf/pkgconf/issues/83> for rationale.
 	 */
 	if ((want_flags & PKG_PURE) == PKG_PURE || getenv("PKG_CONFIG_PURE_DEPGRAPH") != NULL || personality->want_default_pure)
+	{
 		want_client_flags &= ~PKGCONF_PKG_PKGF_MERGE_PRIVATE_FRAGMENTS;
+		want_pure = true;
+	}
 
 	if ((want_flags & PKG_ENV_ONLY) == PKG_ENV_ONLY)
 		want_client_flags |= PKGCONF_PKG_PKGF_ENV_ONLY;
@@ -1076,6 +1598,14 @@ main(int argc, char *argv[])
 	if ((want_flags & PKG_INTERNAL_CFLAGS) == PKG_INTERNAL_CFLAGS)
 		want_client_flags |= PKGCONF_PKG_PKGF_DONT_FILTER_INTERNAL_CFLAGS;
 
+	/* these queries do not need the fragments of the packages they load, nor the dependencies
+	 * of the packages they do not traverse.  --validate wants the diagnostics of every field.
+	 */
+	if (((want_flags & (PKG_LIST | PKG_LIST_PACKAGE_NAMES | PKG_EXISTS | PKG_MODVERSION)) != 0 ||
+	    required_module_version != NULL || required_exact_module_version != NULL || required_max_module_version != NULL) &&
+	    (want_flags & PKG_VALIDATE) != PKG_VALIDATE)
+		want_client_flags |= PKGCONF_PKG_PKGF_LAZY_PARSE;
+
 #ifdef XXX_NOTYET
 	/* if these selectors are used, it means that we are inquiring about a single package.
 	 * so signal to libpkgconf that we do not want to use the dependency resolver for more than one level,
@@ -1105,14 +1635,15 @@ main(int argc, char *argv[])
 	if (getenv("PKG_CONFIG_ALLOW_SYSTEM_LIBS") != NULL)
 		want_flags |= PKG_KEEP_SYSTEM_LIBS;
 
-	if ((builddir = getenv("PKG_CONFIG_TOP_BUILD_DIR")) != NULL)
+	if ((builddir = getenv("PKG_CONFIG_TOP_BUILD_DIR")) != NULL && !reuse_client)
 		pkgconf_client_set_buildroot_dir(&pkg_client, builddir);
 
 	if ((sysroot_dir = getenv("PKG_CONFIG_SYSROOT_DIR")) != NULL)
 	{
 		const char *destdir;
 
-		pkgconf_client_set_sysroot_dir(&pkg_client, sysroot_dir);
+		if (!reuse_client)
+			pkgconf_client_set_sysroot_dir(&pkg_client, sysroot_dir);
 
 		if ((destdir = getenv("DESTDIR")) != NULL)
 		{
@@ -1121,11 +1652,42 @@ main(int argc, char *argv[])
 		}
 	}
 
+	if (parse_cache_arg == NULL)
+		parse_cache_arg = getenv("PKG_CONFIG_PARSE_CACHE");
+
+	if (parse_cache_arg != NULL && !reuse_client)
+		pkgconf_parsecache_open(&pkg_client, parse_cache_arg);
+
+	if (scan_threads_arg == NULL)
+		scan_threads_arg = getenv("PKG_CONFIG_SCAN_THREADS");
+
+	/* the thread count does not change the output, so a shared client just follows the query */
+	if (scan_threads_arg != NULL && atoi(scan_threads_arg) > 0)
+		pkgconf_client_set_scan_threads(&pkg_client, atoi(scan_threads_arg));
+	else
+		pkgconf_client_set_scan_threads(&pkg_client, 0);
+
 	/* we have determined what features we want most likely.  in some cases, we override later. */
 	pkgconf_client_set_flags(&pkg_client, want_client_flags);
 
 	/* at this point, want_client_flags should be set, so build the dir list */
-	pkgconf_client_dir_list_build(&pkg_client, personality);
+	if (!reuse_client)
+	{
+		pkgconf_client_dir_list_build(&pkg_client, personality);
+
+		/* the client is fully set up now, so later queries may share it */
+		if (batch_mode)
+			pkg_client_key = strdup(client_key);
+	}
+
+	if (trace_events_arg == NULL)
+		trace_events_arg = getenv("PKG_CONFIG_TRACE_EVENTS");
+
+	if (trace_events_arg != NULL && (trace_events_out = fopen(trace_events_arg, "w")) != NULL)
+		pkgconf_traceevent_open(&pkg_client, trace_events_out);
+
+	/* everything the query allocates from here on is released in bulk when it ends */
+	pkgconf_client_begin_query(&pkg_client);
 
 	if (required_pkgconfig_version != NULL)
 	{
@@ -1304,7 +1866,12 @@ main(int argc, char *argv[])
 			pkg_optind += 3;
 
 			pkgconf_queue_push(&pkgq, packagebuf);
+			package = packagebuf;
 		}
+
+		/* --json describes the queried modules only, so remember which ones they are */
+		if ((want_flags & PKG_JSON) == PKG_JSON)
+			pkgconf_dependency_parse_str(&pkg_client, &json_requested, package, 0);
 	}
 
 	if (pkgq.head == NULL)
@@ -1337,7 +1904,7 @@ main(int argc, char *argv[])
 	}
 
 	if ((want_flags & PKG_VALIDATE) == PKG_VALIDATE)
-		return 0;
+		goto out;
 
 	if ((want_flags & PKG_UNINSTALLED) == PKG_UNINSTALLED)
 	{
@@ -1357,6 +1924,32 @@ main(int argc, char *argv[])
 		want_flags = 0;
 	}
 
+	if ((want_flags & PKG_JSON) == PKG_JSON)
+	{
+		json_flags_t json_flags = {.requested = &json_requested};
+
+		/* the fragment selectors narrow down the fragment lists, which are complete by default */
+		if (!(want_flags & PKG_CFLAGS))
+			want_flags |= PKG_CFLAGS;
+
+		if (!(want_flags & PKG_LIBS))
+			want_flags |= PKG_LIBS;
+
+		json_flags.cflags = want_client_flags | PKGCONF_PKG_PKGF_SEARCH_PRIVATE;
+		json_flags.libs = want_client_flags & ~(PKGCONF_PKG_PKGF_SEARCH_PRIVATE | PKGCONF_PKG_PKGF_MERGE_PRIVATE_FRAGMENTS);
+		json_flags.libs_static = want_client_flags | PKGCONF_PKG_PKGF_SEARCH_PRIVATE;
+		if (!want_pure)
+			json_flags.libs_static |= PKGCONF_PKG_PKGF_MERGE_PRIVATE_FRAGMENTS;
+
+		pkgconf_client_set_flags(&pkg_client, json_flags.cflags);
+
+		if (!pkgconf_queue_apply(&pkg_client, &pkgq, apply_json, maximum_traverse_depth, &json_flags))
+			ret = EXIT_FAILURE;
+
+		pkgconf_client_set_flags(&pkg_client, want_client_flags);
+		goto out;
+	}
+
 	if ((want_flags & PKG_PROVIDES) == PKG_PROVIDES)
 	{
 		want_flags &= ~(PKG_CFLAGS|PKG_LIBS);
@@ -1481,13 +2074,126 @@ out_println:
 
 out:
 	pkgconf_queue_free(&pkgq);
-	pkgconf_cross_personality_deinit(personality);
-	pkgconf_client_deinit(&pkg_client);
+	pkgconf_dependency_free(&json_requested);
+	if (personality != NULL)
+		pkgconf_cross_personality_deinit(personality);
+
+	pkgconf_client_end_query(&pkg_client);
+	pkgconf_traceevent_close(&pkg_client);
+
+	if (want_stats)
+	{
+		print_stats(&pkg_client);
+		pkgconf_client_set_stats(&pkg_client, NULL);
+	}
+
+	/* batched queries leave the client (and its package cache) to the next query */
+	if (batch_mode)
+		pkgconf_audit_set_log(&pkg_client, NULL);
+	else
+		pkgconf_client_deinit(&pkg_client);
 
 	if (logfile_out != NULL)
 		fclose(logfile_out);
+	if (trace_events_out != NULL)
+		fclose(trace_events_out);
 	if (opened_error_msgout)
 		fclose(error_msgout);
 
+	free(defines);
+	free(client_key);
+
 	return ret;
 }
+
+/*
+ * Batch mode: every line of stdin is a query, made of options and package
+ * expressions like a regular command line.  The options given along with --batch
+ * apply to every query.  Each query's output is followed by a terminator line,
+ * consisting of an ASCII record separator and the query's exit status.
+ */
+static int
+run_batch(int argc, char *argv[])
+{
+	char linebuf[PKGCONF_BUFSIZE];
+	int ret = EXIT_SUCCESS;
+
+	batch_mode = true;
+
+	while (fgets(linebuf, sizeof linebuf, stdin) != NULL)
+	{
+		int line_argc, query_argc, query_ret, i;
+		char **line_argv, **query_argv;
+		size_t len = strlen(linebuf);
+
+		/* the rest of a line which does not fit is skipped, rather than taken as another query */
+		if (len == sizeof linebuf - 1 && linebuf[len - 1] != '\n' && !feof(stdin))
+		{
+			int c;
+
+			while ((c = getchar()) != EOF && c != '\n')
+				;
+
+			fprintf(stderr, "Query too long: lines are limited to %zu characters\n", sizeof linebuf - 2);
+			query_ret = EXIT_FAILURE;
+			goto next;
+		}
+
+		linebuf[strcspn(linebuf, "\r\n")] = '\0';
+
+		if (pkgconf_argv_split(linebuf, &line_argc, &line_argv) < 0)
+		{
+			fprintf(stderr, "Malformed query: %s\n", linebuf);
+			query_ret = EXIT_FAILURE;
+			goto next;
+		}
+
+		if (line_argc == 0)
+		{
+			pkgconf_argv_free(line_argv);
+			continue;
+		}
+
+		query_argc = argc + line_argc;
+		query_argv = calloc(query_argc + 1, sizeof(char *));
+
+		for (i = 0; i < argc; i++)
+			query_argv[i] = argv[i];
+
+		for (i = 0; i < line_argc; i++)
+			query_argv[argc + i] = line_argv[i];
+
+		query_ret = run_query(query_argc, query_argv);
+
+		free(query_argv);
+		pkgconf_argv_free(line_argv);
+
+next:
+		if (query_ret != EXIT_SUCCESS)
+			ret = EXIT_FAILURE;
+
+		fflush(stderr);
+		printf("\036%d\n", query_ret);
+		fflush(stdout);
+	}
+
+	client_drop();
+
+	return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+#ifdef _WIN32
+	/* When running regression tests in cygwin, and building native
+	 * executable, tests fail unless native executable outputs unix
+	 * line endings.  Come to think of it, this will probably help
+	 * real people who use cygwin build environments but native pkgconf, too.
+	 */
+	_setmode(fileno(stdout), O_BINARY);
+	_setmode(fileno(stderr), O_BINARY);
+#endif
+
+	return run_query(argc, argv);
+}
@@ -0,0 +1,876 @@
+/*
+ * serve.c
+ * long-running query server and thin client
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include "libpkgconf/config.h"
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
+#include "serve.h"
+
+#ifdef HAVE_PKGCONF_SERVE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#ifdef __linux__
+# include <sys/inotify.h>
+# define SERVE_INOTIFY
+#endif
+
+/*
+ * A query is sent as a fixed header, which carries the client's stdout and stderr
+ * descriptors as SCM_RIGHTS ancillary data, followed by a block of NUL-terminated
+ * strings: the working directory, argc arguments and envc environment entries.
+ * Once the server has received the whole query, it acknowledges it with the magic
+ * number, and only runs it after the client confirms with a byte that it is still
+ * waiting for the answer.  A client which timed out before the acknowledgement can
+ * thus answer the query itself without risking a second answer from the server.
+ * The server writes the query's output straight to the passed descriptors, and
+ * answers with the query's exit status as a 32-bit integer.
+ */
+#define SERVE_MAGIC		0x706b6331
+#define SERVE_MAX_REQUEST	(1024 * 1024)
+#define SERVE_TIMEOUT		5
+#define SERVE_QUERY_TIMEOUT	60
+#define SERVE_MAX_FDS		16
+#define SERVE_MAX_CONNECTIONS	64
+
+typedef struct {
+	uint32_t magic;
+	uint32_t argc;
+	uint32_t envc;
+	uint32_t size;
+} serve_request_t;
+
+/* a file or directory the warm client depends on */
+typedef struct {
+	char *path;
+	bool polled;
+	bool exists;
+	time_t ctime;
+	ino_t ino;
+} serve_watch_t;
+
+typedef struct {
+	pkgconf_client_t *client;
+	serve_query_func_t query_func;
+	serve_reset_func_t reset_func;
+
+	pkgconf_hash_t watches;
+	int inotify_fd;
+	bool stale;
+	time_t started;
+
+	int stdout_fd;
+	int stderr_fd;
+} serve_state_t;
+
+/* a connection whose query is still being received */
+typedef struct {
+	int fd;
+	time_t deadline;
+	serve_request_t req;
+	size_t received;
+	char *buf;
+	int fds[2];
+} serve_conn_t;
+
+static volatile sig_atomic_t serve_quit = 0;
+
+/* environment variables besides PKG_CONFIG_* which change the answer to a query */
+static const char *serve_env_names[] = {
+	"BELIBRARIES",
+	"CPATH",
+	"CPLUS_INCLUDE_PATH",
+	"C_INCLUDE_PATH",
+	"DESTDIR",
+	"LIBRARY_PATH",
+	"OBJC_INCLUDE_PATH",
+};
+
+bool
+serve_env_forwarded(const char *envvar)
+{
+	size_t i, len = strcspn(envvar, "=");
+
+	if (!strncmp(envvar, "PKG_CONFIG_", 11))
+		return strncmp(envvar, "PKG_CONFIG_SERVER=", 18) != 0;
+
+	for (i = 0; i < PKGCONF_ARRAY_SIZE(serve_env_names); i++)
+	{
+		if (strlen(serve_env_names[i]) == len && !strncmp(envvar, serve_env_names[i], len))
+			return true;
+	}
+
+	return false;
+}
+
+static bool
+read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+
+	while (len > 0)
+	{
+		ssize_t n = read(fd, p, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static bool
+write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len > 0)
+	{
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static void
+serve_watch_stat(serve_watch_t *watch)
+{
+	struct stat st;
+
+	watch->exists = stat(watch->path, &st) == 0;
+	watch->ctime = watch->exists ? st.st_ctime : 0;
+	watch->ino = watch->exists ? st.st_ino : 0;
+}
+
+static void
+serve_watch_add(serve_state_t *state, const char *path)
+{
+	char pathbuf[PKGCONF_ITEM_SIZE];
+	serve_watch_t *watch;
+
+	/* relative paths are relative to the query's working directory */
+	if (*path != '/')
+	{
+		char cwd[PKGCONF_ITEM_SIZE];
+
+		if (getcwd(cwd, sizeof cwd) == NULL)
+			return;
+
+		if ((size_t) snprintf(pathbuf, sizeof pathbuf, "%s/%s", cwd, path) >= sizeof pathbuf)
+			return;
+
+		path = pathbuf;
+	}
+
+	if (pkgconf_hash_lookup(&state->watches, path, strlen(path)) != NULL)
+		return;
+
+	watch = calloc(1, sizeof(serve_watch_t));
+	watch->path = strdup(path);
+	watch->polled = true;
+	serve_watch_stat(watch);
+
+	/* a change which raced with parsing cannot be told apart from an older one, so start over */
+	if (watch->exists && watch->ctime >= state->started - 1)
+		state->stale = true;
+
+#ifdef SERVE_INOTIFY
+	if (state->inotify_fd >= 0 && inotify_add_watch(state->inotify_fd, path,
+		IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF |
+		IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO) >= 0)
+		watch->polled = false;
+#endif
+
+	pkgconf_hash_insert(&state->watches, watch->path, strlen(watch->path), watch);
+}
+
+static void
+serve_watch_client(serve_state_t *state)
+{
+	pkgconf_client_t *client = state->client;
+	pkgconf_node_t *n;
+	pkgconf_pkg_t *pkg;
+	size_t cursor = 0;
+
+	PKGCONF_FOREACH_LIST_ENTRY(client->dir_list.head, n)
+	{
+		pkgconf_path_t *pnode = n->data;
+
+		serve_watch_add(state, pnode->path);
+	}
+
+	while ((pkg = pkgconf_hash_next(&client->cache_table, &cursor)) != NULL)
+	{
+		if (pkg->filename != NULL)
+			serve_watch_add(state, pkg->filename);
+	}
+}
+
+#ifdef SERVE_INOTIFY
+static bool
+serve_inotify_changed(serve_state_t *state)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+	ssize_t len;
+
+	while ((len = read(state->inotify_fd, buf, sizeof buf)) > 0)
+	{
+		char *p = buf;
+
+		while (p < buf + len)
+		{
+			const struct inotify_event *ev = (const struct inotify_event *) p;
+			size_t namelen = ev->len ? strlen(ev->name) : 0;
+
+			/* events on a watched file always count, inside a search directory only .pc files do */
+			if (namelen == 0 || (namelen > 3 && !strcmp(ev->name + namelen - 3, ".pc")))
+				changed = true;
+
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+
+	return changed;
+}
+#endif
+
+static bool
+serve_watch_changed(serve_state_t *state)
+{
+	serve_watch_t *watch;
+	size_t cursor = 0;
+
+#ifdef SERVE_INOTIFY
+	if (state->inotify_fd >= 0 && serve_inotify_changed(state))
+		return true;
+#endif
+
+	while ((watch = pkgconf_hash_next(&state->watches, &cursor)) != NULL)
+	{
+		serve_watch_t now = { .path = watch->path };
+
+		if (!watch->polled)
+			continue;
+
+		serve_watch_stat(&now);
+
+		if (now.exists != watch->exists || now.ctime != watch->ctime || now.ino != watch->ino)
+			return true;
+	}
+
+	return false;
+}
+
+static void
+serve_watch_free(serve_state_t *state)
+{
+	serve_watch_t *watch;
+	size_t cursor = 0;
+
+	while ((watch = pkgconf_hash_next(&state->watches, &cursor)) != NULL)
+	{
+		free(watch->path);
+		free(watch);
+	}
+
+	pkgconf_hash_free(&state->watches);
+
+#ifdef SERVE_INOTIFY
+	if (state->inotify_fd >= 0)
+		close(state->inotify_fd);
+#endif
+	state->inotify_fd = -1;
+}
+
+static void
+serve_reset(serve_state_t *state)
+{
+	PKGCONF_TRACE(state->client, "package files changed, dropping warm client");
+
+	state->reset_func();
+	serve_watch_free(state);
+
+#ifdef SERVE_INOTIFY
+	state->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+	state->stale = false;
+}
+
+static void
+serve_apply_environ(char **env, size_t envc)
+{
+	char **iter;
+	size_t i;
+
+	/* drop whatever the previous query (or our own parent) forwarded */
+restart:
+	for (iter = environ; *iter != NULL; iter++)
+	{
+		if (serve_env_forwarded(*iter))
+		{
+			char namebuf[PKGCONF_ITEM_SIZE];
+
+			pkgconf_strlcpy(namebuf, *iter, sizeof namebuf);
+			namebuf[strcspn(namebuf, "=")] = '\0';
+			unsetenv(namebuf);
+			goto restart;
+		}
+	}
+
+	for (i = 0; i < envc; i++)
+	{
+		char namebuf[PKGCONF_ITEM_SIZE];
+		char *value = strchr(env[i], '=');
+
+		if (value == NULL || !serve_env_forwarded(env[i]))
+			continue;
+
+		pkgconf_strlcpy(namebuf, env[i], sizeof namebuf);
+		namebuf[value - env[i]] = '\0';
+		setenv(namebuf, value + 1, 1);
+	}
+}
+
+/* closes the descriptors of a control message the server has no use for */
+static void
+serve_close_fds(const struct cmsghdr *cmsg)
+{
+	size_t i, count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+	for (i = 0; i < count; i++)
+	{
+		int fd;
+
+		memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+		close(fd);
+	}
+}
+
+/*
+ * reads as much of the header of a query as has arrived.  returns -1 if the peer hung up
+ * or sent a malformed query, 0 if more is to come and 1 once the header is complete.
+ */
+static int
+serve_conn_recv_header(serve_conn_t *conn)
+{
+	/* leaves room for more descriptors than a query carries, so that stray ones are seen and closed */
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(SERVE_MAX_FDS * sizeof(int))];
+	} control;
+	struct iovec iov = {
+		.iov_base = (char *) &conn->req + conn->received,
+		.iov_len = sizeof(serve_request_t) - conn->received,
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof control.buf,
+	};
+	struct cmsghdr *cmsg;
+	ssize_t len;
+
+	do
+		len = recvmsg(conn->fd, &msg, MSG_DONTWAIT);
+	while (len < 0 && errno == EINTR);
+
+	if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+	if (len <= 0)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		/* only the first message of exactly two descriptors is used, everything else is closed */
+		if (cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int)) && conn->fds[0] < 0 && !(msg.msg_flags & MSG_CTRUNC))
+			memcpy(conn->fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+		else
+			serve_close_fds(cmsg);
+	}
+
+	conn->received += len;
+	if (conn->received < sizeof(serve_request_t))
+		return 0;
+
+	if (conn->req.magic != SERVE_MAGIC || conn->req.size == 0 || conn->req.size > SERVE_MAX_REQUEST ||
+	    conn->fds[0] < 0 || conn->fds[1] < 0)
+		return -1;
+
+	return 1;
+}
+
+static int
+serve_run(serve_state_t *state, int fds[2], char *buf, const serve_request_t *req)
+{
+	char **argv, **env, *p = buf, *end = buf + req->size;
+	const char *cwd;
+	size_t i;
+	int ret = -1;
+
+	/* every string, including the last one, has to be terminated inside the request */
+	if (end[-1] != '\0')
+		return -1;
+
+	argv = calloc(req->argc + 1, sizeof(char *));
+	env = calloc(req->envc + 1, sizeof(char *));
+
+	cwd = p;
+	p += strlen(p) + 1;
+
+	for (i = 0; i < req->argc + req->envc; i++)
+	{
+		if (p >= end)
+			goto out;
+
+		if (i < req->argc)
+			argv[i] = p;
+		else
+			env[i - req->argc] = p;
+
+		p += strlen(p) + 1;
+	}
+
+	if (req->argc == 0)
+		goto out;
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(fds[0], STDOUT_FILENO);
+	dup2(fds[1], STDERR_FILENO);
+
+	if (chdir(cwd) == 0)
+	{
+		serve_apply_environ(env, req->envc);
+		state->started = time(NULL);
+
+		if (state->stale || serve_watch_changed(state))
+			serve_reset(state);
+
+		ret = state->query_func(req->argc, argv);
+
+		serve_watch_client(state);
+	}
+	else
+	{
+		fprintf(stderr, "%s: %s\n", cwd, strerror(errno));
+		ret = EXIT_FAILURE;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(state->stdout_fd, STDOUT_FILENO);
+	dup2(state->stderr_fd, STDERR_FILENO);
+
+out:
+	free(argv);
+	free(env);
+
+	return ret;
+}
+
+static void
+serve_conn_close(serve_conn_t *conn)
+{
+	free(conn->buf);
+
+	if (conn->fds[0] >= 0)
+		close(conn->fds[0]);
+	if (conn->fds[1] >= 0)
+		close(conn->fds[1]);
+
+	close(conn->fd);
+}
+
+/*
+ * reads what a connection has sent so far, and answers its query once the whole of it
+ * has arrived and the client confirmed it.  returns false once the connection is done
+ * with, one way or another.
+ */
+static bool
+serve_conn_read(serve_state_t *state, serve_conn_t *conn)
+{
+	uint32_t ack = SERVE_MAGIC;
+	int32_t status;
+	ssize_t len;
+	char confirm;
+	int ret;
+
+	if (conn->buf == NULL)
+	{
+		ret = serve_conn_recv_header(conn);
+		if (ret <= 0)
+			return ret == 0;
+
+		conn->buf = malloc(conn->req.size);
+		if (conn->buf == NULL)
+			return false;
+
+		conn->received = 0;
+	}
+
+	if (conn->received < conn->req.size)
+	{
+		do
+			len = read(conn->fd, conn->buf + conn->received, conn->req.size - conn->received);
+		while (len < 0 && errno == EINTR);
+
+		if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return true;
+		if (len <= 0)
+			return false;
+
+		conn->received += len;
+		if (conn->received < conn->req.size)
+			return true;
+
+		conn->deadline = time(NULL) + SERVE_TIMEOUT;
+		return write_full(conn->fd, &ack, sizeof ack);
+	}
+
+	/* a client which hung up instead of confirming answered the query itself */
+	do
+		len = read(conn->fd, &confirm, sizeof confirm);
+	while (len < 0 && errno == EINTR);
+
+	if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return true;
+	if (len <= 0)
+		return false;
+
+	ret = serve_run(state, conn->fds, conn->buf, &conn->req);
+	if (ret < 0)
+		return false;
+
+	status = ret;
+	write_full(conn->fd, &status, sizeof status);
+
+	return false;
+}
+
+static void
+serve_accept(int listen_fd, serve_conn_t *conn)
+{
+	int fd;
+
+	do
+		fd = accept(listen_fd, NULL, NULL);
+	while (fd < 0 && errno == EINTR);
+
+	conn->fd = fd;
+	if (fd < 0)
+		return;
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	conn->deadline = time(NULL) + SERVE_TIMEOUT;
+	conn->received = 0;
+	conn->buf = NULL;
+	conn->fds[0] = conn->fds[1] = -1;
+}
+
+static void
+serve_signal(int sig)
+{
+	(void) sig;
+
+	serve_quit = 1;
+}
+
+/*
+ * Keeps one client warm and answers queries forwarded by serve_forward() until
+ * SIGINT or SIGTERM.  The warm client is dropped whenever a search directory or a
+ * loaded .pc file changes, which is noticed through inotify where available and
+ * by comparing change times otherwise.
+ */
+int
+serve_main(const char *path, pkgconf_client_t *client, serve_query_func_t query_func, serve_reset_func_t reset_func)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct sigaction sa = { .sa_handler = serve_signal };
+	serve_state_t state = {
+		.client = client,
+		.query_func = query_func,
+		.reset_func = reset_func,
+		.inotify_fd = -1,
+	};
+	serve_conn_t conns[SERVE_MAX_CONNECTIONS];
+	struct pollfd pfds[SERVE_MAX_CONNECTIONS + 1];
+	size_t nconns = 0;
+	int listen_fd, probe_fd;
+	mode_t mask;
+
+	if (strlen(path) >= sizeof addr.sun_path)
+	{
+		fprintf(stderr, "%s: socket path is too long\n", path);
+		return EXIT_FAILURE;
+	}
+
+	pkgconf_strlcpy(addr.sun_path, path, sizeof addr.sun_path);
+
+	/* refuse to take over the socket of a live server, but clean up after a dead one */
+	probe_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (probe_fd >= 0 && connect(probe_fd, (struct sockaddr *) &addr, sizeof addr) == 0)
+	{
+		fprintf(stderr, "%s: a server is already listening on this socket\n", path);
+		close(probe_fd);
+		return EXIT_FAILURE;
+	}
+
+	if (probe_fd >= 0)
+		close(probe_fd);
+
+	unlink(path);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	/* only the user running the server may talk to it */
+	mask = umask(077);
+	if (bind(listen_fd, (struct sockaddr *) &addr, sizeof addr) != 0 || listen(listen_fd, 64) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		umask(mask);
+		close(listen_fd);
+		return EXIT_FAILURE;
+	}
+	umask(mask);
+
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	state.stdout_fd = dup(STDOUT_FILENO);
+	state.stderr_fd = dup(STDERR_FILENO);
+#ifdef SERVE_INOTIFY
+	state.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+
+	PKGCONF_TRACE(client, "serving queries on %s", path);
+
+	/*
+	 * queries are answered one at a time, but are received from every connection at once,
+	 * so that a peer which is slow to send its query does not hold up the others.
+	 */
+	while (!serve_quit)
+	{
+		size_t i;
+
+		pfds[0].fd = listen_fd;
+		pfds[0].events = nconns < SERVE_MAX_CONNECTIONS ? POLLIN : 0;
+		for (i = 0; i < nconns; i++)
+		{
+			pfds[i + 1].fd = conns[i].fd;
+			pfds[i + 1].events = POLLIN;
+		}
+
+		if (poll(pfds, nconns + 1, nconns > 0 ? 1000 : -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			break;
+		}
+
+		/*
+		 * walking backwards, a finished connection is replaced by one which was already seen to.
+		 * peers which did not send their query in time are dropped, but only once whatever they
+		 * did send was read, as answering the queries of others may have taken a while.
+		 */
+		for (i = nconns; i-- > 0;)
+		{
+			bool keep;
+
+			if (pfds[i + 1].revents != 0)
+				keep = serve_conn_read(&state, &conns[i]);
+			else
+				keep = conns[i].deadline > time(NULL);
+
+			if (!keep)
+			{
+				serve_conn_close(&conns[i]);
+				conns[i] = conns[--nconns];
+			}
+		}
+
+		if (pfds[0].revents & POLLIN)
+		{
+			serve_accept(listen_fd, &conns[nconns]);
+
+			if (conns[nconns].fd >= 0)
+				nconns++;
+			else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				fprintf(stderr, "%s: %s\n", path, strerror(errno));
+				break;
+			}
+		}
+	}
+
+	while (nconns > 0)
+		serve_conn_close(&conns[--nconns]);
+
+	close(listen_fd);
+	unlink(path);
+
+	reset_func();
+	serve_watch_free(&state);
+	close(state.stdout_fd);
+	close(state.stderr_fd);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Forwards a query to the server listening on path.  Returns false if no server
+ * could be reached, in which case the caller answers the query itself.
+ */
+bool
+serve_forward(const char *path, int argc, char *argv[], int *status)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char cwd[PKGCONF_ITEM_SIZE];
+	serve_request_t req = { .magic = SERVE_MAGIC, .argc = argc };
+	int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct iovec iov = { .iov_base = &req, .iov_len = sizeof req };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof control.buf,
+	};
+	struct cmsghdr *cmsg;
+	struct timeval tv = { .tv_sec = SERVE_TIMEOUT };
+	char **env, *buf, *p, confirm = 0;
+	size_t size;
+	int fd, i;
+	uint32_t ack;
+	int32_t result;
+	bool sent;
+
+	if (strlen(path) >= sizeof addr.sun_path || getcwd(cwd, sizeof cwd) == NULL)
+		return false;
+
+	pkgconf_strlcpy(addr.sun_path, path, sizeof addr.sun_path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+
+	/* a server which is stuck or stopped must not hold the query up forever */
+	if (connect(fd, (struct sockaddr *) &addr, sizeof addr) != 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv) != 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	size = strlen(cwd) + 1;
+	for (i = 0; i < argc; i++)
+		size += strlen(argv[i]) + 1;
+	for (env = environ; *env != NULL; env++)
+	{
+		if (serve_env_forwarded(*env))
+			size += strlen(*env) + 1;
+	}
+
+	p = buf = malloc(size);
+
+	p += pkgconf_strlcpy(p, cwd, size) + 1;
+	for (i = 0; i < argc; i++)
+		p += pkgconf_strlcpy(p, argv[i], size - (p - buf)) + 1;
+	for (env = environ; *env != NULL; env++)
+	{
+		if (!serve_env_forwarded(*env))
+			continue;
+
+		p += pkgconf_strlcpy(p, *env, size - (p - buf)) + 1;
+		req.envc++;
+	}
+
+	req.size = size;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof fds);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+
+	fflush(stdout);
+	fflush(stderr);
+
+	sent = sendmsg(fd, &msg, 0) == sizeof req && write_full(fd, buf, size);
+	free(buf);
+
+	/* the server does not run a query it was not told to, so it is safe to fall back */
+	if (!sent || !read_full(fd, &ack, sizeof ack) || ack != SERVE_MAGIC ||
+	    !write_full(fd, &confirm, sizeof confirm))
+	{
+		close(fd);
+		return false;
+	}
+
+	tv.tv_sec = SERVE_QUERY_TIMEOUT;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+	if (!read_full(fd, &result, sizeof result))
+	{
+		fprintf(stderr, "%s: lost connection to server\n", path);
+		result = EXIT_FAILURE;
+	}
+
+	close(fd);
+
+	*status = result;
+	return true;
+}
+
+#endif
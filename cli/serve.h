@@ -0,0 +1,34 @@
+/*
+ * serve.h
+ * long-running query server and thin client header
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <libpkgconf/libpkgconf.h>
+
+#if !defined(_WIN32) && !defined(PKGCONF_LITE)
+#define HAVE_PKGCONF_SERVE
+
+extern char **environ;
+
+typedef int (*serve_query_func_t)(int argc, char *argv[]);
+typedef void (*serve_reset_func_t)(void);
+
+bool serve_env_forwarded(const char *envvar);
+int serve_main(const char *path, pkgconf_client_t *client, serve_query_func_t query_func, serve_reset_func_t reset_func);
+bool serve_forward(const char *path, int argc, char *argv[], int *status);
+#endif
+
+#endif
@@ -0,0 +1,295 @@
+/*
+ * alloc.c
+ * pluggable memory allocators and allocation accounting
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+
+/*
+ * !doc
+ *
+ * libpkgconf `alloc` module
+ * =========================
+ *
+ * The libpkgconf `alloc` module lets embedders control where the memory of the objects
+ * owned by a client comes from.  An allocator is a set of `malloc`, `realloc` and `free`
+ * functions sharing an opaque data pointer.  Every request is tagged with the subsystem
+ * it is made on behalf of, so that allocators can account for memory use per subsystem.
+ *
+ * An allocator whose functions are ``NULL`` uses the C library, which is the default for
+ * every client.  A counting allocator, which tracks allocation counts, live bytes and peak
+ * bytes per subsystem, is provided to help tracking down memory regressions.
+ */
+
+static const char *subsystem_names[PKGCONF_ALLOC_SUBSYSTEM_COUNT] = {
+	[PKGCONF_ALLOC_PARSER]		= "parser",
+	[PKGCONF_ALLOC_TUPLE]		= "tuple",
+	[PKGCONF_ALLOC_FRAGMENT]	= "fragment",
+	[PKGCONF_ALLOC_DEPENDENCY]	= "dependency",
+	[PKGCONF_ALLOC_PACKAGE]		= "package",
+	[PKGCONF_ALLOC_CACHE]		= "cache",
+	[PKGCONF_ALLOC_QUERY]		= "query",
+	[PKGCONF_ALLOC_STRING]		= "string",
+};
+
+/*
+ * !doc
+ *
+ * .. c:function:: const char *pkgconf_alloc_subsystem_name(pkgconf_alloc_subsystem_t subsystem)
+ *
+ *    Returns a short, human-readable name for an allocation subsystem.
+ *
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem to name.
+ *    :return: the name of the subsystem, else ``NULL``.
+ *    :rtype: const char *
+ */
+const char *
+pkgconf_alloc_subsystem_name(pkgconf_alloc_subsystem_t subsystem)
+{
+	if ((unsigned int) subsystem >= PKGCONF_ALLOC_SUBSYSTEM_COUNT)
+		return NULL;
+
+	return subsystem_names[subsystem];
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void *pkgconf_alloc(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, size_t size)
+ *
+ *    Allocates `size` bytes of zero-filled memory from an allocator.
+ *
+ *    :param pkgconf_allocator_t* allocator: The allocator to use, or ``NULL`` for the C library.
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem the memory is allocated for.
+ *    :param size_t size: The number of bytes to allocate.
+ *    :return: a pointer to the memory, else ``NULL``.
+ *    :rtype: void *
+ */
+void *
+pkgconf_alloc(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, size_t size)
+{
+	void *p;
+
+	if (allocator == NULL || allocator->malloc_func == NULL)
+		return calloc(1, size);
+
+	if ((p = allocator->malloc_func(allocator->data, size, subsystem)) != NULL)
+		memset(p, 0, size);
+
+	return p;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void *pkgconf_alloc_realloc(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, void *ptr, size_t size)
+ *
+ *    Resizes memory previously obtained from the same allocator.  Like ``realloc()``, a
+ *    ``NULL`` `ptr` allocates new memory.  Memory added to the allocation is not initialized.
+ *
+ *    :param pkgconf_allocator_t* allocator: The allocator to use, or ``NULL`` for the C library.
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem the memory is allocated for.
+ *    :param void* ptr: The memory to resize.
+ *    :param size_t size: The new size in bytes.
+ *    :return: a pointer to the memory, else ``NULL``.
+ *    :rtype: void *
+ */
+void *
+pkgconf_alloc_realloc(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, void *ptr, size_t size)
+{
+	if (allocator == NULL || allocator->realloc_func == NULL)
+		return realloc(ptr, size);
+
+	return allocator->realloc_func(allocator->data, ptr, size, subsystem);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: char *pkgconf_alloc_strndup(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, const char *str, size_t len)
+ *
+ *    Copies at most `len` bytes of a string into memory obtained from an allocator.
+ *    The copy is always terminated.
+ *
+ *    :param pkgconf_allocator_t* allocator: The allocator to use, or ``NULL`` for the C library.
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem the memory is allocated for.
+ *    :param char* str: The string to copy.
+ *    :param size_t len: The maximum number of bytes to copy.
+ *    :return: the copy of the string, else ``NULL``.
+ *    :rtype: char *
+ */
+char *
+pkgconf_alloc_strndup(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, const char *str, size_t len)
+{
+	const char *nul;
+	char *p;
+
+	if ((nul = memchr(str, '\0', len)) != NULL)
+		len = nul - str;
+
+	if ((p = pkgconf_alloc_realloc(allocator, subsystem, NULL, len + 1)) == NULL)
+		return NULL;
+
+	memcpy(p, str, len);
+	p[len] = '\0';
+
+	return p;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: char *pkgconf_alloc_strdup(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, const char *str)
+ *
+ *    Copies a string into memory obtained from an allocator.
+ *
+ *    :param pkgconf_allocator_t* allocator: The allocator to use, or ``NULL`` for the C library.
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem the memory is allocated for.
+ *    :param char* str: The string to copy.
+ *    :return: the copy of the string, else ``NULL``.
+ *    :rtype: char *
+ */
+char *
+pkgconf_alloc_strdup(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, const char *str)
+{
+	size_t len = strlen(str);
+	char *p;
+
+	if ((p = pkgconf_alloc_realloc(allocator, subsystem, NULL, len + 1)) == NULL)
+		return NULL;
+
+	memcpy(p, str, len + 1);
+
+	return p;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_alloc_free(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, void *ptr)
+ *
+ *    Releases memory previously obtained from the same allocator.  ``NULL`` is ignored.
+ *
+ *    :param pkgconf_allocator_t* allocator: The allocator to use, or ``NULL`` for the C library.
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem the memory was allocated for.
+ *    :param void* ptr: The memory to release.
+ *    :return: nothing
+ */
+void
+pkgconf_alloc_free(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, void *ptr)
+{
+	if (ptr == NULL)
+		return;
+
+	if (allocator == NULL || allocator->free_func == NULL)
+	{
+		free(ptr);
+		return;
+	}
+
+	allocator->free_func(allocator->data, ptr, subsystem);
+}
+
+/*
+ * the counting allocator prefixes every allocation with its size, padded so that the
+ * memory handed out keeps the alignment guaranteed by malloc().
+ */
+typedef union {
+	size_t size;
+	long double ld;
+	void *p;
+} counting_header_t;
+
+static inline void
+counting_account(pkgconf_alloc_stats_t *stats, size_t allocated, size_t released)
+{
+	if (allocated > 0)
+		stats->allocations++;
+	if (released > 0)
+		stats->frees++;
+
+	stats->bytes += allocated;
+	stats->bytes -= released;
+
+	if (stats->bytes > stats->peak_bytes)
+		stats->peak_bytes = stats->bytes;
+}
+
+static void
+counting_update(pkgconf_counting_allocator_t *counter, pkgconf_alloc_subsystem_t subsystem, size_t allocated, size_t released)
+{
+	if ((unsigned int) subsystem < PKGCONF_ALLOC_SUBSYSTEM_COUNT)
+		counting_account(&counter->subsystems[subsystem], allocated, released);
+
+	counting_account(&counter->total, allocated, released);
+}
+
+static void *
+counting_realloc(void *data, void *ptr, size_t size, pkgconf_alloc_subsystem_t subsystem)
+{
+	counting_header_t *hdr = ptr != NULL ? (counting_header_t *) ptr - 1 : NULL;
+	size_t oldsize = hdr != NULL ? hdr->size : 0;
+
+	if (size > SIZE_MAX - sizeof(counting_header_t))
+		return NULL;
+
+	if ((hdr = realloc(hdr, sizeof(counting_header_t) + size)) == NULL)
+		return NULL;
+
+	hdr->size = size;
+
+	/* a resize is accounted as a release of the old block and a new allocation */
+	counting_update(data, subsystem, size, oldsize);
+
+	return hdr + 1;
+}
+
+static void *
+counting_malloc(void *data, size_t size, pkgconf_alloc_subsystem_t subsystem)
+{
+	return counting_realloc(data, NULL, size, subsystem);
+}
+
+static void
+counting_free(void *data, void *ptr, pkgconf_alloc_subsystem_t subsystem)
+{
+	counting_header_t *hdr = (counting_header_t *) ptr - 1;
+
+	counting_update(data, subsystem, 0, hdr->size);
+	free(hdr);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_counting_allocator_init(pkgconf_counting_allocator_t *counter)
+ *
+ *    Sets up a counting allocator, which forwards requests to the C library and records the
+ *    number of allocations and frees as well as the live and peak byte counts, per subsystem
+ *    and in total.  Install ``counter->allocator`` on a client with ``pkgconf_client_set_allocator()``
+ *    and read the statistics from ``counter->subsystems`` and ``counter->total``.
+ *
+ *    :param pkgconf_counting_allocator_t* counter: The counting allocator to set up.
+ *    :return: nothing
+ */
+void
+pkgconf_counting_allocator_init(pkgconf_counting_allocator_t *counter)
+{
+	memset(counter, 0, sizeof *counter);
+
+	counter->allocator.malloc_func = counting_malloc;
+	counter->allocator.realloc_func = counting_realloc;
+	counter->allocator.free_func = counting_free;
+	counter->allocator.data = counter;
+}
@@ -0,0 +1,259 @@
+/*
+ * arena.c
+ * bump allocation of objects which are released in bulk
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
+
+/*
+ * !doc
+ *
+ * libpkgconf `arena` module
+ * =========================
+ *
+ * The libpkgconf `arena` module provides a bump allocator for objects which share a
+ * lifetime.  Memory is carved out of large chunks and is never released individually:
+ * the whole arena is released at once with ``pkgconf_arena_reset()`` or
+ * ``pkgconf_arena_free()``.
+ *
+ * A client owns two arenas: one for objects belonging to cached packages, which is
+ * released by ``pkgconf_client_deinit()``, and one for objects belonging to the query
+ * in progress, which is released by ``pkgconf_client_end_query()``.  Objects which were
+ * allocated from an arena are marked as such, and the usual ``_free()`` functions only
+ * run their side effects on them (such as dropping package references).
+ *
+ * A zero-initialized ``pkgconf_arena_t`` is a valid empty arena which takes its chunks
+ * from the C library.  ``pkgconf_arena_init()`` sets up an arena which takes its chunks
+ * from an allocator instead.
+ */
+
+#define PKGCONF_ARENA_CHUNK_SIZE	65536
+#define PKGCONF_ARENA_ALIGN		(2 * sizeof(void *))
+
+#define ARENA_ROUND(size)		(((size) + PKGCONF_ARENA_ALIGN - 1) & ~(PKGCONF_ARENA_ALIGN - 1))
+
+struct pkgconf_arena_chunk_ {
+	pkgconf_arena_chunk_t *next;
+	size_t size;
+	size_t used;
+};
+
+#define ARENA_CHUNK_DATA(chunk)		((char *) (chunk) + ARENA_ROUND(sizeof(pkgconf_arena_chunk_t)))
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_arena_init(pkgconf_arena_t *arena, const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem)
+ *
+ *    Sets up an empty arena which allocates its chunks from `allocator`, on behalf of `subsystem`.
+ *
+ *    :param pkgconf_arena_t* arena: The arena to set up.
+ *    :param pkgconf_allocator_t* allocator: The allocator to take chunks from, or ``NULL`` for the C library.
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem chunks are accounted to.
+ *    :return: nothing
+ */
+void
+pkgconf_arena_init(pkgconf_arena_t *arena, const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem)
+{
+	memset(arena, 0, sizeof *arena);
+
+	arena->allocator = allocator;
+	arena->subsystem = subsystem;
+}
+
+static void *
+arena_reserve(pkgconf_arena_t *arena, size_t size)
+{
+	pkgconf_arena_chunk_t *chunk = arena->chunks;
+	void *p;
+
+	size = ARENA_ROUND(size);
+
+	if (chunk == NULL || chunk->size - chunk->used < size)
+	{
+		size_t chunk_size = size > PKGCONF_ARENA_CHUNK_SIZE / 4 ? size : PKGCONF_ARENA_CHUNK_SIZE;
+
+		chunk = pkgconf_alloc_realloc(arena->allocator, arena->subsystem, NULL, ARENA_ROUND(sizeof(pkgconf_arena_chunk_t)) + chunk_size);
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->size = chunk_size;
+		chunk->used = 0;
+
+		/* oversized allocations get a chunk of their own, which is linked behind the
+		 * current chunk so that the space left in the current chunk is not wasted.
+		 */
+		if (chunk_size != PKGCONF_ARENA_CHUNK_SIZE && arena->chunks != NULL)
+		{
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		}
+		else
+		{
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+
+		arena->reserved += chunk_size;
+	}
+
+	p = ARENA_CHUNK_DATA(chunk) + chunk->used;
+	chunk->used += size;
+	arena->allocated += size;
+
+	return p;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void *pkgconf_arena_alloc(pkgconf_arena_t *arena, size_t size)
+ *
+ *    Allocates `size` bytes of zero-filled memory from an arena.
+ *
+ *    :param pkgconf_arena_t* arena: The arena to allocate from.
+ *    :param size_t size: The number of bytes to allocate.
+ *    :return: a pointer to the memory, else ``NULL``.
+ *    :rtype: void *
+ */
+void *
+pkgconf_arena_alloc(pkgconf_arena_t *arena, size_t size)
+{
+	void *p;
+
+	if ((p = arena_reserve(arena, size)) != NULL)
+		memset(p, 0, size);
+
+	return p;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: char *pkgconf_arena_strndup(pkgconf_arena_t *arena, const char *str, size_t len)
+ *
+ *    Copies at most `len` bytes of a string into an arena.  The copy is always terminated.
+ *
+ *    :param pkgconf_arena_t* arena: The arena to allocate from.
+ *    :param char* str: The string to copy.
+ *    :param size_t len: The maximum number of bytes to copy.
+ *    :return: the copy of the string, else ``NULL``.
+ *    :rtype: char *
+ */
+char *
+pkgconf_arena_strndup(pkgconf_arena_t *arena, const char *str, size_t len)
+{
+	const char *nul;
+	char *p;
+
+	if ((nul = memchr(str, '\0', len)) != NULL)
+		len = nul - str;
+
+	if ((p = arena_reserve(arena, len + 1)) == NULL)
+		return NULL;
+
+	memcpy(p, str, len);
+	p[len] = '\0';
+
+	return p;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: char *pkgconf_arena_strdup(pkgconf_arena_t *arena, const char *str)
+ *
+ *    Copies a string into an arena.
+ *
+ *    :param pkgconf_arena_t* arena: The arena to allocate from.
+ *    :param char* str: The string to copy.
+ *    :return: the copy of the string, else ``NULL``.
+ *    :rtype: char *
+ */
+char *
+pkgconf_arena_strdup(pkgconf_arena_t *arena, const char *str)
+{
+	size_t len = strlen(str);
+	char *p;
+
+	if ((p = arena_reserve(arena, len + 1)) == NULL)
+		return NULL;
+
+	memcpy(p, str, len + 1);
+
+	return p;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_arena_reset(pkgconf_arena_t *arena)
+ *
+ *    Releases every object allocated from an arena at once.  The oldest chunk is kept
+ *    around, so that an arena which is reset between queries does not have to go back
+ *    to the system allocator for small queries.
+ *
+ *    :param pkgconf_arena_t* arena: The arena to reset.
+ *    :return: nothing
+ */
+void
+pkgconf_arena_reset(pkgconf_arena_t *arena)
+{
+	pkgconf_arena_chunk_t *chunk = arena->chunks;
+
+	if (chunk == NULL)
+		return;
+
+	while (chunk->next != NULL)
+	{
+		pkgconf_arena_chunk_t *next = chunk->next;
+
+		pkgconf_alloc_free(arena->allocator, arena->subsystem, chunk);
+		chunk = next;
+	}
+
+	chunk->used = 0;
+
+	arena->chunks = chunk;
+	arena->allocated = 0;
+	arena->reserved = chunk->size;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_arena_free(pkgconf_arena_t *arena)
+ *
+ *    Releases every object allocated from an arena along with the memory backing it.
+ *    The arena is left empty and may be used again.
+ *
+ *    :param pkgconf_arena_t* arena: The arena to free.
+ *    :return: nothing
+ */
+void
+pkgconf_arena_free(pkgconf_arena_t *arena)
+{
+	pkgconf_arena_chunk_t *chunk, *next;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next)
+	{
+		next = chunk->next;
+		pkgconf_alloc_free(arena->allocator, arena->subsystem, chunk);
+	}
+
+	arena->chunks = NULL;
+	arena->allocated = 0;
+	arena->reserved = 0;
+}
@@ -15,6 +15,7 @@
 
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
 
 /*
  * !doc
@@ -29,43 +30,18 @@
  * be shared across threads.
  */
 
-static int
-cache_member_cmp(const void *a, const void *b)
-{
-	const char *key = a;
-	const pkgconf_pkg_t *pkg = *(void **) b;
-
-	return strcmp(key, pkg->id);
-}
-
-static int
-cache_member_sort_cmp(const void *a, const void *b)
-{
-	const pkgconf_pkg_t *pkgA = *(void **) a;
-	const pkgconf_pkg_t *pkgB = *(void **) b;
-
-	if (pkgA == NULL)
-		return 1;
-
-	if (pkgB == NULL)
-		return -1;
-
-	return strcmp(pkgA->id, pkgB->id);
-}
-
 static void
 cache_dump(const pkgconf_client_t *client)
 {
-	size_t i;
+	const pkgconf_pkg_t *pkg;
+	size_t i = 0, cursor = 0;
 
 	PKGCONF_TRACE(client, "dumping package cache contents");
 
-	for (i = 0; i < client->cache_count; i++)
+	while ((pkg = pkgconf_hash_next(&client->cache_table, &cursor)) != NULL)
 	{
-		const pkgconf_pkg_t *pkg = client->cache_table[i];
-
 		PKGCONF_TRACE(client, "%zu: %p(%s)",
-			i, pkg, pkg == NULL ? "NULL" : pkg->id);
+			i++, pkg, pkg->id);
 	}
 }
 
@@ -86,19 +62,18 @@ cache_dump(const pkgconf_client_t *client)
 pkgconf_pkg_t *
 pkgconf_cache_lookup(pkgconf_client_t *client, const char *id)
 {
-	pkgconf_pkg_t **pkg;
-
-	pkg = bsearch(id, client->cache_table,
-		client->cache_count, sizeof (void *),
-		cache_member_cmp);
+	pkgconf_pkg_t *pkg;
 
+	pkg = pkgconf_hash_lookup(&client->cache_table, id, strlen(id));
 	if (pkg != NULL)
 	{
-		PKGCONF_TRACE(client, "found: %s @%p", id, *pkg);
-		return pkgconf_pkg_ref(client, *pkg);
+		PKGCONF_TRACE(client, "found: %s @%p", id, pkg);
+		PKGCONF_STATS_COUNT(client, cache_hits, 1);
+		return pkgconf_pkg_ref(client, pkg);
 	}
 
 	PKGCONF_TRACE(client, "miss: %s", id);
+	PKGCONF_STATS_COUNT(client, cache_misses, 1);
 	return NULL;
 }
 
@@ -117,6 +92,8 @@ pkgconf_cache_lookup(pkgconf_client_t *client, const char *id)
 void
 pkgconf_cache_add(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 {
+	pkgconf_pkg_t *old;
+
 	if (pkg == NULL)
 		return;
 
@@ -127,13 +104,18 @@ pkgconf_cache_add(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 	/* mark package as cached */
 	pkg->flags |= PKGCONF_PKG_PROPF_CACHED;
 
-	++client->cache_count;
-	client->cache_table = pkgconf_reallocarray(client->cache_table,
-		client->cache_count, sizeof (void *));
-	client->cache_table[client->cache_count - 1] = pkg;
+	old = pkgconf_hash_insert(&client->cache_table, pkg->id, strlen(pkg->id), pkg);
+	if (old != NULL && old != pkg)
+	{
+		PKGCONF_TRACE(client, "displaced @%p(%s) from cache", old, old->id);
+
+		old->flags &= ~PKGCONF_PKG_PROPF_CACHED;
+		pkgconf_pkg_unref(client, old);
 
-	qsort(client->cache_table, client->cache_count,
-		sizeof(void *), cache_member_sort_cmp);
+		pkgconf_closure_invalidate(client);
+	}
+	else if (old == pkg)
+		pkgconf_pkg_unref(client, pkg);
 }
 
 /*
@@ -158,31 +140,18 @@ pkgconf_cache_remove(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 
 	PKGCONF_TRACE(client, "removed @%p from cache", pkg);
 
-	pkgconf_pkg_t **slot;
-
-	slot = bsearch(pkg->id, client->cache_table,
-		client->cache_count, sizeof (void *),
-		cache_member_cmp);
-
-	if (slot == NULL)
-		return;
-
-	*slot = NULL;
-
-	qsort(client->cache_table, client->cache_count,
-		sizeof(void *), cache_member_sort_cmp);
-
-	if (client->cache_table[client->cache_count - 1] != NULL)
+	if (pkgconf_hash_lookup(&client->cache_table, pkg->id, strlen(pkg->id)) != pkg)
 	{
-		PKGCONF_TRACE(client, "end of cache table refers to %p, not NULL",
-			client->cache_table[client->cache_count - 1]);
+		PKGCONF_TRACE(client, "cache entry for %s does not refer to %p", pkg->id, pkg);
 		cache_dump(client);
 		abort();
 	}
 
-	client->cache_count--;
-	client->cache_table = pkgconf_reallocarray(client->cache_table,
-		client->cache_count, sizeof(void *));
+	pkgconf_hash_delete(&client->cache_table, pkg->id, strlen(pkg->id));
+	pkg->flags &= ~PKGCONF_PKG_PROPF_CACHED;
+
+	/* recorded closures may lead through the package */
+	pkgconf_closure_invalidate(client);
 }
 
 static inline void
@@ -211,17 +180,20 @@ clear_dependency_matches(pkgconf_list_t *list)
 void
 pkgconf_cache_free(pkgconf_client_t *client)
 {
-	pkgconf_pkg_t **cache_table;
-	size_t i, count;
+	pkgconf_pkg_t **cache_table, *pkg;
+	size_t i, count, cursor = 0;
+
+	count = client->cache_table.count;
+	cache_table = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_CACHE, count * sizeof (void *));
 
-	cache_table = pkgconf_reallocarray(NULL, client->cache_count, sizeof (void *));
-	memcpy(cache_table, client->cache_table,
-		client->cache_count * sizeof (void *));
+	/* freeing a package removes it from the hash table, so take a snapshot first */
+	for (i = 0; (pkg = pkgconf_hash_next(&client->cache_table, &cursor)) != NULL; i++)
+		cache_table[i] = pkg;
 
 	/* first we clear cached match pointers */
-	for (i = 0, count = client->cache_count; i < count; i++)
+	for (i = 0; i < count; i++)
 	{
-		pkgconf_pkg_t *pkg = cache_table[i];
+		pkg = cache_table[i];
 
 		clear_dependency_matches(&pkg->required);
 		clear_dependency_matches(&pkg->requires_private);
@@ -230,11 +202,53 @@ pkgconf_cache_free(pkgconf_client_t *client)
 	}
 
 	/* now forcibly free everything */
-	for (i = 0, count = client->cache_count; i < count; i++)
+	for (i = 0; i < count; i++)
 	{
-		pkgconf_pkg_t *pkg = cache_table[i];
+		pkg = cache_table[i];
 		pkgconf_pkg_free(client, pkg);
 	}
 
+	pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, cache_table);
+	pkgconf_hash_free(&client->cache_table);
+
 	PKGCONF_TRACE(client, "cleared package cache");
 }
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_cache_reset_hits(pkgconf_client_t *client)
+ *
+ *    Resets the dependency resolver's hit counters on every cached package.
+ *    The hit counters decide the order of a flattened dependency set, so a client object
+ *    which answers several unrelated queries should reset them between queries.
+ *
+ *    :param pkgconf_client_t* client: The client object to modify.
+ *    :return: nothing
+ */
+void
+pkgconf_cache_reset_hits(pkgconf_client_t *client)
+{
+	pkgconf_pkg_t *pkg;
+	size_t cursor = 0;
+
+	while ((pkg = pkgconf_hash_next(&client->cache_table, &cursor)) != NULL)
+		pkg->hits = 0;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_cache_get_stats(const pkgconf_client_t *client, pkgconf_hash_stats_t *stats)
+ *
+ *    Retrieves occupancy and probe length statistics for the client object's package cache.
+ *
+ *    :param pkgconf_client_t* client: The client object to inspect.
+ *    :param pkgconf_hash_stats_t* stats: The structure to fill in.
+ *    :return: nothing
+ */
+void
+pkgconf_cache_get_stats(const pkgconf_client_t *client, pkgconf_hash_stats_t *stats)
+{
+	pkgconf_hash_get_stats(&client->cache_table, stats);
+}
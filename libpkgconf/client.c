@@ -16,6 +16,7 @@
 #include <libpkgconf/config.h>
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
 
 /*
  * !doc
@@ -60,6 +61,8 @@ trace_path_list(const pkgconf_client_t *client, const char *desc, pkgconf_list_t
 void
 pkgconf_client_dir_list_build(pkgconf_client_t *client, const pkgconf_cross_personality_t *personality)
 {
+	pkgconf_stats_phase_t phase = PKGCONF_STATS_ENTER(client, PKGCONF_STATS_PHASE_INIT);
+
 	pkgconf_path_build_from_environ("PKG_CONFIG_PATH", NULL, &client->dir_list, true);
 
 	if (!(client->flags & PKGCONF_PKG_PKGF_ENV_ONLY))
@@ -77,6 +80,11 @@ pkgconf_client_dir_list_build(pkgconf_client_t *client, const pkgconf_cross_pers
 		pkgconf_path_copy_list(&client->dir_list, prepend_list);
 		pkgconf_path_free(&dir_list);
 	}
+
+	/* the providers found on the old search path may not be on the new one */
+	pkgconf_pkg_provides_index_free(client);
+
+	PKGCONF_STATS_LEAVE(client, phase);
 }
 
 /*
@@ -84,7 +92,9 @@ pkgconf_client_dir_list_build(pkgconf_client_t *client, const pkgconf_cross_pers
  *
  * .. c:function:: void pkgconf_client_init(pkgconf_client_t *client, pkgconf_error_handler_func_t error_handler, void *error_handler_data, const pkgconf_cross_personality_t *personality)
  *
- *    Initialise a pkgconf client object.
+ *    Initialise a pkgconf client object.  An allocator installed with ``pkgconf_client_set_allocator()``
+ *    on the zero-initialized client object beforehand is kept, and so is a statistics object attached
+ *    with ``pkgconf_client_set_stats()``, which then accounts for the initialization.
  *
  *    :param pkgconf_client_t* client: The client to initialise.
  *    :param pkgconf_error_handler_func_t error_handler: An optional error handler to use for logging errors.
@@ -95,10 +105,20 @@ pkgconf_client_dir_list_build(pkgconf_client_t *client, const pkgconf_cross_pers
 void
 pkgconf_client_init(pkgconf_client_t *client, pkgconf_error_handler_func_t error_handler, void *error_handler_data, const pkgconf_cross_personality_t *personality)
 {
+	pkgconf_stats_phase_t phase = PKGCONF_STATS_ENTER(client, PKGCONF_STATS_PHASE_INIT);
+
 	client->error_handler_data = error_handler_data;
 	client->error_handler = error_handler;
 	client->auditf = NULL;
 
+	pkgconf_arena_init(&client->cache_arena, &client->allocator, PKGCONF_ALLOC_CACHE);
+	pkgconf_arena_init(&client->query_arena, &client->allocator, PKGCONF_ALLOC_QUERY);
+	client->interns = pkgconf_intern_table_new(&client->allocator);
+
+	pkgconf_hash_init(&client->cache_table, &client->allocator, PKGCONF_ALLOC_CACHE);
+	pkgconf_hash_init(&client->dir_index, &client->allocator, PKGCONF_ALLOC_CACHE);
+	pkgconf_hash_init(&client->provides_index, &client->allocator, PKGCONF_ALLOC_CACHE);
+
 #ifndef PKGCONF_LITE
 	if (client->trace_handler == NULL)
 		pkgconf_client_set_trace_handler(client, NULL, NULL);
@@ -141,6 +161,8 @@ pkgconf_client_init(pkgconf_client_t *client, pkgconf_error_handler_func_t error
 
 	trace_path_list(client, "filtered library paths", &client->filter_libdirs);
 	trace_path_list(client, "filtered include paths", &client->filter_includedirs);
+
+	PKGCONF_STATS_LEAVE(client, phase);
 }
 
 /*
@@ -193,7 +215,19 @@ pkgconf_client_deinit(pkgconf_client_t *client)
 
 	pkgconf_tuple_free_global(client);
 	pkgconf_path_free(&client->dir_list);
+	pkgconf_pkg_dir_index_free(client);
+	pkgconf_pkg_provides_index_free(client);
 	pkgconf_cache_free(client);
+	pkgconf_parsecache_close(client);
+	pkgconf_traceevent_close(client);
+
+	client->arena = NULL;
+	pkgconf_arena_free(&client->query_arena);
+	pkgconf_arena_free(&client->cache_arena);
+
+	/* the dependencies and fragments referring to interned strings are gone now */
+	pkgconf_intern_table_free(client->interns);
+	client->interns = NULL;
 }
 
 /*
@@ -213,6 +247,331 @@ pkgconf_client_free(pkgconf_client_t *client)
 	free(client);
 }
 
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_client_begin_query(pkgconf_client_t *client)
+ *
+ *    Starts allocating packages, dependencies, variables and fragments from the client's arenas.
+ *    Packages which are loaded into the cache are allocated from an arena which lives until
+ *    ``pkgconf_client_deinit()``, everything else is allocated from a per-query arena.
+ *    Global variables are always allocated from the heap.
+ *
+ *    Every object created between this call and ``pkgconf_client_end_query()``, which is
+ *    not owned by a cached package, must be released before the query is ended.
+ *
+ *    :param pkgconf_client_t* client: The client object to start a query on.
+ *    :return: nothing
+ */
+void
+pkgconf_client_begin_query(pkgconf_client_t *client)
+{
+	client->arena = &client->query_arena;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_client_end_query(pkgconf_client_t *client)
+ *
+ *    Releases the memory of the query started with ``pkgconf_client_begin_query()`` in bulk, and
+ *    goes back to allocating objects from the heap.
+ *
+ *    :param pkgconf_client_t* client: The client object to end the query on.
+ *    :return: nothing
+ */
+void
+pkgconf_client_end_query(pkgconf_client_t *client)
+{
+	PKGCONF_TRACE(client, "releasing %zu bytes of query memory", client->query_arena.allocated);
+
+	client->arena = NULL;
+	pkgconf_arena_reset(&client->query_arena);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: size_t pkgconf_client_get_retained_bytes(const pkgconf_client_t *client)
+ *
+ *    Returns the number of bytes a client holds on to between queries in its arenas and its
+ *    table of interned strings.  This memory is only given back by ``pkgconf_client_deinit()``,
+ *    so long-lived clients can use it to decide when to start over with a fresh client.
+ *
+ *    :param pkgconf_client_t* client: The client object to query.
+ *    :return: the number of bytes reserved by the client's arenas and intern table
+ *    :rtype: size_t
+ */
+size_t
+pkgconf_client_get_retained_bytes(const pkgconf_client_t *client)
+{
+	size_t bytes = client->cache_arena.reserved + client->query_arena.reserved;
+
+	/* every distinct name and version any query looked up stays interned */
+	if (client->interns != NULL)
+		bytes += client->interns->arena.reserved +
+			(client->interns->table.size + client->interns->versions.size) * sizeof(pkgconf_hash_entry_t);
+
+	return bytes;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: const pkgconf_allocator_t *pkgconf_client_get_allocator(const pkgconf_client_t *client)
+ *
+ *    Returns the allocator used for the objects owned by a client.
+ *
+ *    :param pkgconf_client_t* client: The client object to query.
+ *    :return: the client's allocator
+ *    :rtype: const pkgconf_allocator_t *
+ */
+const pkgconf_allocator_t *
+pkgconf_client_get_allocator(const pkgconf_client_t *client)
+{
+	return &client->allocator;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_client_set_allocator(pkgconf_client_t *client, const pkgconf_allocator_t *allocator)
+ *
+ *    Sets the allocator used for the packages, dependencies, variables and fragments owned by a client,
+ *    for the client's arenas and for its parse cache.  The allocator is copied into the client object.
+ *
+ *    The allocator must be installed before anything is allocated through the client: on a zero-initialized
+ *    client object before ``pkgconf_client_init()``, or after ``pkgconf_client_deinit()``.
+ *
+ *    :param pkgconf_client_t* client: The client object to modify.
+ *    :param pkgconf_allocator_t* allocator: The allocator to use, or ``NULL`` to use the C library.
+ *    :return: nothing
+ */
+void
+pkgconf_client_set_allocator(pkgconf_client_t *client, const pkgconf_allocator_t *allocator)
+{
+	if (allocator != NULL)
+		client->allocator = *allocator;
+	else
+		memset(&client->allocator, 0, sizeof client->allocator);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: unsigned int pkgconf_client_get_scan_threads(const pkgconf_client_t *client)
+ *
+ *    Returns the number of worker threads used to parse the packages of a directory while
+ *    scanning it, see ``pkgconf_client_set_scan_threads()``.
+ *
+ *    :param pkgconf_client_t* client: The client object to query.
+ *    :return: the number of worker threads, 0 or 1 meaning that directories are scanned serially.
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkgconf_client_get_scan_threads(const pkgconf_client_t *client)
+{
+	return client->scan_threads;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_client_set_scan_threads(pkgconf_client_t *client, unsigned int threads)
+ *
+ *    Sets the number of worker threads ``pkgconf_scan_all()`` uses to read and tokenize the `.pc`
+ *    files of a directory ahead of the iteration function, see the `prefetch` module.  Packages
+ *    are still built and handed to the iteration function one at a time, in directory order.
+ *
+ *    Directories are scanned serially if fewer than two threads are requested, if libpkgconf
+ *    was built without thread support or if a parse cache is open, since the cache already
+ *    saves tokenizing the files.
+ *
+ *    :param pkgconf_client_t* client: The client object to modify.
+ *    :param uint threads: The number of worker threads to use.
+ *    :return: nothing
+ */
+void
+pkgconf_client_set_scan_threads(pkgconf_client_t *client, unsigned int threads)
+{
+	client->scan_threads = threads;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_client_get_stats(const pkgconf_client_t *client, pkgconf_stats_t *stats)
+ *
+ *    Copies the statistics collected by a client so far, with the time elapsed in the phase in
+ *    progress accounted to it, see ``pkgconf_client_set_stats()``.
+ *
+ *    :param pkgconf_client_t* client: The client object to query.
+ *    :param pkgconf_stats_t* stats: The statistics object to copy to, which is cleared if no statistics are collected.
+ *    :return: nothing
+ */
+void
+pkgconf_client_get_stats(const pkgconf_client_t *client, pkgconf_stats_t *stats)
+{
+	uint64_t now;
+
+	if (client->stats == NULL)
+	{
+		memset(stats, 0, sizeof *stats);
+		return;
+	}
+
+	*stats = *client->stats;
+
+	now = pkgconf_stats_clock();
+	stats->phase_nsec[stats->phase] += now - stats->mark;
+	stats->mark = now;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_client_set_stats(pkgconf_client_t *client, pkgconf_stats_t *stats)
+ *
+ *    Starts collecting the phase times and counters of a client into `stats`, which is reset and
+ *    must remain valid until collection is stopped, see the `stats` module.  Collection is stopped
+ *    by passing ``NULL``.
+ *
+ *    :param pkgconf_client_t* client: The client object to modify.
+ *    :param pkgconf_stats_t* stats: The statistics object to collect into, or ``NULL``.
+ *    :return: nothing
+ */
+void
+pkgconf_client_set_stats(pkgconf_client_t *client, pkgconf_stats_t *stats)
+{
+	if (stats != NULL)
+		pkgconf_stats_reset(stats);
+
+	client->stats = stats;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_stats_phase_t pkgconf_client_enter_phase(pkgconf_client_t *client, pkgconf_stats_phase_t phase)
+ *
+ *    Starts accounting the time spent by a client to `phase`, for work done by the caller such as
+ *    rendering, if statistics are collected.
+ *
+ *    :param pkgconf_client_t* client: The client object to update.
+ *    :param pkgconf_stats_phase_t phase: The phase being entered.
+ *    :return: the phase which was in progress, to be passed to ``pkgconf_client_leave_phase()``.
+ *    :rtype: pkgconf_stats_phase_t
+ */
+pkgconf_stats_phase_t
+pkgconf_client_enter_phase(pkgconf_client_t *client, pkgconf_stats_phase_t phase)
+{
+	return PKGCONF_STATS_ENTER(client, phase);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_client_leave_phase(pkgconf_client_t *client, pkgconf_stats_phase_t phase)
+ *
+ *    Resumes accounting the time spent by a client to `phase`, if statistics are collected.
+ *
+ *    :param pkgconf_client_t* client: The client object to update.
+ *    :param pkgconf_stats_phase_t phase: The phase returned by the matching ``pkgconf_client_enter_phase()``.
+ *    :return: nothing
+ */
+void
+pkgconf_client_leave_phase(pkgconf_client_t *client, pkgconf_stats_phase_t phase)
+{
+	PKGCONF_STATS_LEAVE(client, phase);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void *pkgconf_client_alloc(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, size_t size)
+ *
+ *    Allocates zero-filled memory for an object owned by a client: from the arena selected by the
+ *    query in progress if there is one, else from the client's allocator.
+ *
+ *    :param pkgconf_client_t* client: The client object which owns the memory.
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem the memory is allocated for.
+ *    :param size_t size: The number of bytes to allocate.
+ *    :return: a pointer to the memory, else ``NULL``.
+ *    :rtype: void *
+ */
+void *
+pkgconf_client_alloc(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, size_t size)
+{
+	if (client->arena != NULL)
+		return pkgconf_arena_alloc(client->arena, size);
+
+	return pkgconf_alloc(&client->allocator, subsystem, size);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: char *pkgconf_client_strdup(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, const char *str)
+ *
+ *    Copies a string owned by a client, with the same rules as ``pkgconf_client_alloc()``.
+ *
+ *    :param pkgconf_client_t* client: The client object which owns the memory.
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem the memory is allocated for.
+ *    :param char* str: The string to copy.
+ *    :return: the copy of the string, else ``NULL``.
+ *    :rtype: char *
+ */
+char *
+pkgconf_client_strdup(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, const char *str)
+{
+	if (client->arena != NULL)
+		return pkgconf_arena_strdup(client->arena, str);
+
+	return pkgconf_alloc_strdup(&client->allocator, subsystem, str);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: char *pkgconf_client_strndup(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, const char *str, size_t len)
+ *
+ *    Copies at most `len` bytes of a string owned by a client, with the same rules as ``pkgconf_client_alloc()``.
+ *
+ *    :param pkgconf_client_t* client: The client object which owns the memory.
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem the memory is allocated for.
+ *    :param char* str: The string to copy.
+ *    :param size_t len: The maximum number of bytes to copy.
+ *    :return: the copy of the string, else ``NULL``.
+ *    :rtype: char *
+ */
+char *
+pkgconf_client_strndup(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, const char *str, size_t len)
+{
+	if (client->arena != NULL)
+		return pkgconf_arena_strndup(client->arena, str, len);
+
+	return pkgconf_alloc_strndup(&client->allocator, subsystem, str, len);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_client_dealloc(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, void *ptr)
+ *
+ *    Releases memory obtained from a client's allocator.  Memory allocated from one of the client's
+ *    arenas must not be passed to this function, it is released in bulk instead.
+ *
+ *    :param pkgconf_client_t* client: The client object which owns the memory.
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem the memory was allocated for.
+ *    :param void* ptr: The memory to release.
+ *    :return: nothing
+ */
+void
+pkgconf_client_dealloc(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, void *ptr)
+{
+	pkgconf_alloc_free(&client->allocator, subsystem, ptr);
+}
+
 /*
  * !doc
  *
@@ -0,0 +1,331 @@
+/*
+ * closure.c
+ * memoized dependency closures
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
+
+/*
+ * !doc
+ *
+ * libpkgconf `closure` module
+ * ===========================
+ *
+ * The libpkgconf `closure` module remembers how ``pkgconf_pkg_traverse()`` walked the
+ * dependency closure of a package, so that later traversals reaching the same package can
+ * replay the walk instead of resolving and verifying every dependency again.
+ *
+ * A closure is recorded as the sequence of `steps` the traversal took below the package:
+ * the dependencies it descended into, the packages it called the traversal function on and
+ * the dependencies it found already visited or skipped.  The closure of a dependency which
+ * has a closure of its own is recorded as a single step referring to it, so every step is
+ * only stored once.
+ *
+ * Closures are kept per package and per set of client flags and `skip_flags`, and are only
+ * recorded for walks which succeeded without reaching the depth limit and without meeting a
+ * package visited before the walk started.  Such a walk only depends on the packages below
+ * it, so it can be replayed by any traversal which has not visited any of them yet.
+ *
+ * Removing a package from the cache invalidates every closure of the client.
+ */
+
+typedef struct {
+	const pkgconf_closure_t *closure;
+	size_t index;
+} closure_cursor_t;
+
+typedef enum {
+	CLOSURE_WALK_CHECK,
+	CLOSURE_WALK_REPLAY
+} closure_walk_mode_t;
+
+/*
+ * walks the steps of a closure along with the closures it refers to.  when checking, the
+ * walk stops at the first package which was already visited by the traversal in progress.
+ */
+static bool
+closure_walk(pkgconf_client_t *client, const pkgconf_closure_t *closure, closure_walk_mode_t mode,
+	pkgconf_pkg_traverse_func_t func, void *data, uint64_t *first_visit)
+{
+	closure_cursor_t *stack;
+	size_t depth = 0;
+	bool ret = true;
+
+	if (closure->nesting > SIZE_MAX / sizeof(closure_cursor_t))
+		return false;
+
+	stack = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_QUERY, closure->nesting * sizeof(closure_cursor_t));
+	if (stack == NULL)
+		return false;
+
+	stack[depth].closure = closure;
+	stack[depth].index = 0;
+	depth++;
+
+	while (depth > 0)
+	{
+		closure_cursor_t *cursor = &stack[depth - 1];
+		const pkgconf_closure_step_t *step;
+
+		if (cursor->index == cursor->closure->count)
+		{
+			depth--;
+			continue;
+		}
+
+		step = &cursor->closure->steps[cursor->index++];
+
+		if (step->type == PKGCONF_CLOSURE_REPLAY)
+		{
+			stack[depth].closure = step->closure;
+			stack[depth].index = 0;
+			depth++;
+			continue;
+		}
+
+		if (mode == CLOSURE_WALK_CHECK)
+		{
+			if (step->type == PKGCONF_CLOSURE_VISIT && step->pkg->serial == client->serial)
+			{
+				ret = false;
+				break;
+			}
+
+			continue;
+		}
+
+		switch (step->type)
+		{
+		case PKGCONF_CLOSURE_VISIT:
+			pkgconf_audit_log_dependency(client, step->pkg, step->dep);
+
+			step->pkg->hits++;
+			step->pkg->serial = client->serial;
+			step->pkg->visit = ++client->visits;
+
+			PKGCONF_STATS_COUNT(client, nodes_visited, 1);
+			break;
+		case PKGCONF_CLOSURE_FUNC:
+			if (step->is_private)
+				client->flags |= PKGCONF_PKG_PKGF_ITER_PKG_IS_PRIVATE;
+			else
+				client->flags &= ~PKGCONF_PKG_PKGF_ITER_PKG_IS_PRIVATE;
+
+			if (func != NULL)
+				func(client, step->pkg, data);
+			break;
+		case PKGCONF_CLOSURE_HIT:
+			step->pkg->hits++;
+			break;
+		case PKGCONF_CLOSURE_SKIP:
+			/* the dependency was skipped because it had not been visited yet */
+			if (step->pkg->serial == client->serial)
+			{
+				step->pkg->hits++;
+
+				if (step->pkg->visit < *first_visit)
+					*first_visit = step->pkg->visit;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_QUERY, stack);
+
+	return ret;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_closure_t *pkgconf_closure_new(pkgconf_client_t *client, pkgconf_pkg_t *pkg, unsigned int flags, unsigned int skip_flags, int levels, const pkgconf_closure_step_t *steps, size_t count)
+ *
+ *    Records the closure of a package, as walked by a traversal which entered the package with
+ *    the client flags `flags` and which skipped dependency nodes matching `skip_flags`.
+ *
+ *    :param pkgconf_client_t* client: The client object which owns the package.
+ *    :param pkgconf_pkg_t* pkg: The package the closure belongs to.
+ *    :param uint flags: The client flags the package was entered with.
+ *    :param uint skip_flags: The `skip_flags` of the traversal.
+ *    :param int levels: The number of levels of the dependency graph the walk went through, counting the package itself.
+ *    :param pkgconf_closure_step_t* steps: The steps taken below the package.
+ *    :param size_t count: The number of steps.
+ *    :return: the closure, else ``NULL``.
+ *    :rtype: pkgconf_closure_t *
+ */
+pkgconf_closure_t *
+pkgconf_closure_new(pkgconf_client_t *client, pkgconf_pkg_t *pkg, unsigned int flags, unsigned int skip_flags, int levels, const pkgconf_closure_step_t *steps, size_t count)
+{
+	pkgconf_closure_t *closure;
+	size_t i;
+
+	if (count > (SIZE_MAX - sizeof(pkgconf_closure_t)) / sizeof(pkgconf_closure_step_t))
+		return NULL;
+
+	closure = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_CACHE, sizeof(pkgconf_closure_t) + count * sizeof(pkgconf_closure_step_t));
+	if (closure == NULL)
+		return NULL;
+
+	closure->flags = flags;
+	closure->skip_flags = skip_flags;
+	closure->generation = client->closure_generation;
+	closure->levels = levels;
+	closure->nesting = 1;
+	closure->count = count;
+	closure->steps = (pkgconf_closure_step_t *) (closure + 1);
+
+	memcpy(closure->steps, steps, count * sizeof(pkgconf_closure_step_t));
+
+	for (i = 0; i < count; i++)
+	{
+		if (steps[i].type == PKGCONF_CLOSURE_REPLAY && steps[i].closure->nesting >= closure->nesting)
+			closure->nesting = steps[i].closure->nesting + 1;
+	}
+
+	closure->next = pkg->closures;
+	pkg->closures = closure;
+
+	PKGCONF_TRACE(client, "%s: recorded closure of %zu steps, %d levels", pkg->id, count, levels);
+
+	return closure;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_closure_t *pkgconf_closure_lookup(pkgconf_client_t *client, pkgconf_pkg_t *pkg, unsigned int flags, unsigned int skip_flags, int maxdepth)
+ *
+ *    Looks up a closure of a package which the traversal in progress can replay, if it enters the
+ *    package with the client flags `flags` and up to `maxdepth` levels.  Closures which were
+ *    invalidated are released.
+ *
+ *    :param pkgconf_client_t* client: The client object which owns the package.
+ *    :param pkgconf_pkg_t* pkg: The package to look up a closure for.
+ *    :param uint flags: The client flags the package is entered with.
+ *    :param uint skip_flags: The `skip_flags` of the traversal.
+ *    :param int maxdepth: The number of levels left to walk, -1 or less meaning no limit.
+ *    :return: the closure, else ``NULL``.
+ *    :rtype: pkgconf_closure_t *
+ */
+pkgconf_closure_t *
+pkgconf_closure_lookup(pkgconf_client_t *client, pkgconf_pkg_t *pkg, unsigned int flags, unsigned int skip_flags, int maxdepth)
+{
+	pkgconf_closure_t **prev = &pkg->closures;
+	pkgconf_closure_t *closure;
+
+	while ((closure = *prev) != NULL)
+	{
+		if (closure->generation != client->closure_generation)
+		{
+			*prev = closure->next;
+			pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, closure);
+			continue;
+		}
+
+		if (closure->flags == flags && closure->skip_flags == skip_flags)
+			break;
+
+		prev = &closure->next;
+	}
+
+	if (closure == NULL)
+		return NULL;
+
+	if (maxdepth >= 0 && maxdepth < closure->levels)
+		return NULL;
+
+	if (!closure_walk(client, closure, CLOSURE_WALK_CHECK, NULL, NULL, NULL))
+		return NULL;
+
+	return closure;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_closure_replay(pkgconf_client_t *client, const pkgconf_closure_t *closure, pkgconf_pkg_traverse_func_t func, void *data, uint64_t *first_visit)
+ *
+ *    Replays a closure returned by ``pkgconf_closure_lookup()`` for the traversal in progress:
+ *    the packages of the closure are marked as visited and `func` is called on them in the
+ *    order the closure was walked in.
+ *
+ *    :param pkgconf_client_t* client: The client object which owns the closure.
+ *    :param pkgconf_closure_t* closure: The closure to replay.
+ *    :param pkgconf_pkg_traverse_func_t func: The traversal function, or ``NULL``.
+ *    :param void* data: An opaque pointer to data to be passed to the traversal function.
+ *    :param uint64_t* first_visit: Lowered to the visit number of any package the closure skipped which was visited before.
+ *    :return: true if the closure was replayed, false if there was not enough memory to start replaying it.
+ *    :rtype: bool
+ */
+bool
+pkgconf_closure_replay(pkgconf_client_t *client, const pkgconf_closure_t *closure, pkgconf_pkg_traverse_func_t func, void *data, uint64_t *first_visit)
+{
+	PKGCONF_TRACE(client, "replaying closure of %zu steps", closure->count);
+
+	if (!closure_walk(client, closure, CLOSURE_WALK_REPLAY, func, data, first_visit))
+		return false;
+
+	/* the package is left the way a walk of its requires.private list leaves it */
+	if (closure->flags & PKGCONF_PKG_PKGF_SEARCH_PRIVATE)
+		client->flags &= ~PKGCONF_PKG_PKGF_ITER_PKG_IS_PRIVATE;
+	else
+		client->flags = (client->flags & ~PKGCONF_PKG_PKGF_ITER_PKG_IS_PRIVATE) | (closure->flags & PKGCONF_PKG_PKGF_ITER_PKG_IS_PRIVATE);
+
+	return true;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_closure_free(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
+ *
+ *    Releases the closures of a package.
+ *
+ *    :param pkgconf_client_t* client: The client object which owns the package.
+ *    :param pkgconf_pkg_t* pkg: The package to release the closures of.
+ *    :return: nothing
+ */
+void
+pkgconf_closure_free(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
+{
+	pkgconf_closure_t *closure, *next;
+
+	for (closure = pkg->closures; closure != NULL; closure = next)
+	{
+		next = closure->next;
+		pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, closure);
+	}
+
+	pkg->closures = NULL;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_closure_invalidate(pkgconf_client_t *client)
+ *
+ *    Invalidates every closure recorded by a client.  Invalidated closures are released the
+ *    next time their package is looked up, or along with their package.
+ *
+ *    :param pkgconf_client_t* client: The client object to invalidate the closures of.
+ *    :return: nothing
+ */
+void
+pkgconf_closure_invalidate(pkgconf_client_t *client)
+{
+	client->closure_generation++;
+}
@@ -15,6 +15,7 @@
 
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
 
 /*
  * !doc
@@ -24,6 +25,10 @@
  *
  * The `dependency` module provides support for building `dependency lists` (the basic component of the overall `dependency graph`) and
  * `dependency nodes` which store dependency information.
+ *
+ * The package names and versions of dependency nodes are interned by the client which owns
+ * them (see the `intern` module), and their versions are parsed ahead of time for comparison
+ * (see the `version` module), so nodes should only be created with the functions below.
  */
 
 typedef enum {
@@ -62,7 +67,8 @@ find_colliding_dependency(const pkgconf_dependency_t *dep, const pkgconf_list_t
 	{
 		pkgconf_dependency_t *dep2 = n->data;
 
-		if (strcmp(dep->package, dep2->package))
+		/* package names are interned by the client, see pkgconf_dependency_addraw() */
+		if (dep->package != dep2->package)
 			continue;
 
 		if (dep->flags != dep2->flags)
@@ -123,11 +129,15 @@ pkgconf_dependency_addraw(pkgconf_client_t *client, pkgconf_list_t *list, const
 {
 	pkgconf_dependency_t *dep;
 
-	dep = calloc(sizeof(pkgconf_dependency_t), 1);
-	dep->package = pkgconf_strndup(package, package_sz);
+	dep = pkgconf_client_alloc(client, PKGCONF_ALLOC_DEPENDENCY, sizeof(pkgconf_dependency_t));
+	dep->arena_owned = client->arena != NULL;
+	dep->package = pkgconf_intern_strn(client->interns, package, package_sz);
 
 	if (version_sz != 0)
-		dep->version = pkgconf_strndup(version, version_sz);
+	{
+		dep->version = pkgconf_intern_strn(client->interns, version, version_sz);
+		dep->version_key = pkgconf_intern_version(client->interns, dep->version);
+	}
 
 	dep->compare = compare;
 	dep->flags = flags;
@@ -195,13 +205,11 @@ pkgconf_dependency_free_one(pkgconf_dependency_t *dep)
 	if (dep->match != NULL)
 		pkgconf_pkg_unref(dep->match->owner, dep->match);
 
-	if (dep->package != NULL)
-		free(dep->package);
-
-	if (dep->version != NULL)
-		free(dep->version);
+	/* arena memory is released in bulk by the client */
+	if (dep->arena_owned)
+		return;
 
-	free(dep);
+	pkgconf_client_dealloc(dep->owner, PKGCONF_ALLOC_DEPENDENCY, dep);
 }
 
 /*
@@ -434,10 +442,10 @@ pkgconf_dependency_parse_str(pkgconf_client_t *client, pkgconf_list_t *deplist_h
 void
 pkgconf_dependency_parse(pkgconf_client_t *client, pkgconf_pkg_t *pkg, pkgconf_list_t *deplist, const char *depends, unsigned int flags)
 {
-	char *kvdepends = pkgconf_tuple_parse(client, &pkg->vars, depends, pkg->flags);
+	char *kvdepends = pkgconf_tuple_parse_alloc(client, &pkg->vars, depends, pkg->flags);
 
 	pkgconf_dependency_parse_str(client, deplist, kvdepends, flags);
-	free(kvdepends);
+	pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_TUPLE, kvdepends);
 }
 
 /*
@@ -456,11 +464,24 @@ pkgconf_dependency_copy(pkgconf_client_t *client, const pkgconf_dependency_t *de
 {
 	pkgconf_dependency_t *new_dep;
 
-	new_dep = calloc(sizeof(pkgconf_dependency_t), 1);
-	new_dep->package = strdup(dep->package);
+	new_dep = pkgconf_client_alloc(client, PKGCONF_ALLOC_DEPENDENCY, sizeof(pkgconf_dependency_t));
+	new_dep->arena_owned = client->arena != NULL;
 
-	if (dep->version != NULL)
-		new_dep->version = strdup(dep->version);
+	/* strings interned by the same client can be shared as they are */
+	if (dep->owner == client)
+	{
+		new_dep->package = dep->package;
+		new_dep->version = dep->version;
+		new_dep->version_key = dep->version_key;
+	}
+	else
+	{
+		new_dep->package = pkgconf_intern_str(client->interns, dep->package);
+		new_dep->version_key = pkgconf_intern_version(client->interns, dep->version);
+
+		if (new_dep->version_key != NULL)
+			new_dep->version = new_dep->version_key->str;
+	}
 
 	new_dep->compare = dep->compare;
 	new_dep->flags = dep->flags;
@@ -15,6 +15,7 @@
 
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
 
 /*
  * !doc
@@ -25,8 +26,35 @@
  * The `fragment` module provides low-level management and rendering of fragment lists.  A
  * `fragment list` contains various `fragments` of text (such as ``-I /usr/include``) in a matter
  * which is composable, mergeable and reorderable.
+ *
+ * The text of fragments is interned by the client which owns them (see the `intern` module),
+ * so fragments with equal text share the same pointer.  Once a `fragment list` grows past a
+ * handful of entries, the module keeps an index of its fragments keyed on that pointer, so
+ * that deduplication during `mergeback` does not need to scan the list.  The index is private
+ * to the module: fragment lists should only be modified with the functions below, and must be
+ * released with ``pkgconf_fragment_free()``.
  */
 
+/* lists shorter than this are searched linearly */
+#define PKGCONF_FRAGMENT_INDEX_MIN	16
+
+typedef struct {
+	/* the interned text of the fragments, whose address is the key of the bucket */
+	const char *data;
+	size_t count;
+	size_t alloc;
+
+	/* fragments with this text, in list order; their types may differ */
+	pkgconf_fragment_t **frags;
+} pkgconf_fragment_bucket_t;
+
+typedef struct {
+	pkgconf_hash_t table;
+
+	/* the list serial this index describes; a mismatch means it must be rebuilt */
+	size_t serial;
+} pkgconf_fragment_index_t;
+
 struct pkgconf_fragment_check {
 	char *token;
 	size_t len;
@@ -112,12 +140,195 @@ pkgconf_fragment_munge(const pkgconf_client_t *client, char *buf, size_t buflen,
 		pkgconf_path_relocate(buf, buflen);
 }
 
-static inline char *
+static inline const char *
 pkgconf_fragment_copy_munged(const pkgconf_client_t *client, const char *source, unsigned int flags)
 {
 	char mungebuf[PKGCONF_ITEM_SIZE];
 	pkgconf_fragment_munge(client, mungebuf, sizeof mungebuf, source, client->sysroot_dir, flags);
-	return strdup(mungebuf);
+	return pkgconf_intern_str(client->interns, mungebuf);
+}
+
+static inline pkgconf_fragment_t *
+fragment_new(const pkgconf_client_t *client)
+{
+	pkgconf_fragment_t *frag = pkgconf_client_alloc(client, PKGCONF_ALLOC_FRAGMENT, sizeof(pkgconf_fragment_t));
+
+	frag->arena_owned = client->arena != NULL;
+	frag->owner = client;
+
+	return frag;
+}
+
+static inline void
+fragment_release(pkgconf_fragment_t *frag)
+{
+	/* arena memory is released in bulk by the client */
+	if (frag->arena_owned)
+		return;
+
+	pkgconf_client_dealloc(frag->owner, PKGCONF_ALLOC_FRAGMENT, frag);
+}
+
+/* the text of a fragment owned by `client`, interning it if it is owned by another client */
+static inline const char *
+fragment_intern_data(const pkgconf_client_t *client, const pkgconf_fragment_t *frag)
+{
+	if (frag->data == NULL || frag->owner == client)
+		return frag->data;
+
+	return pkgconf_intern_str(client->interns, frag->data);
+}
+
+static void
+fragment_index_free(pkgconf_list_t *list)
+{
+	pkgconf_fragment_index_t *idx = list->index;
+	pkgconf_fragment_bucket_t *bucket;
+	size_t cursor = 0;
+
+	if (idx == NULL)
+		return;
+
+	/* the table keeps the allocator the index and its buckets were obtained from */
+	while ((bucket = pkgconf_hash_next(&idx->table, &cursor)) != NULL)
+	{
+		pkgconf_alloc_free(idx->table.allocator, PKGCONF_ALLOC_FRAGMENT, bucket->frags);
+		pkgconf_alloc_free(idx->table.allocator, PKGCONF_ALLOC_FRAGMENT, bucket);
+	}
+
+	pkgconf_hash_free(&idx->table);
+	pkgconf_alloc_free(idx->table.allocator, PKGCONF_ALLOC_FRAGMENT, idx);
+
+	list->index = NULL;
+}
+
+/* returns false if the index could not grow, in which case it no longer describes the list */
+static bool
+fragment_index_add(pkgconf_fragment_index_t *idx, pkgconf_fragment_t *frag)
+{
+	pkgconf_fragment_bucket_t *bucket = pkgconf_hash_lookup(&idx->table, (const char *) &frag->data, sizeof frag->data);
+
+	if (bucket == NULL)
+	{
+		if (!pkgconf_hash_reserve(&idx->table, idx->table.count + 1))
+			return false;
+
+		bucket = pkgconf_alloc(idx->table.allocator, PKGCONF_ALLOC_FRAGMENT, sizeof(pkgconf_fragment_bucket_t));
+		if (bucket == NULL)
+			return false;
+
+		bucket->data = frag->data;
+		pkgconf_hash_insert(&idx->table, (const char *) &bucket->data, sizeof bucket->data, bucket);
+	}
+
+	if (bucket->count == bucket->alloc)
+	{
+		size_t alloc = bucket->alloc ? bucket->alloc * 2 : 2;
+		pkgconf_fragment_t **frags = pkgconf_alloc_realloc(idx->table.allocator, PKGCONF_ALLOC_FRAGMENT, bucket->frags, alloc * sizeof(pkgconf_fragment_t *));
+
+		if (frags == NULL)
+			return false;
+
+		bucket->frags = frags;
+		bucket->alloc = alloc;
+	}
+
+	bucket->frags[bucket->count++] = frag;
+	return true;
+}
+
+static void
+fragment_index_remove(pkgconf_fragment_index_t *idx, const pkgconf_fragment_t *frag)
+{
+	pkgconf_fragment_bucket_t *bucket = pkgconf_hash_lookup(&idx->table, (const char *) &frag->data, sizeof frag->data);
+	size_t i;
+
+	if (bucket == NULL)
+		return;
+
+	/* mergeback almost always removes the most recent copy, so search backwards */
+	for (i = bucket->count; i-- > 0; )
+	{
+		if (bucket->frags[i] != frag)
+			continue;
+
+		memmove(&bucket->frags[i], &bucket->frags[i + 1], (bucket->count - i - 1) * sizeof(pkgconf_fragment_t *));
+		bucket->count--;
+		return;
+	}
+}
+
+/*
+ * Returns the index for a list, building it if the list is long enough to warrant one
+ * and rebuilding it if the list was changed behind the module's back.  NULL means the
+ * list is to be searched linearly, which is also the fallback when memory runs out.
+ */
+static pkgconf_fragment_index_t *
+fragment_index_get(const pkgconf_client_t *client, pkgconf_list_t *list)
+{
+	pkgconf_fragment_index_t *idx = list->index;
+	pkgconf_node_t *node;
+
+	if (idx != NULL && idx->serial == list->serial)
+		return idx;
+
+	fragment_index_free(list);
+
+	if (list->length < PKGCONF_FRAGMENT_INDEX_MIN)
+		return NULL;
+
+	idx = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_FRAGMENT, sizeof(pkgconf_fragment_index_t));
+	if (idx == NULL)
+		return NULL;
+
+	pkgconf_hash_init(&idx->table, &client->allocator, PKGCONF_ALLOC_FRAGMENT);
+	list->index = idx;
+
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
+	{
+		if (!fragment_index_add(idx, node->data))
+		{
+			fragment_index_free(list);
+			return NULL;
+		}
+	}
+
+	idx->serial = list->serial;
+	return idx;
+}
+
+static void
+fragment_insert_tail(pkgconf_list_t *list, pkgconf_fragment_t *frag)
+{
+	pkgconf_fragment_index_t *idx = list->index;
+	bool current = idx != NULL && idx->serial == list->serial;
+
+	if (current && !fragment_index_add(idx, frag))
+	{
+		fragment_index_free(list);
+		current = false;
+	}
+
+	pkgconf_node_insert_tail(&frag->iter, frag, list);
+
+	/* the index followed the change, so it still describes the list */
+	if (current)
+		idx->serial = list->serial;
+}
+
+static void
+fragment_unlink(pkgconf_list_t *list, pkgconf_fragment_t *frag)
+{
+	pkgconf_fragment_index_t *idx = list->index;
+	bool current = idx != NULL && idx->serial == list->serial;
+
+	if (current)
+		fragment_index_remove(idx, frag);
+
+	pkgconf_node_delete(&frag->iter, list);
+
+	if (current)
+		idx->serial = list->serial;
 }
 
 /*
@@ -143,7 +354,7 @@ pkgconf_fragment_add(const pkgconf_client_t *client, pkgconf_list_t *list, const
 
 	if (strlen(string) > 1 && !pkgconf_fragment_is_special(string))
 	{
-		frag = calloc(sizeof(pkgconf_fragment_t), 1);
+		frag = fragment_new(client);
 
 		frag->type = *(string + 1);
 		frag->data = pkgconf_fragment_copy_munged(client, string + 2, flags);
@@ -158,64 +369,87 @@ pkgconf_fragment_add(const pkgconf_client_t *client, pkgconf_list_t *list, const
 		    !(client->flags & PKGCONF_PKG_PKGF_DONT_MERGE_SPECIAL_FRAGMENTS))
 		{
 			pkgconf_fragment_t *parent = list->tail->data;
+			size_t len;
+			char *newdata = NULL;
 
 			/* only attempt to merge 'special' fragments together */
 			if (!parent->type && pkgconf_fragment_is_unmergeable(parent->data))
 			{
-				size_t len;
-				char *newdata;
-
 				pkgconf_fragment_munge(client, mungebuf, sizeof mungebuf, string, NULL, flags);
 
 				len = strlen(parent->data) + strlen(mungebuf) + 2;
-				newdata = malloc(len);
+				newdata = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_FRAGMENT, len);
+			}
 
+			/* without memory to merge into, the fragment is added on its own */
+			if (newdata != NULL)
+			{
 				pkgconf_strlcpy(newdata, parent->data, len);
 				pkgconf_strlcat(newdata, " ", len);
 				pkgconf_strlcat(newdata, mungebuf, len);
 
 				PKGCONF_TRACE(client, "merging '%s' to '%s' to form fragment {'%s'} in list @%p", mungebuf, parent->data, newdata, list);
 
-				free(parent->data);
-				parent->data = newdata;
+				/* use a copy operation to force a dedup */
+				fragment_unlink(list, parent);
+
+				parent->data = pkgconf_intern_str(client->interns, newdata);
 				parent->merged = true;
+				pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_FRAGMENT, newdata);
 
-				/* use a copy operation to force a dedup */
-				pkgconf_node_delete(&parent->iter, list);
 				pkgconf_fragment_copy(client, list, parent, false);
 
 				/* the fragment list now (maybe) has the copied node, so free the original */
-				free(parent->data);
-				free(parent);
+				fragment_release(parent);
 
 				return;
 			}
 		}
 
-		frag = calloc(sizeof(pkgconf_fragment_t), 1);
+		frag = fragment_new(client);
 
 		frag->type = 0;
-		frag->data = strdup(string);
+		frag->data = pkgconf_intern_str(client->interns, string);
 
 		PKGCONF_TRACE(client, "created special fragment {'%s'} in list @%p", frag->data, list);
 	}
 
-	pkgconf_node_insert_tail(&frag->iter, frag, list);
+	fragment_insert_tail(list, frag);
 }
 
+/*
+ * `data` must be interned by the client which owns the fragments in `list`, so that
+ * the text of fragments can be compared by pointer.
+ */
 static inline pkgconf_fragment_t *
-pkgconf_fragment_lookup(pkgconf_list_t *list, const pkgconf_fragment_t *base)
+pkgconf_fragment_lookup(const pkgconf_client_t *client, pkgconf_list_t *list, char type, const char *data)
 {
+	pkgconf_fragment_index_t *idx = fragment_index_get(client, list);
 	pkgconf_node_t *node;
 
+	if (idx != NULL)
+	{
+		const pkgconf_fragment_bucket_t *bucket = pkgconf_hash_lookup(&idx->table, (const char *) &data, sizeof data);
+		size_t i;
+
+		if (bucket == NULL)
+			return NULL;
+
+		/* the most recent fragment wins, as with the reverse scan below */
+		for (i = bucket->count; i-- > 0; )
+		{
+			if (bucket->frags[i]->type == type)
+				return bucket->frags[i];
+		}
+
+		return NULL;
+	}
+
 	PKGCONF_FOREACH_LIST_ENTRY_REVERSE(list->tail, node)
 	{
 		pkgconf_fragment_t *frag = node->data;
 
-		if (base->type != frag->type)
-			continue;
-
-		if (!strcmp(base->data, frag->data))
+		if (frag->type == type && frag->data == data)
 			return frag;
 	}
 
@@ -257,7 +491,7 @@ pkgconf_fragment_can_merge(const pkgconf_fragment_t *base, unsigned int flags, b
 }
 
 static inline pkgconf_fragment_t *
-pkgconf_fragment_exists(pkgconf_list_t *list, const pkgconf_fragment_t *base, unsigned int flags, bool is_private)
+pkgconf_fragment_exists(const pkgconf_client_t *client, pkgconf_list_t *list, const pkgconf_fragment_t *base, const char *data, unsigned int flags, bool is_private)
 {
 	if (!pkgconf_fragment_can_merge_back(base, flags, is_private))
 		return NULL;
@@ -265,7 +499,7 @@ pkgconf_fragment_exists(pkgconf_list_t *list, const pkgconf_fragment_t *base, un
 	if (!pkgconf_fragment_can_merge(base, flags, is_private))
 		return NULL;
 
-	return pkgconf_fragment_lookup(list, base);
+	return pkgconf_fragment_lookup(client, list, base->type, data);
 }
 
 static inline bool
@@ -343,24 +577,32 @@ pkgconf_fragment_has_system_dir(const pkgconf_client_t *client, const pkgconf_fr
 void
 pkgconf_fragment_copy(const pkgconf_client_t *client, pkgconf_list_t *list, const pkgconf_fragment_t *base, bool is_private)
 {
+	const char *data = fragment_intern_data(client, base);
 	pkgconf_fragment_t *frag;
 
-	if ((frag = pkgconf_fragment_exists(list, base, client->flags, is_private)) != NULL)
+	if ((frag = pkgconf_fragment_exists(client, list, base, data, client->flags, is_private)) != NULL)
 	{
 		if (pkgconf_fragment_should_merge(frag))
+		{
 			pkgconf_fragment_delete(list, frag);
+			PKGCONF_STATS_COUNT(client, fragment_dedups, 1);
+		}
 	}
-	else if (!is_private && !pkgconf_fragment_can_merge_back(base, client->flags, is_private) && (pkgconf_fragment_lookup(list, base) != NULL))
+	else if (!is_private && !pkgconf_fragment_can_merge_back(base, client->flags, is_private) && (pkgconf_fragment_lookup(client, list, base->type, data) != NULL))
+	{
+		PKGCONF_STATS_COUNT(client, fragment_dedups, 1);
 		return;
+	}
 
-	frag = calloc(sizeof(pkgconf_fragment_t), 1);
+	PKGCONF_STATS_COUNT(client, fragment_copies, 1);
+
+	frag = fragment_new(client);
 
 	frag->type = base->type;
 	frag->merged = base->merged;
-	if (base->data != NULL)
-		frag->data = strdup(base->data);
+	frag->data = data;
 
-	pkgconf_node_insert_tail(&frag->iter, frag, list);
+	fragment_insert_tail(list, frag);
 }
 
 /*
@@ -627,10 +869,8 @@ pkgconf_fragment_render(const pkgconf_list_t *list, bool escape, const pkgconf_f
 void
 pkgconf_fragment_delete(pkgconf_list_t *list, pkgconf_fragment_t *node)
 {
-	pkgconf_node_delete(&node->iter, list);
-
-	free(node->data);
-	free(node);
+	fragment_unlink(list, node);
+	fragment_release(node);
 }
 
 /*
@@ -652,9 +892,10 @@ pkgconf_fragment_free(pkgconf_list_t *list)
 	{
 		pkgconf_fragment_t *frag = node->data;
 
-		free(frag->data);
-		free(frag);
+		fragment_release(frag);
 	}
+
+	fragment_index_free(list);
 }
 
 /*
@@ -676,7 +917,7 @@ pkgconf_fragment_parse(const pkgconf_client_t *client, pkgconf_list_t *list, pkg
 {
 	int i, ret, argc;
 	char **argv;
-	char *repstr = pkgconf_tuple_parse(client, vars, value, flags);
+	char *repstr = pkgconf_tuple_parse_alloc(client, vars, value, flags);
 
 	PKGCONF_TRACE(client, "post-subst: [%s] -> [%s]", value, repstr);
 
@@ -684,7 +925,7 @@ pkgconf_fragment_parse(const pkgconf_client_t *client, pkgconf_list_t *list, pkg
 	if (ret < 0)
 	{
 		PKGCONF_TRACE(client, "unable to parse fragment string [%s]", repstr);
-		free(repstr);
+		pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_TUPLE, repstr);
 		return false;
 	}
 
@@ -696,7 +937,7 @@ pkgconf_fragment_parse(const pkgconf_client_t *client, pkgconf_list_t *list, pkg
 		{
 			PKGCONF_TRACE(client, "parsed fragment string is inconsistent: argc = %d while argv[%d] == NULL", argc, i);
 			pkgconf_argv_free(argv);
-			free(repstr);
+			pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_TUPLE, repstr);
 			return false;
 		}
 
@@ -704,7 +945,7 @@ pkgconf_fragment_parse(const pkgconf_client_t *client, pkgconf_list_t *list, pkg
 	}
 
 	pkgconf_argv_free(argv);
-	free(repstr);
+	pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_TUPLE, repstr);
 
 	return true;
 }
@@ -0,0 +1,365 @@
+/*
+ * hash.c
+ * open-addressing hash tables keyed on strings
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
+
+/*
+ * !doc
+ *
+ * libpkgconf `hash` module
+ * ========================
+ *
+ * The libpkgconf `hash` module provides a simple open-addressing hash table which
+ * maps string keys to opaque pointers.  It is used internally to index package caches
+ * and other collections which would otherwise require linear scans.
+ *
+ * Keys are not copied: the caller must ensure that a key remains valid for as long
+ * as the entry it names is present in the table.  Collisions are resolved with linear
+ * probing and removals use backward-shift deletion, so no tombstones are left behind.
+ *
+ * A zero-initialized ``pkgconf_hash_t`` is a valid empty table, whose storage comes from the
+ * C library.  Tables owned by a client are set up with ``pkgconf_hash_init()`` to use its allocator.
+ */
+
+#define PKGCONF_HASH_MIN_SIZE	16
+
+/*
+ * !doc
+ *
+ * .. c:function:: unsigned int pkgconf_hash_str(const char *key, size_t len)
+ *
+ *    Computes the 32-bit FNV-1a hash of `len` bytes of `key`.
+ *
+ *    :param char* key: The key to hash.
+ *    :param size_t len: The length of the key in bytes.
+ *    :return: the hash value.
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkgconf_hash_str(const char *key, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) key;
+	uint32_t h = 2166136261U;
+
+	while (len--)
+	{
+		h ^= *p++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+static inline size_t
+hash_home(const pkgconf_hash_t *hash, unsigned int hv)
+{
+	return hv & (hash->size - 1);
+}
+
+static inline void
+hash_account(pkgconf_hash_t *hash, size_t probes)
+{
+	hash->stats.lookups++;
+	hash->stats.probes += probes;
+
+	if (probes > hash->stats.max_probe)
+		hash->stats.max_probe = probes;
+}
+
+static pkgconf_hash_entry_t *
+hash_find_slot(pkgconf_hash_t *hash, const char *key, size_t len, unsigned int hv)
+{
+	size_t i, probes = 1;
+
+	if (hash->size == 0)
+		return NULL;
+
+	for (i = hash_home(hash, hv); hash->entries[i].key != NULL; i = (i + 1) & (hash->size - 1), probes++)
+	{
+		pkgconf_hash_entry_t *entry = &hash->entries[i];
+
+		if (entry->hash == hv && entry->keylen == len && !memcmp(entry->key, key, len))
+		{
+			hash_account(hash, probes);
+			return entry;
+		}
+	}
+
+	hash_account(hash, probes);
+	return NULL;
+}
+
+static void
+hash_place(pkgconf_hash_t *hash, const pkgconf_hash_entry_t *src)
+{
+	size_t i;
+
+	for (i = hash_home(hash, src->hash); hash->entries[i].key != NULL; i = (i + 1) & (hash->size - 1))
+		;
+
+	hash->entries[i] = *src;
+}
+
+static bool
+hash_resize(pkgconf_hash_t *hash, size_t size)
+{
+	pkgconf_hash_entry_t *old_entries = hash->entries;
+	pkgconf_hash_entry_t *entries;
+	size_t i, old_size = hash->size;
+
+	/* on failure the table is left as it was */
+	entries = pkgconf_alloc(hash->allocator, hash->subsystem, size * sizeof(pkgconf_hash_entry_t));
+	if (entries == NULL)
+		return false;
+
+	hash->entries = entries;
+	hash->size = size;
+
+	for (i = 0; i < old_size; i++)
+	{
+		if (old_entries[i].key != NULL)
+			hash_place(hash, &old_entries[i]);
+	}
+
+	pkgconf_alloc_free(hash->allocator, hash->subsystem, old_entries);
+	return true;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_hash_init(pkgconf_hash_t *hash, const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem)
+ *
+ *    Sets up an empty hash table whose storage comes from `allocator`, which must outlive the table.
+ *
+ *    :param pkgconf_hash_t* hash: The hash table to set up.
+ *    :param pkgconf_allocator_t* allocator: The allocator to use, or ``NULL`` for the C library.
+ *    :param pkgconf_alloc_subsystem_t subsystem: The subsystem the storage is allocated for.
+ *    :return: nothing
+ */
+void
+pkgconf_hash_init(pkgconf_hash_t *hash, const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem)
+{
+	memset(hash, 0, sizeof(pkgconf_hash_t));
+
+	hash->allocator = allocator;
+	hash->subsystem = subsystem;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void *pkgconf_hash_lookup(pkgconf_hash_t *hash, const char *key, size_t len)
+ *
+ *    Looks up the value associated with `key`.
+ *
+ *    :param pkgconf_hash_t* hash: The hash table to search.
+ *    :param char* key: The key to look up.
+ *    :param size_t len: The length of the key in bytes.
+ *    :return: the value stored for the key if present, else ``NULL``.
+ *    :rtype: void *
+ */
+void *
+pkgconf_hash_lookup(pkgconf_hash_t *hash, const char *key, size_t len)
+{
+	pkgconf_hash_entry_t *entry = hash_find_slot(hash, key, len, pkgconf_hash_str(key, len));
+
+	return entry != NULL ? entry->value : NULL;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_hash_reserve(pkgconf_hash_t *hash, size_t count)
+ *
+ *    Grows the hash table so that it can hold `count` entries without growing again.
+ *
+ *    :param pkgconf_hash_t* hash: The hash table to grow.
+ *    :param size_t count: The number of entries the table must be able to hold.
+ *    :return: true if the table can hold `count` entries, false if its storage could not be grown.
+ *    :rtype: bool
+ */
+bool
+pkgconf_hash_reserve(pkgconf_hash_t *hash, size_t count)
+{
+	size_t size = hash->size ? hash->size : PKGCONF_HASH_MIN_SIZE;
+
+	/* keep the load factor at or below 3/4 */
+	while (count * 4 > size * 3)
+		size *= 2;
+
+	if (size == hash->size)
+		return true;
+
+	return hash_resize(hash, size);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void *pkgconf_hash_insert(pkgconf_hash_t *hash, const char *key, size_t len, void *value)
+ *
+ *    Associates `value` with `key`, replacing any value previously stored for it.
+ *    The table does not take a copy of `key`.  A new key is dropped if the table
+ *    can not grow to hold it; callers which must know use ``pkgconf_hash_reserve()`` first.
+ *
+ *    :param pkgconf_hash_t* hash: The hash table to modify.
+ *    :param char* key: The key to store the value under.
+ *    :param size_t len: The length of the key in bytes.
+ *    :param void* value: The value to store, which must not be ``NULL``.
+ *    :return: the value previously stored for the key, if any, else ``NULL``.
+ *    :rtype: void *
+ */
+void *
+pkgconf_hash_insert(pkgconf_hash_t *hash, const char *key, size_t len, void *value)
+{
+	pkgconf_hash_entry_t entry = {
+		.key = key,
+		.keylen = len,
+		.hash = pkgconf_hash_str(key, len),
+		.value = value,
+	};
+	pkgconf_hash_entry_t *slot;
+
+	slot = hash_find_slot(hash, key, len, entry.hash);
+	if (slot != NULL)
+	{
+		void *old = slot->value;
+
+		*slot = entry;
+		return old;
+	}
+
+	if (!pkgconf_hash_reserve(hash, hash->count + 1))
+		return NULL;
+
+	hash_place(hash, &entry);
+	hash->count++;
+
+	return NULL;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void *pkgconf_hash_delete(pkgconf_hash_t *hash, const char *key, size_t len)
+ *
+ *    Removes `key` from the hash table.
+ *
+ *    :param pkgconf_hash_t* hash: The hash table to modify.
+ *    :param char* key: The key to remove.
+ *    :param size_t len: The length of the key in bytes.
+ *    :return: the value which was stored for the key, if any, else ``NULL``.
+ *    :rtype: void *
+ */
+void *
+pkgconf_hash_delete(pkgconf_hash_t *hash, const char *key, size_t len)
+{
+	pkgconf_hash_entry_t *slot = hash_find_slot(hash, key, len, pkgconf_hash_str(key, len));
+	size_t i, j, mask = hash->size - 1;
+	void *value;
+
+	if (slot == NULL)
+		return NULL;
+
+	value = slot->value;
+	i = slot - hash->entries;
+
+	/* shift back any following entries which would no longer be reachable */
+	for (j = (i + 1) & mask; hash->entries[j].key != NULL; j = (j + 1) & mask)
+	{
+		size_t home = hash_home(hash, hash->entries[j].hash);
+
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			hash->entries[i] = hash->entries[j];
+			i = j;
+		}
+	}
+
+	memset(&hash->entries[i], 0, sizeof(pkgconf_hash_entry_t));
+	hash->count--;
+
+	return value;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void *pkgconf_hash_next(const pkgconf_hash_t *hash, size_t *cursor)
+ *
+ *    Iterates over the values stored in a hash table, in no particular order.
+ *    The cursor should be initialized to zero before the first call.  The table
+ *    must not be modified while an iteration is in progress.
+ *
+ *    :param pkgconf_hash_t* hash: The hash table to iterate over.
+ *    :param size_t* cursor: The iteration state.
+ *    :return: the next value, or ``NULL`` when the iteration is complete.
+ *    :rtype: void *
+ */
+void *
+pkgconf_hash_next(const pkgconf_hash_t *hash, size_t *cursor)
+{
+	while (*cursor < hash->size)
+	{
+		const pkgconf_hash_entry_t *entry = &hash->entries[(*cursor)++];
+
+		if (entry->key != NULL)
+			return entry->value;
+	}
+
+	return NULL;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_hash_get_stats(const pkgconf_hash_t *hash, pkgconf_hash_stats_t *stats)
+ *
+ *    Retrieves occupancy and probe length statistics for a hash table.  Probe lengths
+ *    count the number of slots examined by each lookup, insertion or removal since the
+ *    table was created.
+ *
+ *    :param pkgconf_hash_t* hash: The hash table to inspect.
+ *    :param pkgconf_hash_stats_t* stats: The structure to fill in.
+ *    :return: nothing
+ */
+void
+pkgconf_hash_get_stats(const pkgconf_hash_t *hash, pkgconf_hash_stats_t *stats)
+{
+	*stats = hash->stats;
+	stats->count = hash->count;
+	stats->size = hash->size;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_hash_free(pkgconf_hash_t *hash)
+ *
+ *    Releases the storage used by a hash table.  The keys and values are not freed.
+ *    The table is left empty and may be reused, with the same allocator.
+ *
+ *    :param pkgconf_hash_t* hash: The hash table to release.
+ *    :return: nothing
+ */
+void
+pkgconf_hash_free(pkgconf_hash_t *hash)
+{
+	pkgconf_alloc_free(hash->allocator, hash->subsystem, hash->entries);
+	pkgconf_hash_init(hash, hash->allocator, hash->subsystem);
+}
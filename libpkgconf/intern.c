@@ -0,0 +1,179 @@
+/*
+ * intern.c
+ * deduplicated storage of immutable strings
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
+
+/*
+ * !doc
+ *
+ * libpkgconf `intern` module
+ * ==========================
+ *
+ * The libpkgconf `intern` module keeps a single, immutable copy of strings which would
+ * otherwise be duplicated many times over, such as package names in dependency nodes and
+ * the text of fragments like ``-L/usr/lib``, which appear in a large number of packages.
+ *
+ * Every client owns an intern table.  The package names and versions of dependency nodes
+ * and the text of fragments created by a client are interned in its table, so two of them
+ * are equal if and only if their pointers are equal.  Interned strings are never released
+ * individually: they remain valid until the client is deinitialized.
+ *
+ * The table also keeps the parsed form of the versions interned in it, so that a version
+ * shared by many packages and dependency nodes is only split into segments once.
+ */
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_intern_table_t *pkgconf_intern_table_new(const pkgconf_allocator_t *allocator)
+ *
+ *    Creates an empty intern table.  The table and the strings interned in it are allocated
+ *    from `allocator`.
+ *
+ *    :param pkgconf_allocator_t* allocator: The allocator to use, or ``NULL`` for the C library.
+ *    :return: the intern table, else ``NULL``.
+ *    :rtype: pkgconf_intern_table_t *
+ */
+pkgconf_intern_table_t *
+pkgconf_intern_table_new(const pkgconf_allocator_t *allocator)
+{
+	pkgconf_intern_table_t *table = pkgconf_alloc(allocator, PKGCONF_ALLOC_STRING, sizeof(pkgconf_intern_table_t));
+
+	if (table == NULL)
+		return NULL;
+
+	table->allocator = allocator;
+	pkgconf_arena_init(&table->arena, allocator, PKGCONF_ALLOC_STRING);
+	pkgconf_hash_init(&table->table, allocator, PKGCONF_ALLOC_STRING);
+	pkgconf_hash_init(&table->versions, allocator, PKGCONF_ALLOC_STRING);
+
+	return table;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_intern_table_free(pkgconf_intern_table_t *table)
+ *
+ *    Releases an intern table along with every string interned in it.
+ *
+ *    :param pkgconf_intern_table_t* table: The intern table to release, or ``NULL``.
+ *    :return: nothing
+ */
+void
+pkgconf_intern_table_free(pkgconf_intern_table_t *table)
+{
+	if (table == NULL)
+		return;
+
+	pkgconf_hash_free(&table->table);
+	pkgconf_hash_free(&table->versions);
+	pkgconf_arena_free(&table->arena);
+
+	pkgconf_alloc_free(table->allocator, PKGCONF_ALLOC_STRING, table);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: const char *pkgconf_intern_strn(pkgconf_intern_table_t *table, const char *str, size_t len)
+ *
+ *    Interns at most `len` bytes of a string.  The string does not need to be terminated
+ *    if it is `len` bytes or longer.
+ *
+ *    :param pkgconf_intern_table_t* table: The intern table to use.
+ *    :param char* str: The string to intern.
+ *    :param size_t len: The maximum number of bytes to intern.
+ *    :return: the interned copy of the string, else ``NULL``.
+ *    :rtype: const char *
+ */
+const char *
+pkgconf_intern_strn(pkgconf_intern_table_t *table, const char *str, size_t len)
+{
+	const char *nul;
+	char *copy;
+
+	if ((nul = memchr(str, '\0', len)) != NULL)
+		len = nul - str;
+
+	if ((copy = pkgconf_hash_lookup(&table->table, str, len)) != NULL)
+		return copy;
+
+	if ((copy = pkgconf_arena_strndup(&table->arena, str, len)) == NULL)
+		return NULL;
+
+	pkgconf_hash_insert(&table->table, copy, len, copy);
+	table->count++;
+	table->bytes += len + 1;
+
+	return copy;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: const char *pkgconf_intern_str(pkgconf_intern_table_t *table, const char *str)
+ *
+ *    Interns a string.
+ *
+ *    :param pkgconf_intern_table_t* table: The intern table to use.
+ *    :param char* str: The string to intern.
+ *    :return: the interned copy of the string, else ``NULL``.
+ *    :rtype: const char *
+ */
+const char *
+pkgconf_intern_str(pkgconf_intern_table_t *table, const char *str)
+{
+	return pkgconf_intern_strn(table, str, strlen(str));
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: const pkgconf_version_t *pkgconf_intern_version(pkgconf_intern_table_t *table, const char *str)
+ *
+ *    Interns a version and returns its parsed form, see ``pkgconf_version_parse()``.  The version is
+ *    only parsed the first time it is interned.
+ *
+ *    :param pkgconf_intern_table_t* table: The intern table to use.
+ *    :param char* str: The version to intern, or ``NULL``.
+ *    :return: the parsed version, else ``NULL``.
+ *    :rtype: const pkgconf_version_t *
+ */
+const pkgconf_version_t *
+pkgconf_intern_version(pkgconf_intern_table_t *table, const char *str)
+{
+	pkgconf_version_t *version;
+	size_t len;
+
+	if (str == NULL)
+		return NULL;
+
+	len = strlen(str);
+	if ((version = pkgconf_hash_lookup(&table->versions, str, len)) != NULL)
+		return version;
+
+	if ((str = pkgconf_intern_strn(table, str, len)) == NULL)
+		return NULL;
+
+	if ((version = pkgconf_version_parse(&table->arena, str)) == NULL)
+		return NULL;
+
+	pkgconf_hash_insert(&table->versions, version->str, len, version);
+
+	return version;
+}
@@ -30,9 +30,15 @@ struct pkgconf_node_ {
 typedef struct {
 	pkgconf_node_t *head, *tail;
 	size_t length;
+
+	/* bumped by every change to the list, so that an index can tell it has gone stale */
+	size_t serial;
+
+	/* optional lookup index, owned by the module which manages the list's entries */
+	void *index;
 } pkgconf_list_t;
 
-#define PKGCONF_LIST_INITIALIZER		{ NULL, NULL, 0 }
+#define PKGCONF_LIST_INITIALIZER		{ NULL, NULL, 0, 0, NULL }
 
 static inline void
 pkgconf_list_zero(pkgconf_list_t *list)
@@ -40,6 +46,7 @@ pkgconf_list_zero(pkgconf_list_t *list)
 	list->head = NULL;
 	list->tail = NULL;
 	list->length = 0;
+	list->serial++;
 }
 
 static inline void
@@ -48,6 +55,7 @@ pkgconf_node_insert(pkgconf_node_t *node, void *data, pkgconf_list_t *list)
 	pkgconf_node_t *tnode;
 
 	node->data = data;
+	list->serial++;
 
 	if (list->head == NULL)
 	{
@@ -72,6 +80,7 @@ pkgconf_node_insert_tail(pkgconf_node_t *node, void *data, pkgconf_list_t *list)
 	pkgconf_node_t *tnode;
 
 	node->data = data;
+	list->serial++;
 
 	if (list->tail == NULL)
 	{
@@ -94,6 +103,7 @@ static inline void
 pkgconf_node_delete(pkgconf_node_t *node, pkgconf_list_t *list)
 {
 	list->length--;
+	list->serial++;
 
 	if (node->prev == NULL)
 		list->head = node->next;
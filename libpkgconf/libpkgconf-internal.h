@@ -0,0 +1,133 @@
+/*
+ * libpkgconf-internal.h
+ * Declarations shared between the modules of libpkgconf which are not part of its API.
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#ifndef LIBPKGCONF__LIBPKGCONF_INTERNAL_H
+#define LIBPKGCONF__LIBPKGCONF_INTERNAL_H
+
+#include <libpkgconf/libpkgconf.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Nothing declared here is exported with PKGCONF_API or installed, so it may change
+ * without a soname bump.  The types of fields embedded in public structures, such as
+ * pkgconf_hash_t and pkgconf_arena_t, stay in libpkgconf.h.
+ */
+
+typedef enum {
+	PKGCONF_CLOSURE_VISIT,
+	PKGCONF_CLOSURE_FUNC,
+	PKGCONF_CLOSURE_HIT,
+	PKGCONF_CLOSURE_SKIP,
+	PKGCONF_CLOSURE_REPLAY
+} pkgconf_closure_step_type_t;
+
+typedef struct {
+	pkgconf_closure_step_type_t type;
+	bool is_private;
+
+	pkgconf_pkg_t *pkg;
+	pkgconf_dependency_t *dep;
+	pkgconf_closure_t *closure;
+} pkgconf_closure_step_t;
+
+struct pkgconf_closure_ {
+	pkgconf_closure_t *next;
+
+	unsigned int flags;
+	unsigned int skip_flags;
+	uint64_t generation;
+
+	int levels;
+	size_t nesting;
+
+	size_t count;
+	pkgconf_closure_step_t *steps;
+};
+
+/* hash.c */
+unsigned int pkgconf_hash_str(const char *key, size_t len);
+void pkgconf_hash_init(pkgconf_hash_t *hash, const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem);
+void *pkgconf_hash_lookup(pkgconf_hash_t *hash, const char *key, size_t len);
+bool pkgconf_hash_reserve(pkgconf_hash_t *hash, size_t count);
+void *pkgconf_hash_insert(pkgconf_hash_t *hash, const char *key, size_t len, void *value);
+void *pkgconf_hash_delete(pkgconf_hash_t *hash, const char *key, size_t len);
+void *pkgconf_hash_next(const pkgconf_hash_t *hash, size_t *cursor);
+void pkgconf_hash_get_stats(const pkgconf_hash_t *hash, pkgconf_hash_stats_t *stats);
+void pkgconf_hash_free(pkgconf_hash_t *hash);
+
+/* arena.c */
+void pkgconf_arena_init(pkgconf_arena_t *arena, const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem);
+void *pkgconf_arena_alloc(pkgconf_arena_t *arena, size_t size);
+char *pkgconf_arena_strdup(pkgconf_arena_t *arena, const char *str);
+char *pkgconf_arena_strndup(pkgconf_arena_t *arena, const char *str, size_t len);
+void pkgconf_arena_reset(pkgconf_arena_t *arena);
+void pkgconf_arena_free(pkgconf_arena_t *arena);
+
+/* intern.c */
+pkgconf_intern_table_t *pkgconf_intern_table_new(const pkgconf_allocator_t *allocator);
+void pkgconf_intern_table_free(pkgconf_intern_table_t *table);
+const char *pkgconf_intern_str(pkgconf_intern_table_t *table, const char *str);
+const char *pkgconf_intern_strn(pkgconf_intern_table_t *table, const char *str, size_t len);
+const pkgconf_version_t *pkgconf_intern_version(pkgconf_intern_table_t *table, const char *str);
+
+/* closure.c */
+pkgconf_closure_t *pkgconf_closure_new(pkgconf_client_t *client, pkgconf_pkg_t *pkg, unsigned int flags, unsigned int skip_flags, int levels, const pkgconf_closure_step_t *steps, size_t count);
+pkgconf_closure_t *pkgconf_closure_lookup(pkgconf_client_t *client, pkgconf_pkg_t *pkg, unsigned int flags, unsigned int skip_flags, int maxdepth);
+bool pkgconf_closure_replay(pkgconf_client_t *client, const pkgconf_closure_t *closure, pkgconf_pkg_traverse_func_t func, void *data, uint64_t *first_visit);
+void pkgconf_closure_free(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
+void pkgconf_closure_invalidate(pkgconf_client_t *client);
+
+/* prefetch.c */
+pkgconf_prefetch_t *pkgconf_prefetch_new(unsigned int threads);
+bool pkgconf_prefetch_add(pkgconf_prefetch_t *prefetch, const char *path);
+size_t pkgconf_prefetch_count(const pkgconf_prefetch_t *prefetch);
+const char *pkgconf_prefetch_path(const pkgconf_prefetch_t *prefetch, size_t index);
+bool pkgconf_prefetch_start(pkgconf_prefetch_t *prefetch);
+bool pkgconf_prefetch_wait(pkgconf_prefetch_t *prefetch, size_t index);
+void pkgconf_prefetch_replay(pkgconf_prefetch_t *prefetch, size_t index, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc);
+void pkgconf_prefetch_free(pkgconf_prefetch_t *prefetch);
+
+/* parser.c */
+void pkgconf_parser_parse_alloc(const pkgconf_allocator_t *allocator, FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename);
+
+/* tuple.c */
+char *pkgconf_tuple_parse_alloc(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *value, unsigned int flags);
+
+/* stats.c */
+pkgconf_stats_phase_t pkgconf_stats_enter(pkgconf_stats_t *stats, pkgconf_stats_phase_t phase);
+void pkgconf_stats_leave(pkgconf_stats_t *stats, pkgconf_stats_phase_t phase);
+
+/* collecting statistics costs a single test while no pkgconf_stats_t is attached to the client */
+#define PKGCONF_STATS_COUNT(client, counter, n) do { \
+		if ((client)->stats != NULL) \
+			(client)->stats->counter += (n); \
+	} while (0)
+
+#define PKGCONF_STATS_ENTER(client, phase) \
+	((client)->stats != NULL ? pkgconf_stats_enter((client)->stats, (phase)) : PKGCONF_STATS_PHASE_OTHER)
+
+#define PKGCONF_STATS_LEAVE(client, phase) do { \
+		if ((client)->stats != NULL) \
+			pkgconf_stats_leave((client)->stats, (phase)); \
+	} while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -60,6 +60,55 @@ typedef enum {
 
 #define PKGCONF_CMP_COUNT 7
 
+typedef enum {
+	PKGCONF_ALLOC_PARSER,
+	PKGCONF_ALLOC_TUPLE,
+	PKGCONF_ALLOC_FRAGMENT,
+	PKGCONF_ALLOC_DEPENDENCY,
+	PKGCONF_ALLOC_PACKAGE,
+	PKGCONF_ALLOC_CACHE,
+	PKGCONF_ALLOC_QUERY,
+	PKGCONF_ALLOC_STRING
+} pkgconf_alloc_subsystem_t;
+
+#define PKGCONF_ALLOC_SUBSYSTEM_COUNT 8
+
+typedef enum {
+	PKGCONF_STATS_PHASE_OTHER,
+	PKGCONF_STATS_PHASE_INIT,
+	PKGCONF_STATS_PHASE_SEARCH,
+	PKGCONF_STATS_PHASE_OPEN,
+	PKGCONF_STATS_PHASE_PARSE,
+	PKGCONF_STATS_PHASE_EXPAND,
+	PKGCONF_STATS_PHASE_TRAVERSE,
+	PKGCONF_STATS_PHASE_RENDER
+} pkgconf_stats_phase_t;
+
+#define PKGCONF_STATS_PHASE_COUNT 8
+
+typedef enum {
+	PKGCONF_VERSION_SEGMENT_NUMERIC,
+	PKGCONF_VERSION_SEGMENT_ALPHA,
+	PKGCONF_VERSION_SEGMENT_TILDE
+} pkgconf_version_segment_type_t;
+
+typedef struct {
+	pkgconf_version_segment_type_t type;
+
+	/* not terminated; numeric segments do not include their leading zeroes */
+	const char *text;
+	size_t len;
+} pkgconf_version_segment_t;
+
+typedef struct {
+	const char *str;
+	size_t len;
+	bool has_upper;
+
+	size_t count;
+	pkgconf_version_segment_t *segments;
+} pkgconf_version_t;
+
 typedef struct pkgconf_pkg_ pkgconf_pkg_t;
 typedef struct pkgconf_dependency_ pkgconf_dependency_t;
 typedef struct pkgconf_tuple_ pkgconf_tuple_t;
@@ -67,6 +116,10 @@ typedef struct pkgconf_fragment_ pkgconf_fragment_t;
 typedef struct pkgconf_path_ pkgconf_path_t;
 typedef struct pkgconf_client_ pkgconf_client_t;
 typedef struct pkgconf_cross_personality_ pkgconf_cross_personality_t;
+typedef struct pkgconf_parsecache_ pkgconf_parsecache_t;
+typedef struct pkgconf_closure_ pkgconf_closure_t;
+typedef struct pkgconf_prefetch_ pkgconf_prefetch_t;
+typedef struct pkgconf_pkg_deferred_ pkgconf_pkg_deferred_t;
 
 #define PKGCONF_ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
 
@@ -86,17 +139,21 @@ struct pkgconf_fragment_ {
 	pkgconf_node_t iter;
 
 	char type;
-	char *data;
+	const char *data;
 
 	bool merged;
+	bool arena_owned;
+
+	const pkgconf_client_t *owner;
 };
 
 struct pkgconf_dependency_ {
 	pkgconf_node_t iter;
 
-	char *package;
+	const char *package;
 	pkgconf_pkg_comparator_t compare;
-	char *version;
+	const char *version;
+	const pkgconf_version_t *version_key;
 	pkgconf_pkg_t *parent;
 	pkgconf_pkg_t *match;
 
@@ -104,6 +161,8 @@ struct pkgconf_dependency_ {
 
 	int refcount;
 	pkgconf_client_t *owner;
+
+	bool arena_owned;
 };
 
 struct pkgconf_tuple_ {
@@ -111,6 +170,16 @@ struct pkgconf_tuple_ {
 
 	char *key;
 	char *value;
+
+	/* memoized expansion of value, managed by the tuple module */
+	char *expanded;
+	uint64_t expanded_serial;
+	unsigned int expanded_flags;
+	unsigned int expanded_client_flags;
+
+	bool arena_owned;
+
+	const pkgconf_client_t *owner;
 };
 
 struct pkgconf_path_ {
@@ -126,6 +195,12 @@ struct pkgconf_path_ {
 #define PKGCONF_PKG_PROPF_CACHED		0x02
 #define PKGCONF_PKG_PROPF_UNINSTALLED		0x08
 #define PKGCONF_PKG_PROPF_VIRTUAL		0x10
+#define PKGCONF_PKG_PROPF_ARENA			0x20
+
+/* groups of fields which are parsed on first use by PKGCONF_PKG_PKGF_LAZY_PARSE, see pkgconf_pkg_materialize() */
+#define PKGCONF_PKG_FIELDF_DEPENDENCIES		0x1
+#define PKGCONF_PKG_FIELDF_FRAGMENTS		0x2
+#define PKGCONF_PKG_FIELDF_ALL			(PKGCONF_PKG_FIELDF_DEPENDENCIES | PKGCONF_PKG_FIELDF_FRAGMENTS)
 
 struct pkgconf_pkg_ {
 	int refcount;
@@ -137,6 +212,8 @@ struct pkgconf_pkg_ {
 	char *url;
 	char *pc_filedir;
 
+	const pkgconf_version_t *version_key;
+
 	pkgconf_list_t libs;
 	pkgconf_list_t libs_private;
 	pkgconf_list_t cflags;
@@ -160,8 +237,15 @@ struct pkgconf_pkg_ {
 	pkgconf_tuple_t *prefix;
 
 	uint64_t serial;
+	uint64_t visit;
 
 	size_t hits;
+
+	/* see pkgconf_closure_lookup() */
+	pkgconf_closure_t *closures;
+
+	/* fields left unparsed by PKGCONF_PKG_PKGF_LAZY_PARSE, see pkgconf_pkg_materialize() */
+	pkgconf_pkg_deferred_t *deferred;
 };
 
 typedef bool (*pkgconf_pkg_iteration_func_t)(const pkgconf_pkg_t *pkg, void *data);
@@ -169,6 +253,124 @@ typedef void (*pkgconf_pkg_traverse_func_t)(pkgconf_client_t *client, pkgconf_pk
 typedef bool (*pkgconf_queue_apply_func_t)(pkgconf_client_t *client, pkgconf_pkg_t *world, void *data, int maxdepth);
 typedef bool (*pkgconf_error_handler_func_t)(const char *msg, const pkgconf_client_t *client, void *data);
 
+typedef struct {
+	const char *key;
+	size_t keylen;
+	unsigned int hash;
+	void *value;
+} pkgconf_hash_entry_t;
+
+typedef struct {
+	size_t count;
+	size_t size;
+
+	size_t lookups;
+	size_t probes;
+	size_t max_probe;
+} pkgconf_hash_stats_t;
+
+typedef void *(*pkgconf_malloc_func_t)(void *data, size_t size, pkgconf_alloc_subsystem_t subsystem);
+typedef void *(*pkgconf_realloc_func_t)(void *data, void *ptr, size_t size, pkgconf_alloc_subsystem_t subsystem);
+typedef void (*pkgconf_free_func_t)(void *data, void *ptr, pkgconf_alloc_subsystem_t subsystem);
+
+/*
+ * the memory of client objects comes from the client's allocator, except for:
+ * - memory handed to the caller to release with free(), such as the strings returned by
+ *   pkgconf_tuple_parse() and pkgconf_fragment_render()
+ * - objects created by functions which are not given a client: queue entries, path lists,
+ *   split argument vectors, personalities and the files read by pkgconf_parser_parse(),
+ *   which includes the prefetch worker threads
+ * - the client object itself when created by pkgconf_client_new(), and its sysroot, buildroot
+ *   and prefix variable name settings
+ */
+typedef struct {
+	pkgconf_malloc_func_t malloc_func;
+	pkgconf_realloc_func_t realloc_func;
+	pkgconf_free_func_t free_func;
+
+	void *data;
+} pkgconf_allocator_t;
+
+typedef struct {
+	pkgconf_hash_entry_t *entries;
+	size_t size;
+	size_t count;
+
+	pkgconf_hash_stats_t stats;
+
+	/* see pkgconf_hash_init(); a zero-initialized table uses the C library */
+	const pkgconf_allocator_t *allocator;
+	pkgconf_alloc_subsystem_t subsystem;
+} pkgconf_hash_t;
+
+typedef struct {
+	size_t allocations;
+	size_t frees;
+	size_t bytes;
+	size_t peak_bytes;
+} pkgconf_alloc_stats_t;
+
+typedef struct {
+	pkgconf_allocator_t allocator;
+
+	pkgconf_alloc_stats_t subsystems[PKGCONF_ALLOC_SUBSYSTEM_COUNT];
+	pkgconf_alloc_stats_t total;
+} pkgconf_counting_allocator_t;
+
+typedef struct pkgconf_arena_chunk_ pkgconf_arena_chunk_t;
+
+typedef struct {
+	pkgconf_arena_chunk_t *chunks;
+
+	size_t allocated;
+	size_t reserved;
+
+	const pkgconf_allocator_t *allocator;
+	pkgconf_alloc_subsystem_t subsystem;
+} pkgconf_arena_t;
+
+typedef struct {
+	/* monotonic clock time spent in each phase, in nanoseconds */
+	uint64_t phase_nsec[PKGCONF_STATS_PHASE_COUNT];
+
+	uint64_t files_opened;
+	uint64_t probes_failed;
+	uint64_t bytes_parsed;
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	uint64_t parse_cache_hits;
+	uint64_t parse_cache_misses;
+	uint64_t tuple_lookups;
+	uint64_t fragment_copies;
+	uint64_t fragment_dedups;
+	uint64_t nodes_visited;
+	uint64_t provides_names;
+	uint64_t provides_providers;
+
+	/* the phase in progress, and when its time was last accounted */
+	pkgconf_stats_phase_t phase;
+	uint64_t mark;
+} pkgconf_stats_t;
+
+typedef struct {
+	FILE *out;
+
+	/* when the sink was attached, and the number of events written since */
+	uint64_t epoch;
+	size_t count;
+} pkgconf_traceevent_sink_t;
+
+typedef struct {
+	pkgconf_hash_t table;
+	pkgconf_hash_t versions;
+	pkgconf_arena_t arena;
+
+	size_t count;
+	size_t bytes;
+
+	const pkgconf_allocator_t *allocator;
+} pkgconf_intern_table_t;
+
 struct pkgconf_client_ {
 	pkgconf_list_t dir_list;
 
@@ -197,9 +399,36 @@ struct pkgconf_client_ {
 	bool already_sent_notice;
 
 	uint64_t serial;
+	uint64_t visits;
+	uint64_t closure_generation;
+
+	pkgconf_hash_t cache_table;
+	pkgconf_hash_t dir_index;
+
+	pkgconf_hash_t provides_index;
+	bool provides_indexed;
+
+	pkgconf_parsecache_t *parse_cache;
 
-	pkgconf_pkg_t **cache_table;
-	size_t cache_count;
+	/* see pkgconf_client_set_scan_threads() */
+	unsigned int scan_threads;
+
+	/* objects are allocated from arena, if set; see pkgconf_client_begin_query() */
+	pkgconf_arena_t *arena;
+	pkgconf_arena_t cache_arena;
+	pkgconf_arena_t query_arena;
+
+	/* see pkgconf_client_set_allocator() */
+	pkgconf_allocator_t allocator;
+
+	/* held by pointer so that strings can be interned through a const client */
+	pkgconf_intern_table_t *interns;
+
+	/* see pkgconf_client_set_stats() */
+	pkgconf_stats_t *stats;
+
+	/* see pkgconf_traceevent_open() */
+	pkgconf_traceevent_sink_t *traceevents;
 };
 
 struct pkgconf_cross_personality_ {
@@ -236,6 +465,21 @@ PKGCONF_API void pkgconf_client_set_error_handler(pkgconf_client_t *client, pkgc
 PKGCONF_API pkgconf_error_handler_func_t pkgconf_client_get_trace_handler(const pkgconf_client_t *client);
 PKGCONF_API void pkgconf_client_set_trace_handler(pkgconf_client_t *client, pkgconf_error_handler_func_t trace_handler, void *trace_handler_data);
 PKGCONF_API void pkgconf_client_dir_list_build(pkgconf_client_t *client, const pkgconf_cross_personality_t *personality);
+PKGCONF_API void pkgconf_client_begin_query(pkgconf_client_t *client);
+PKGCONF_API void pkgconf_client_end_query(pkgconf_client_t *client);
+PKGCONF_API size_t pkgconf_client_get_retained_bytes(const pkgconf_client_t *client);
+PKGCONF_API const pkgconf_allocator_t *pkgconf_client_get_allocator(const pkgconf_client_t *client);
+PKGCONF_API void pkgconf_client_set_allocator(pkgconf_client_t *client, const pkgconf_allocator_t *allocator);
+PKGCONF_API unsigned int pkgconf_client_get_scan_threads(const pkgconf_client_t *client);
+PKGCONF_API void pkgconf_client_set_scan_threads(pkgconf_client_t *client, unsigned int threads);
+PKGCONF_API void pkgconf_client_get_stats(const pkgconf_client_t *client, pkgconf_stats_t *stats);
+PKGCONF_API void pkgconf_client_set_stats(pkgconf_client_t *client, pkgconf_stats_t *stats);
+PKGCONF_API pkgconf_stats_phase_t pkgconf_client_enter_phase(pkgconf_client_t *client, pkgconf_stats_phase_t phase);
+PKGCONF_API void pkgconf_client_leave_phase(pkgconf_client_t *client, pkgconf_stats_phase_t phase);
+PKGCONF_API void *pkgconf_client_alloc(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, size_t size);
+PKGCONF_API char *pkgconf_client_strdup(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, const char *str);
+PKGCONF_API char *pkgconf_client_strndup(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, const char *str, size_t len);
+PKGCONF_API void pkgconf_client_dealloc(const pkgconf_client_t *client, pkgconf_alloc_subsystem_t subsystem, void *ptr);
 
 /* personality.c */
 PKGCONF_API pkgconf_cross_personality_t *pkgconf_cross_personality_default(void);
@@ -263,6 +507,7 @@ PKGCONF_API void pkgconf_cross_personality_deinit(pkgconf_cross_personality_t *p
 #define PKGCONF_PKG_PKGF_DONT_MERGE_SPECIAL_FRAGMENTS	0x4000
 #define PKGCONF_PKG_PKGF_FDO_SYSROOT_RULES		0x8000
 #define PKGCONF_PKG_PKGF_PKGCONF1_SYSROOT_RULES         0x10000
+#define PKGCONF_PKG_PKGF_LAZY_PARSE			0x20000
 
 #define PKGCONF_PKG_DEPF_INTERNAL		0x1
 
@@ -288,6 +533,11 @@ typedef void (*pkgconf_parser_warn_func_t)(void *data, const char *fmt, ...);
 
 PKGCONF_API void pkgconf_parser_parse(FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename);
 
+/* parsecache.c */
+PKGCONF_API bool pkgconf_parsecache_open(pkgconf_client_t *client, const char *path);
+PKGCONF_API void pkgconf_parsecache_close(pkgconf_client_t *client);
+PKGCONF_API void pkgconf_parsecache_parse(pkgconf_client_t *client, FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename);
+
 /* pkg.c */
 PKGCONF_API bool pkgconf_error(const pkgconf_client_t *client, const char *format, ...) PRINTFLIKE(2, 3);
 PKGCONF_API bool pkgconf_warn(const pkgconf_client_t *client, const char *format, ...) PRINTFLIKE(2, 3);
@@ -312,6 +562,9 @@ PKGCONF_API pkgconf_pkg_t *pkgconf_pkg_ref(pkgconf_client_t *client, pkgconf_pkg
 PKGCONF_API void pkgconf_pkg_unref(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
 PKGCONF_API void pkgconf_pkg_free(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
 PKGCONF_API pkgconf_pkg_t *pkgconf_pkg_find(pkgconf_client_t *client, const char *name);
+PKGCONF_API void pkgconf_pkg_materialize(pkgconf_client_t *client, pkgconf_pkg_t *pkg, unsigned int fields);
+PKGCONF_API void pkgconf_pkg_dir_index_free(pkgconf_client_t *client);
+PKGCONF_API void pkgconf_pkg_provides_index_free(pkgconf_client_t *client);
 PKGCONF_API unsigned int pkgconf_pkg_traverse(pkgconf_client_t *client, pkgconf_pkg_t *root, pkgconf_pkg_traverse_func_t func, void *data, int maxdepth, unsigned int skip_flags);
 PKGCONF_API unsigned int pkgconf_pkg_verify_graph(pkgconf_client_t *client, pkgconf_pkg_t *root, int depth);
 PKGCONF_API pkgconf_pkg_t *pkgconf_pkg_verify_dependency(pkgconf_client_t *client, pkgconf_dependency_t *pkgdep, unsigned int *eflags);
@@ -321,7 +574,6 @@ PKGCONF_API unsigned int pkgconf_pkg_libs(pkgconf_client_t *client, pkgconf_pkg_
 PKGCONF_API pkgconf_pkg_comparator_t pkgconf_pkg_comparator_lookup_by_name(const char *name);
 PKGCONF_API pkgconf_pkg_t *pkgconf_builtin_pkg_get(const char *name);
 
-PKGCONF_API int pkgconf_compare_version(const char *a, const char *b);
 PKGCONF_API pkgconf_pkg_t *pkgconf_scan_all(pkgconf_client_t *client, void *ptr, pkgconf_pkg_iteration_func_t func);
 
 /* parse.c */
@@ -385,12 +637,50 @@ PKGCONF_API pkgconf_pkg_t *pkgconf_cache_lookup(pkgconf_client_t *client, const
 PKGCONF_API void pkgconf_cache_add(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
 PKGCONF_API void pkgconf_cache_remove(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
 PKGCONF_API void pkgconf_cache_free(pkgconf_client_t *client);
+PKGCONF_API void pkgconf_cache_reset_hits(pkgconf_client_t *client);
+PKGCONF_API void pkgconf_cache_get_stats(const pkgconf_client_t *client, pkgconf_hash_stats_t *stats);
+
+/* alloc.c */
+PKGCONF_API const char *pkgconf_alloc_subsystem_name(pkgconf_alloc_subsystem_t subsystem);
+PKGCONF_API void *pkgconf_alloc(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, size_t size);
+PKGCONF_API void *pkgconf_alloc_realloc(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, void *ptr, size_t size);
+PKGCONF_API char *pkgconf_alloc_strdup(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, const char *str);
+PKGCONF_API char *pkgconf_alloc_strndup(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, const char *str, size_t len);
+PKGCONF_API void pkgconf_alloc_free(const pkgconf_allocator_t *allocator, pkgconf_alloc_subsystem_t subsystem, void *ptr);
+PKGCONF_API void pkgconf_counting_allocator_init(pkgconf_counting_allocator_t *counter);
+
+/* version.c */
+PKGCONF_API int pkgconf_compare_version(const char *a, const char *b);
+PKGCONF_API pkgconf_version_t *pkgconf_version_parse(pkgconf_arena_t *arena, const char *str);
+PKGCONF_API int pkgconf_version_compare(const pkgconf_version_t *a, const pkgconf_version_t *b);
 
 /* audit.c */
 PKGCONF_API void pkgconf_audit_set_log(pkgconf_client_t *client, FILE *auditf);
 PKGCONF_API void pkgconf_audit_log(pkgconf_client_t *client, const char *format, ...) PRINTFLIKE(2, 3);
 PKGCONF_API void pkgconf_audit_log_dependency(pkgconf_client_t *client, const pkgconf_pkg_t *dep, const pkgconf_dependency_t *depnode);
 
+/* stats.c */
+PKGCONF_API uint64_t pkgconf_stats_clock(void);
+PKGCONF_API const char *pkgconf_stats_phase_name(pkgconf_stats_phase_t phase);
+PKGCONF_API void pkgconf_stats_reset(pkgconf_stats_t *stats);
+
+/* traceevent.c */
+PKGCONF_API bool pkgconf_traceevent_open(pkgconf_client_t *client, FILE *out);
+PKGCONF_API void pkgconf_traceevent_close(pkgconf_client_t *client);
+PKGCONF_API void pkgconf_traceevent_begin(const pkgconf_client_t *client, const char *name, const char *key, const char *value);
+PKGCONF_API void pkgconf_traceevent_end(const pkgconf_client_t *client, const char *name);
+
+/* writing a span costs a single test while no trace-event sink is attached to the client */
+#define PKGCONF_TRACEEVENT_BEGIN(client, name, key, value) do { \
+		if ((client)->traceevents != NULL) \
+			pkgconf_traceevent_begin((client), (name), (key), (value)); \
+	} while (0)
+
+#define PKGCONF_TRACEEVENT_END(client, name) do { \
+		if ((client)->traceevents != NULL) \
+			pkgconf_traceevent_end((client), (name)); \
+	} while (0)
+
 /* path.c */
 PKGCONF_API void pkgconf_path_add(const char *text, pkgconf_list_t *dirlist, bool filter);
 PKGCONF_API size_t pkgconf_path_split(const char *text, pkgconf_list_t *dirlist, bool filter);
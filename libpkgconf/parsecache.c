@@ -0,0 +1,776 @@
+/*
+ * parsecache.c
+ * persistent on-disk cache of parsed .pc files
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/config.h>
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+# include <sys/mman.h>
+#else
+# include <process.h>
+# define getpid _getpid
+#endif
+
+/*
+ * !doc
+ *
+ * libpkgconf `parsecache` module
+ * ==============================
+ *
+ * The libpkgconf `parsecache` module implements an optional persistent cache of parsed
+ * `.pc` files.  The cache records the operands produced by the `.pc` file parser (keywords,
+ * raw variable definitions and parser warnings) so that later runs can replay them into a
+ * package object without reading and tokenizing the file again.
+ *
+ * Variable expansion, dependency parsing and fragment parsing still happen when the operands
+ * are replayed, because their results depend on client settings such as the sysroot, prefix
+ * redefinition and ``--define-variable``.
+ *
+ * Entries are validated against the path, size, modification time and inode of the `.pc`
+ * file.  The cache file is written atomically when the client is deinitialized, and is
+ * mapped read-only into memory when it is opened.
+ */
+
+#define PARSECACHE_MAGIC	"PKGCONFC"
+#define PARSECACHE_VERSION	1
+#define PARSECACHE_BYTEORDER	0x01020304U
+
+/* on-disk layout: header, entry table, record table, string table; offsets are from the start of the file */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint32_t count;
+	uint32_t entries;
+	uint64_t size;
+} parsecache_header_t;
+
+typedef struct {
+	uint32_t path;
+	uint32_t records;
+	uint32_t nrecords;
+	uint32_t reserved;
+	uint64_t size;
+	int64_t mtime;
+	int64_t mtime_nsec;
+	uint64_t ino;
+	uint64_t dev;
+} parsecache_entry_t;
+
+/* op is the parser operator character, or 0 for a warning whose message is stored in value */
+typedef struct {
+	uint32_t op;
+	uint32_t lineno;
+	uint32_t key;
+	uint32_t value;
+} parsecache_record_t;
+
+typedef struct {
+	char op;
+	size_t lineno;
+	char *key;
+	char *value;
+} parsecache_mem_record_t;
+
+typedef struct {
+	char *path;
+	parsecache_entry_t stamp;
+
+	parsecache_mem_record_t *records;
+	size_t nrecords;
+} parsecache_mem_entry_t;
+
+struct pkgconf_parsecache_ {
+	char *path;
+
+	/* mapped cache file, if any */
+	const char *base;
+	size_t size;
+
+	/* path -> const parsecache_entry_t * in the mapped file */
+	pkgconf_hash_t disk_entries;
+
+	/* path -> parsecache_mem_entry_t * for files parsed during this session */
+	pkgconf_hash_t mem_entries;
+
+	size_t hits;
+	size_t misses;
+
+	/* the owning client's allocator, used for the cache and its in-memory entries */
+	const pkgconf_allocator_t *allocator;
+};
+
+typedef struct {
+	void *data;
+	const pkgconf_parser_operand_func_t *ops;
+	pkgconf_parser_warn_func_t warnfunc;
+	parsecache_mem_entry_t *entry;
+	const pkgconf_allocator_t *allocator;
+} parsecache_recorder_t;
+
+static bool
+parsecache_stamp_stat(const struct stat *st, parsecache_entry_t *stamp)
+{
+	if ((st->st_mode & S_IFMT) != S_IFREG)
+		return false;
+
+	memset(stamp, 0, sizeof *stamp);
+	stamp->size = (uint64_t) st->st_size;
+	stamp->mtime = (int64_t) st->st_mtime;
+#if defined(__APPLE__)
+	stamp->mtime_nsec = (int64_t) st->st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+	stamp->mtime_nsec = (int64_t) st->st_mtim.tv_nsec;
+#endif
+	stamp->ino = (uint64_t) st->st_ino;
+	stamp->dev = (uint64_t) st->st_dev;
+
+	return true;
+}
+
+static bool
+parsecache_stamp(FILE *f, parsecache_entry_t *stamp)
+{
+	struct stat st;
+
+	if (fstat(fileno(f), &st) != 0)
+		return false;
+
+	return parsecache_stamp_stat(&st, stamp);
+}
+
+static inline bool
+parsecache_stamp_equal(const parsecache_entry_t *a, const parsecache_entry_t *b)
+{
+	return a->size == b->size && a->mtime == b->mtime && a->mtime_nsec == b->mtime_nsec &&
+		a->ino == b->ino && a->dev == b->dev;
+}
+
+static void
+parsecache_unmap(pkgconf_parsecache_t *cache)
+{
+	if (cache->base == NULL)
+		return;
+
+#ifndef _WIN32
+	munmap((void *) cache->base, cache->size);
+#else
+	pkgconf_alloc_free(cache->allocator, PKGCONF_ALLOC_PARSER, (void *) cache->base);
+#endif
+
+	cache->base = NULL;
+	cache->size = 0;
+}
+
+static inline bool
+parsecache_aligned(uint64_t off, size_t align)
+{
+	return (off & (align - 1)) == 0;
+}
+
+/* an entry is only used if everything it refers to lies within the mapped file */
+static bool
+parsecache_entry_valid(const pkgconf_parsecache_t *cache, const parsecache_entry_t *entry)
+{
+	const parsecache_record_t *records;
+	size_t i;
+
+	if (entry->path >= cache->size || entry->records < sizeof(parsecache_header_t) || entry->records > cache->size ||
+	    !parsecache_aligned(entry->records, sizeof(uint32_t)) ||
+	    entry->nrecords > (cache->size - entry->records) / sizeof(parsecache_record_t))
+		return false;
+
+	records = (const parsecache_record_t *) (cache->base + entry->records);
+	for (i = 0; i < entry->nrecords; i++)
+	{
+		if (records[i].key >= cache->size || records[i].value >= cache->size)
+			return false;
+	}
+
+	return true;
+}
+
+static bool
+parsecache_map(pkgconf_client_t *client, pkgconf_parsecache_t *cache)
+{
+	const parsecache_header_t *hdr;
+	const parsecache_entry_t *entries;
+	struct stat st;
+	size_t i;
+	FILE *f;
+
+	f = fopen(cache->path, "rb");
+	if (f == NULL)
+		return false;
+
+	if (fstat(fileno(f), &st) != 0 || (size_t) st.st_size < sizeof(parsecache_header_t))
+	{
+		fclose(f);
+		return false;
+	}
+
+	cache->size = st.st_size;
+#ifndef _WIN32
+	cache->base = mmap(NULL, cache->size, PROT_READ, MAP_SHARED, fileno(f), 0);
+	if (cache->base == MAP_FAILED)
+		cache->base = NULL;
+#else
+	cache->base = pkgconf_alloc_realloc(cache->allocator, PKGCONF_ALLOC_PARSER, NULL, cache->size);
+	if (cache->base != NULL && fread((void *) cache->base, 1, cache->size, f) != cache->size)
+	{
+		pkgconf_alloc_free(cache->allocator, PKGCONF_ALLOC_PARSER, (void *) cache->base);
+		cache->base = NULL;
+	}
+#endif
+	fclose(f);
+
+	if (cache->base == NULL)
+		return false;
+
+	/* the writer terminates the file with a NUL byte, so any in-bounds string offset is safe to use */
+	hdr = (const parsecache_header_t *) cache->base;
+	if (memcmp(hdr->magic, PARSECACHE_MAGIC, sizeof hdr->magic) || hdr->version != PARSECACHE_VERSION ||
+	    hdr->byteorder != PARSECACHE_BYTEORDER || hdr->size != cache->size || cache->base[cache->size - 1] != '\0' ||
+	    hdr->entries < sizeof(parsecache_header_t) || hdr->entries > cache->size ||
+	    !parsecache_aligned(hdr->entries, sizeof(uint64_t)) ||
+	    hdr->count > (cache->size - hdr->entries) / sizeof(parsecache_entry_t))
+	{
+		PKGCONF_TRACE(client, "parse cache %s is invalid, ignoring it", cache->path);
+		parsecache_unmap(cache);
+		return false;
+	}
+
+	entries = (const parsecache_entry_t *) (cache->base + hdr->entries);
+	for (i = 0; i < hdr->count; i++)
+	{
+		const parsecache_entry_t *entry = &entries[i];
+		const char *path;
+
+		if (!parsecache_entry_valid(cache, entry))
+			continue;
+
+		path = cache->base + entry->path;
+		pkgconf_hash_insert(&cache->disk_entries, path, strlen(path), (void *) entry);
+	}
+
+	PKGCONF_TRACE(client, "mapped parse cache %s: %zu entries, %zu bytes", cache->path, cache->disk_entries.count, cache->size);
+
+	return true;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_parsecache_open(pkgconf_client_t *client, const char *path)
+ *
+ *    Enables the persistent parse cache for a client object, using the cache file at `path`.
+ *    The file need not exist yet; it is created or updated when the client is deinitialized.
+ *    Any previously opened parse cache is closed first.
+ *
+ *    :param pkgconf_client_t* client: The client object to modify.
+ *    :param char* path: The path of the cache file.
+ *    :return: true if the cache file was loaded, false if the cache starts out empty.
+ *    :rtype: bool
+ */
+bool
+pkgconf_parsecache_open(pkgconf_client_t *client, const char *path)
+{
+	pkgconf_parsecache_t *cache;
+
+	pkgconf_parsecache_close(client);
+
+	cache = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_PARSER, sizeof(pkgconf_parsecache_t));
+	cache->allocator = &client->allocator;
+	cache->path = pkgconf_alloc_strdup(cache->allocator, PKGCONF_ALLOC_PARSER, path);
+	client->parse_cache = cache;
+
+	return parsecache_map(client, cache);
+}
+
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t cap;
+
+	const pkgconf_allocator_t *allocator;
+} parsecache_buf_t;
+
+/* appends `len` zeroed bytes to the buffer and stores their offset, unless the buffer can not grow */
+static bool
+parsecache_buf_reserve(parsecache_buf_t *buf, size_t len, size_t *off)
+{
+	if (len > SIZE_MAX / 2 - buf->len)
+		return false;
+
+	if (buf->len + len > buf->cap)
+	{
+		size_t cap = buf->cap ? buf->cap : 4096;
+		char *newbuf;
+
+		while (buf->len + len > cap)
+			cap *= 2;
+
+		newbuf = pkgconf_alloc_realloc(buf->allocator, PKGCONF_ALLOC_PARSER, buf->buf, cap);
+		if (newbuf == NULL)
+			return false;
+
+		buf->buf = newbuf;
+		buf->cap = cap;
+	}
+
+	memset(buf->buf + buf->len, 0, len);
+	*off = buf->len;
+	buf->len += len;
+
+	return true;
+}
+
+static bool
+parsecache_buf_add_string(parsecache_buf_t *buf, const char *str, uint32_t *off)
+{
+	size_t len = strlen(str) + 1;
+	size_t stroff;
+
+	if (!parsecache_buf_reserve(buf, len, &stroff))
+		return false;
+
+	memcpy(buf->buf + stroff, str, len);
+	*off = (uint32_t) stroff;
+
+	return true;
+}
+
+static bool
+parsecache_write_entry(parsecache_buf_t *buf, size_t entry_off, size_t *record_off, const parsecache_entry_t *stamp, const char *path)
+{
+	parsecache_entry_t *entry;
+	uint32_t path_off;
+
+	if (!parsecache_buf_add_string(buf, path, &path_off))
+		return false;
+
+	entry = (parsecache_entry_t *) (buf->buf + entry_off);
+	*entry = *stamp;
+	entry->path = path_off;
+	entry->records = (uint32_t) *record_off;
+	entry->nrecords = 0;
+
+	return true;
+}
+
+static bool
+parsecache_write_record(parsecache_buf_t *buf, size_t entry_off, size_t *record_off, char op, size_t lineno, const char *key, const char *value)
+{
+	parsecache_record_t *rec;
+	uint32_t key_off = 0, value_off;
+
+	if (key != NULL && !parsecache_buf_add_string(buf, key, &key_off))
+		return false;
+
+	if (!parsecache_buf_add_string(buf, value, &value_off))
+		return false;
+
+	rec = (parsecache_record_t *) (buf->buf + *record_off);
+	rec->op = (unsigned char) op;
+	rec->lineno = (uint32_t) lineno;
+	rec->key = key_off;
+	rec->value = value_off;
+
+	((parsecache_entry_t *) (buf->buf + entry_off))->nrecords++;
+	*record_off += sizeof(parsecache_record_t);
+
+	return true;
+}
+
+/*
+ * entries for files which no longer exist, or which changed since they were cached, can
+ * never be hit again, so they are not carried over into the new cache file.
+ */
+static bool
+parsecache_disk_entry_live(pkgconf_parsecache_t *cache, const parsecache_entry_t *disk_entry)
+{
+	const char *path = cache->base + disk_entry->path;
+	parsecache_entry_t stamp;
+	struct stat st;
+
+	if (pkgconf_hash_lookup(&cache->mem_entries, path, strlen(path)) != NULL)
+		return false;
+
+	if (stat(path, &st) != 0 || !parsecache_stamp_stat(&st, &stamp))
+		return false;
+
+	return parsecache_stamp_equal(disk_entry, &stamp);
+}
+
+static bool
+parsecache_write(pkgconf_client_t *client, pkgconf_parsecache_t *cache)
+{
+	parsecache_buf_t buf = { NULL, 0, 0, cache->allocator };
+	parsecache_header_t *hdr;
+	const parsecache_entry_t *disk_entry;
+	const parsecache_mem_entry_t *mem_entry;
+	size_t count = 0, nrecords = 0, pruned = 0, cursor, hdr_off, entry_off, record_off, nul_off, i, n;
+	char tmppath[PKGCONF_ITEM_SIZE];
+	bool *live = NULL;
+	FILE *f;
+	bool ret;
+
+	/* decide which entries of the old cache file to keep, in the order the table is walked below */
+	if (cache->disk_entries.count > 0)
+	{
+		live = pkgconf_alloc(cache->allocator, PKGCONF_ALLOC_PARSER, cache->disk_entries.count * sizeof(bool));
+		if (live == NULL)
+			return false;
+	}
+
+	/* size the entry and record tables first, so that strings can be appended behind them */
+	cursor = 0;
+	for (n = 0; (disk_entry = pkgconf_hash_next(&cache->disk_entries, &cursor)) != NULL; n++)
+	{
+		live[n] = parsecache_disk_entry_live(cache, disk_entry);
+		if (!live[n])
+		{
+			pruned++;
+			continue;
+		}
+
+		count++;
+		nrecords += disk_entry->nrecords;
+	}
+
+	cursor = 0;
+	while ((mem_entry = pkgconf_hash_next(&cache->mem_entries, &cursor)) != NULL)
+	{
+		count++;
+		nrecords += mem_entry->nrecords;
+	}
+
+	if (!parsecache_buf_reserve(&buf, sizeof(parsecache_header_t), &hdr_off) ||
+	    !parsecache_buf_reserve(&buf, count * sizeof(parsecache_entry_t), &entry_off) ||
+	    !parsecache_buf_reserve(&buf, nrecords * sizeof(parsecache_record_t), &record_off))
+		goto fail;
+
+	cursor = 0;
+	for (n = 0; (disk_entry = pkgconf_hash_next(&cache->disk_entries, &cursor)) != NULL; n++)
+	{
+		const parsecache_record_t *records = (const parsecache_record_t *) (cache->base + disk_entry->records);
+
+		if (!live[n])
+			continue;
+
+		if (!parsecache_write_entry(&buf, entry_off, &record_off, disk_entry, cache->base + disk_entry->path))
+			goto fail;
+
+		for (i = 0; i < disk_entry->nrecords; i++)
+		{
+			const parsecache_record_t *rec = &records[i];
+
+			if (!parsecache_write_record(&buf, entry_off, &record_off, (char) rec->op, rec->lineno,
+				rec->op ? cache->base + rec->key : NULL, cache->base + rec->value))
+				goto fail;
+		}
+
+		entry_off += sizeof(parsecache_entry_t);
+	}
+
+	cursor = 0;
+	while ((mem_entry = pkgconf_hash_next(&cache->mem_entries, &cursor)) != NULL)
+	{
+		if (!parsecache_write_entry(&buf, entry_off, &record_off, &mem_entry->stamp, mem_entry->path))
+			goto fail;
+
+		for (i = 0; i < mem_entry->nrecords; i++)
+		{
+			const parsecache_mem_record_t *rec = &mem_entry->records[i];
+
+			if (!parsecache_write_record(&buf, entry_off, &record_off, rec->op, rec->lineno, rec->key, rec->value))
+				goto fail;
+		}
+
+		entry_off += sizeof(parsecache_entry_t);
+	}
+
+	/* terminating NUL, see parsecache_map() */
+	if (!parsecache_buf_reserve(&buf, 1, &nul_off))
+		goto fail;
+
+	pkgconf_alloc_free(cache->allocator, PKGCONF_ALLOC_PARSER, live);
+	live = NULL;
+
+	hdr = (parsecache_header_t *) (buf.buf + hdr_off);
+	memcpy(hdr->magic, PARSECACHE_MAGIC, sizeof hdr->magic);
+	hdr->version = PARSECACHE_VERSION;
+	hdr->byteorder = PARSECACHE_BYTEORDER;
+	hdr->count = (uint32_t) count;
+	hdr->entries = sizeof(parsecache_header_t);
+	hdr->size = buf.len;
+
+	if (buf.len > UINT32_MAX)
+	{
+		PKGCONF_TRACE(client, "parse cache would be too large (%zu bytes), not writing it", buf.len);
+		pkgconf_alloc_free(cache->allocator, PKGCONF_ALLOC_PARSER, buf.buf);
+		return false;
+	}
+
+	snprintf(tmppath, sizeof tmppath, "%s.%ld.tmp", cache->path, (long) getpid());
+
+	f = fopen(tmppath, "wb");
+	if (f == NULL)
+	{
+		pkgconf_alloc_free(cache->allocator, PKGCONF_ALLOC_PARSER, buf.buf);
+		return false;
+	}
+
+	ret = fwrite(buf.buf, 1, buf.len, f) == buf.len;
+	ret = (fclose(f) == 0) && ret;
+	pkgconf_alloc_free(cache->allocator, PKGCONF_ALLOC_PARSER, buf.buf);
+
+	/* the old mapping must be released before the file is replaced on some platforms */
+	parsecache_unmap(cache);
+
+#ifdef _WIN32
+	if (ret)
+		remove(cache->path);
+#endif
+	if (!ret || rename(tmppath, cache->path) != 0)
+	{
+		remove(tmppath);
+		return false;
+	}
+
+	PKGCONF_TRACE(client, "wrote parse cache %s: %zu entries, %zu stale entries pruned", cache->path, count, pruned);
+
+	return true;
+
+fail:
+	PKGCONF_TRACE(client, "ran out of memory while writing parse cache %s, not writing it", cache->path);
+	pkgconf_alloc_free(cache->allocator, PKGCONF_ALLOC_PARSER, live);
+	pkgconf_alloc_free(cache->allocator, PKGCONF_ALLOC_PARSER, buf.buf);
+	return false;
+}
+
+static void
+parsecache_mem_entry_free(const pkgconf_allocator_t *allocator, parsecache_mem_entry_t *entry)
+{
+	size_t i;
+
+	for (i = 0; i < entry->nrecords; i++)
+	{
+		pkgconf_alloc_free(allocator, PKGCONF_ALLOC_PARSER, entry->records[i].key);
+		pkgconf_alloc_free(allocator, PKGCONF_ALLOC_PARSER, entry->records[i].value);
+	}
+
+	pkgconf_alloc_free(allocator, PKGCONF_ALLOC_PARSER, entry->records);
+	pkgconf_alloc_free(allocator, PKGCONF_ALLOC_PARSER, entry->path);
+	pkgconf_alloc_free(allocator, PKGCONF_ALLOC_PARSER, entry);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_parsecache_close(pkgconf_client_t *client)
+ *
+ *    Writes out any new entries to the client object's persistent parse cache and releases it.
+ *    This is called automatically by ``pkgconf_client_deinit()``.
+ *
+ *    :param pkgconf_client_t* client: The client object to modify.
+ *    :return: nothing
+ */
+void
+pkgconf_parsecache_close(pkgconf_client_t *client)
+{
+	pkgconf_parsecache_t *cache = client->parse_cache;
+	parsecache_mem_entry_t *entry;
+	size_t cursor = 0;
+
+	if (cache == NULL)
+		return;
+
+	PKGCONF_TRACE(client, "parse cache %s: %zu hits, %zu misses", cache->path, cache->hits, cache->misses);
+
+	if (cache->mem_entries.count > 0)
+		parsecache_write(client, cache);
+
+	while ((entry = pkgconf_hash_next(&cache->mem_entries, &cursor)) != NULL)
+		parsecache_mem_entry_free(cache->allocator, entry);
+
+	pkgconf_hash_free(&cache->mem_entries);
+	pkgconf_hash_free(&cache->disk_entries);
+	parsecache_unmap(cache);
+
+	pkgconf_alloc_free(cache->allocator, PKGCONF_ALLOC_PARSER, cache->path);
+	pkgconf_alloc_free(cache->allocator, PKGCONF_ALLOC_PARSER, cache);
+
+	client->parse_cache = NULL;
+}
+
+static void
+parsecache_record(parsecache_recorder_t *recorder, char op, size_t lineno, const char *key, const char *value)
+{
+	parsecache_mem_entry_t *entry = recorder->entry;
+	parsecache_mem_record_t *rec;
+
+	entry->records = pkgconf_alloc_realloc(recorder->allocator, PKGCONF_ALLOC_PARSER, entry->records, (entry->nrecords + 1) * sizeof(parsecache_mem_record_t));
+	rec = &entry->records[entry->nrecords++];
+
+	rec->op = op;
+	rec->lineno = lineno;
+	rec->key = key != NULL ? pkgconf_alloc_strdup(recorder->allocator, PKGCONF_ALLOC_PARSER, key) : NULL;
+	rec->value = pkgconf_alloc_strdup(recorder->allocator, PKGCONF_ALLOC_PARSER, value);
+}
+
+static void
+parsecache_record_keyword(void *data, const size_t lineno, const char *key, const char *value)
+{
+	parsecache_recorder_t *rec = data;
+
+	parsecache_record(rec, ':', lineno, key, value);
+	rec->ops[':'](rec->data, lineno, key, value);
+}
+
+static void
+parsecache_record_value(void *data, const size_t lineno, const char *key, const char *value)
+{
+	parsecache_recorder_t *rec = data;
+
+	parsecache_record(rec, '=', lineno, key, value);
+	rec->ops['='](rec->data, lineno, key, value);
+}
+
+static void parsecache_record_warning(void *data, const char *fmt, ...) PRINTFLIKE(2, 3);
+
+static void
+parsecache_record_warning(void *data, const char *fmt, ...)
+{
+	parsecache_recorder_t *rec = data;
+	char buf[PKGCONF_ITEM_SIZE];
+	va_list va;
+
+	va_start(va, fmt);
+	vsnprintf(buf, sizeof buf, fmt, va);
+	va_end(va);
+
+	parsecache_record(rec, '\0', 0, NULL, buf);
+	rec->warnfunc(rec->data, "%s", buf);
+}
+
+/* only the keyword and variable operators of the .pc format can be recorded */
+static bool
+parsecache_ops_supported(const pkgconf_parser_operand_func_t *ops)
+{
+	size_t i;
+
+	for (i = 0; i < 256; i++)
+	{
+		if (ops[i] != NULL && i != ':' && i != '=')
+			return false;
+	}
+
+	return true;
+}
+
+static void
+parsecache_replay(const pkgconf_parsecache_t *cache, const parsecache_entry_t *entry, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc)
+{
+	const parsecache_record_t *records = (const parsecache_record_t *) (cache->base + entry->records);
+	size_t i;
+
+	for (i = 0; i < entry->nrecords; i++)
+	{
+		const parsecache_record_t *rec = &records[i];
+
+		if (rec->op == 0)
+			warnfunc(data, "%s", cache->base + rec->value);
+		else if (rec->op < 256 && ops[rec->op] != NULL)
+			ops[rec->op](data, rec->lineno, cache->base + rec->key, cache->base + rec->value);
+	}
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_parsecache_parse(pkgconf_client_t *client, FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
+ *
+ *    Behaves like ``pkgconf_parser_parse()``, but consults the client object's persistent parse
+ *    cache first.  If the cache holds an up to date entry for `filename`, its operands are replayed
+ *    instead of parsing `f`; otherwise the file is parsed and the operands are recorded.
+ *    If no parse cache is open, the file is simply parsed.
+ *
+ *    :param pkgconf_client_t* client: The client object which owns the parse cache.
+ *    :param FILE* f: The file to parse.  It is closed before this function returns.
+ *    :param void* data: An opaque pointer passed to the operand and warning functions.
+ *    :param pkgconf_parser_operand_func_t* ops: The operand function table.
+ *    :param pkgconf_parser_warn_func_t warnfunc: The warning function.
+ *    :param char* filename: The path of the file being parsed, used as the cache key.
+ *    :return: nothing
+ */
+void
+pkgconf_parsecache_parse(pkgconf_client_t *client, FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
+{
+	pkgconf_parsecache_t *cache = client->parse_cache;
+	const parsecache_entry_t *disk_entry;
+	parsecache_mem_entry_t *mem_entry;
+	pkgconf_parser_operand_func_t recorder_ops[256] = { NULL };
+	parsecache_recorder_t recorder;
+	parsecache_entry_t stamp;
+	size_t len = strlen(filename);
+
+	if (cache == NULL || !parsecache_ops_supported(ops) || !parsecache_stamp(f, &stamp))
+	{
+		pkgconf_parser_parse_alloc(&client->allocator, f, data, ops, warnfunc, filename);
+		return;
+	}
+
+	disk_entry = pkgconf_hash_lookup(&cache->disk_entries, filename, len);
+	if (disk_entry != NULL && parsecache_stamp_equal(disk_entry, &stamp) &&
+	    pkgconf_hash_lookup(&cache->mem_entries, filename, len) == NULL)
+	{
+		PKGCONF_TRACE(client, "parse cache hit: %s", filename);
+		cache->hits++;
+		PKGCONF_STATS_COUNT(client, parse_cache_hits, 1);
+
+		fclose(f);
+		parsecache_replay(cache, disk_entry, data, ops, warnfunc);
+		return;
+	}
+
+	PKGCONF_TRACE(client, "parse cache miss: %s", filename);
+	cache->misses++;
+	PKGCONF_STATS_COUNT(client, parse_cache_misses, 1);
+
+	mem_entry = pkgconf_alloc(cache->allocator, PKGCONF_ALLOC_PARSER, sizeof(parsecache_mem_entry_t));
+	mem_entry->path = pkgconf_alloc_strdup(cache->allocator, PKGCONF_ALLOC_PARSER, filename);
+	mem_entry->stamp = stamp;
+
+	recorder.data = data;
+	recorder.ops = ops;
+	recorder.warnfunc = warnfunc;
+	recorder.entry = mem_entry;
+	recorder.allocator = cache->allocator;
+
+	if (ops[':'] != NULL)
+		recorder_ops[':'] = parsecache_record_keyword;
+	if (ops['='] != NULL)
+		recorder_ops['='] = parsecache_record_value;
+
+	pkgconf_parser_parse_alloc(cache->allocator, f, &recorder, recorder_ops, parsecache_record_warning, filename);
+
+	/* a file parsed twice in one session replaces its earlier entry */
+	mem_entry = pkgconf_hash_insert(&cache->mem_entries, mem_entry->path, len, mem_entry);
+	if (mem_entry != NULL)
+		parsecache_mem_entry_free(cache->allocator, mem_entry);
+}
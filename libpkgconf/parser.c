@@ -16,6 +16,162 @@
 #include <libpkgconf/config.h>
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
+
+#include <sys/stat.h>
+
+/*
+ * Read the remainder of a file into a single NUL-terminated buffer.  Regular files are
+ * sized up front so that the common case is a single read.
+ */
+static char *
+parser_read_file(const pkgconf_allocator_t *allocator, FILE *f, size_t *len)
+{
+	struct stat st;
+	size_t size = PKGCONF_BUFSIZE, total = 0, n;
+	char *buf;
+
+	if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+		size = (size_t) st.st_size + 1;
+
+	buf = pkgconf_alloc_realloc(allocator, PKGCONF_ALLOC_PARSER, NULL, size);
+	if (buf == NULL)
+		return NULL;
+
+	for (;;)
+	{
+		n = fread(buf + total, 1, size - total - 1, f);
+		total += n;
+
+		if (total < size - 1)
+			break;
+
+		char *nbuf = pkgconf_alloc_realloc(allocator, PKGCONF_ALLOC_PARSER, buf, size * 2);
+		if (nbuf == NULL)
+		{
+			pkgconf_alloc_free(allocator, PKGCONF_ALLOC_PARSER, buf);
+			return NULL;
+		}
+
+		buf = nbuf;
+		size *= 2;
+	}
+
+	if (ferror(f))
+	{
+		pkgconf_alloc_free(allocator, PKGCONF_ALLOC_PARSER, buf);
+		return NULL;
+	}
+
+	buf[total] = '\0';
+	*len = total;
+
+	return buf;
+}
+
+/*
+ * Split the next logical line out of the buffer, in place, and return it NUL-terminated.
+ * The rules are the same as pkgconf_fgetline(): a backslash escapes '#' and joins lines,
+ * an unescaped '#' starts a comment and CR, LF and CRLF all end a line.  Lines without
+ * any of the special characters are handed back as-is.
+ */
+static char *
+parser_next_line(char **cursor, char *end)
+{
+	char *start = *cursor, *lim, *nl, *r, *w;
+	bool quoted = false;
+
+	if (start >= end)
+		return NULL;
+
+	nl = memchr(start, '\n', end - start);
+	lim = nl != NULL ? nl : end;
+
+	if (memchr(start, '\\', lim - start) == NULL &&
+	    memchr(start, '#', lim - start) == NULL &&
+	    memchr(start, '\r', lim - start) == NULL)
+	{
+		*lim = '\0';
+		*cursor = nl != NULL ? nl + 1 : end;
+		return start;
+	}
+
+	/* the line only ever shrinks while it is unescaped, so it can be rewritten in place */
+	r = w = start;
+	while (r < end)
+	{
+		char c = *r++;
+
+		if (c == '\\' && !quoted)
+		{
+			quoted = true;
+			continue;
+		}
+		else if (c == '#')
+		{
+			if (!quoted)
+			{
+				nl = memchr(r, '\n', end - r);
+				r = nl != NULL ? nl + 1 : end;
+				goto done;
+			}
+
+			*w++ = c;
+			quoted = false;
+			continue;
+		}
+		else if (c == '\n')
+		{
+			if (quoted)
+			{
+				/* Trim spaces */
+				while (r < end && (*r == '\t' || *r == ' '))
+					r++;
+
+				quoted = false;
+				continue;
+			}
+
+			goto done;
+		}
+		else if (c == '\r')
+		{
+			if (r < end && *r == '\n')
+				r++;
+
+			if (quoted)
+			{
+				*w++ = '\n';
+				quoted = false;
+				continue;
+			}
+
+			goto done;
+		}
+
+		if (quoted)
+		{
+			*w++ = '\\';
+			quoted = false;
+		}
+		*w++ = c;
+	}
+
+	/* at end of file, nothing but escapes is no line at all, and a dangling escaped
+	 * line break is dropped like a terminator */
+	*cursor = r;
+	if (w == start)
+		return NULL;
+
+	if (w[-1] == '\n')
+		w--;
+
+done:
+	*w = '\0';
+	*cursor = r;
+
+	return start;
+}
 
 /*
  * !doc
@@ -33,10 +189,29 @@
 void
 pkgconf_parser_parse(FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
 {
-	char readbuf[PKGCONF_BUFSIZE];
-	size_t lineno = 0;
+	pkgconf_parser_parse_alloc(NULL, f, data, ops, warnfunc, filename);
+}
+
+/*
+ * Like pkgconf_parser_parse(), but the read buffer comes from an allocator, for the files
+ * parsed on behalf of a client.  Prefetch workers keep using the C library.
+ */
+void
+pkgconf_parser_parse_alloc(const pkgconf_allocator_t *allocator, FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
+{
+	char *buf, *cursor, *end, *readbuf;
+	size_t len, lineno = 0;
 
-	while (pkgconf_fgetline(readbuf, PKGCONF_BUFSIZE, f) != NULL)
+	buf = parser_read_file(allocator, f, &len);
+	fclose(f);
+
+	if (buf == NULL)
+		return;
+
+	cursor = buf;
+	end = buf + len;
+
+	while ((readbuf = parser_next_line(&cursor, end)) != NULL)
 	{
 		char op, *p, *key, *value;
 		bool warned_key_whitespace = false, warned_value_whitespace = false;
@@ -94,5 +269,5 @@ pkgconf_parser_parse(FILE *f, void *data, const pkgconf_parser_operand_func_t *o
 			ops[(unsigned char) op](data, lineno, key, value);
 	}
 
-	fclose(f);
+	pkgconf_alloc_free(allocator, PKGCONF_ALLOC_PARSER, buf);
 }
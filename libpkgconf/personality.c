@@ -118,7 +118,8 @@ pkgconf_cross_personality_default(void)
  *
  * .. c:function:: void pkgconf_cross_personality_deinit(pkgconf_cross_personality_t *)
  *
- *    Decrements the count of default cross personality instances.
+ *    Decrements the count of default cross personality instances.  Personalities which were
+ *    loaded from a file are released instead.
  *
  *    Not thread safe.
  *
@@ -127,6 +128,16 @@ pkgconf_cross_personality_default(void)
 void
 pkgconf_cross_personality_deinit(pkgconf_cross_personality_t *personality)
 {
+    if (personality != &default_personality) {
+        pkgconf_path_free(&personality->dir_list);
+        pkgconf_path_free(&personality->filter_libdirs);
+        pkgconf_path_free(&personality->filter_includedirs);
+        free((char *) personality->name);
+        free(personality->sysroot_dir);
+        free(personality);
+        return;
+    }
+
     if (--default_personality_init == 0) {
         pkgconf_path_free(&personality->dir_list);
         pkgconf_path_free(&personality->filter_libdirs);
@@ -16,6 +16,8 @@
 #include <libpkgconf/config.h>
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
+#include <sys/stat.h>
 
 /*
  * !doc
@@ -37,14 +39,6 @@
 
 #define PKG_CONFIG_EXT ".pc"
 
-static unsigned int
-pkgconf_pkg_traverse_main(pkgconf_client_t *client,
-	pkgconf_pkg_t *root,
-	pkgconf_pkg_traverse_func_t func,
-	void *data,
-	int maxdepth,
-	unsigned int skip_flags);
-
 static inline bool
 str_has_suffix(const char *str, const char *suffix)
 {
@@ -69,7 +63,7 @@ pkg_get_parent_dir(pkgconf_pkg_t *pkg)
 	if (pathbuf != NULL)
 		pathbuf[0] = '\0';
 
-	return strdup(buf);
+	return pkgconf_alloc_strdup(&pkg->owner->allocator, PKGCONF_ALLOC_PACKAGE, buf);
 }
 
 typedef void (*pkgconf_pkg_parser_keyword_func_t)(pkgconf_client_t *client, pkgconf_pkg_t *pkg, const char *keyword, const size_t lineno, const ptrdiff_t offset, const char *value);
@@ -77,8 +71,21 @@ typedef struct {
 	const char *keyword;
 	const pkgconf_pkg_parser_keyword_func_t func;
 	const ptrdiff_t offset;
+	/* the PKGCONF_PKG_FIELDF_* group the field belongs to, 0 if it is always parsed */
+	const unsigned int fields;
 } pkgconf_pkg_parser_keyword_pair_t;
 
+/* a field left unparsed by PKGCONF_PKG_PKGF_LAZY_PARSE, as it was read from the .pc file */
+struct pkgconf_pkg_deferred_ {
+	pkgconf_pkg_deferred_t *next;
+
+	const pkgconf_pkg_parser_keyword_pair_t *pair;
+	size_t lineno;
+
+	char *keyword;
+	char *value;
+};
+
 static int pkgconf_pkg_parser_keyword_pair_cmp(const void *key, const void *ptr)
 {
 	const pkgconf_pkg_parser_keyword_pair_t *pair = ptr;
@@ -92,7 +99,7 @@ pkgconf_pkg_parser_tuple_func(pkgconf_client_t *client, pkgconf_pkg_t *pkg, cons
 	(void) lineno;
 
 	char **dest = (char **)((char *) pkg + offset);
-	*dest = pkgconf_tuple_parse(client, &pkg->vars, value, pkg->flags);
+	*dest = pkgconf_tuple_parse_alloc(client, &pkg->vars, value, pkg->flags);
 }
 
 static void
@@ -105,7 +112,7 @@ pkgconf_pkg_parser_version_func(pkgconf_client_t *client, pkgconf_pkg_t *pkg, co
 	char **dest = (char **)((char *) pkg + offset);
 
 	/* cut at any detected whitespace */
-	p = pkgconf_tuple_parse(client, &pkg->vars, value, pkg->flags);
+	p = pkgconf_tuple_parse_alloc(client, &pkg->vars, value, pkg->flags);
 
 	len = strcspn(p, " \t");
 	if (len != strlen(p))
@@ -156,20 +163,48 @@ pkgconf_pkg_parser_internal_dependency_func(pkgconf_client_t *client, pkgconf_pk
 
 /* keep this in alphabetical order */
 static const pkgconf_pkg_parser_keyword_pair_t pkgconf_pkg_parser_keyword_funcs[] = {
-	{"CFLAGS", pkgconf_pkg_parser_fragment_func, offsetof(pkgconf_pkg_t, cflags)},
-	{"CFLAGS.private", pkgconf_pkg_parser_fragment_func, offsetof(pkgconf_pkg_t, cflags_private)},
-	{"Conflicts", pkgconf_pkg_parser_dependency_func, offsetof(pkgconf_pkg_t, conflicts)},
-	{"Description", pkgconf_pkg_parser_tuple_func, offsetof(pkgconf_pkg_t, description)},
-	{"LIBS", pkgconf_pkg_parser_fragment_func, offsetof(pkgconf_pkg_t, libs)},
-	{"LIBS.private", pkgconf_pkg_parser_fragment_func, offsetof(pkgconf_pkg_t, libs_private)},
-	{"Name", pkgconf_pkg_parser_tuple_func, offsetof(pkgconf_pkg_t, realname)},
-	{"Provides", pkgconf_pkg_parser_dependency_func, offsetof(pkgconf_pkg_t, provides)},
-	{"Requires", pkgconf_pkg_parser_dependency_func, offsetof(pkgconf_pkg_t, required)},
-	{"Requires.internal", pkgconf_pkg_parser_internal_dependency_func, offsetof(pkgconf_pkg_t, requires_private)},
-	{"Requires.private", pkgconf_pkg_parser_dependency_func, offsetof(pkgconf_pkg_t, requires_private)},
-	{"Version", pkgconf_pkg_parser_version_func, offsetof(pkgconf_pkg_t, version)},
+	{"CFLAGS", pkgconf_pkg_parser_fragment_func, offsetof(pkgconf_pkg_t, cflags), PKGCONF_PKG_FIELDF_FRAGMENTS},
+	{"CFLAGS.private", pkgconf_pkg_parser_fragment_func, offsetof(pkgconf_pkg_t, cflags_private), PKGCONF_PKG_FIELDF_FRAGMENTS},
+	{"Conflicts", pkgconf_pkg_parser_dependency_func, offsetof(pkgconf_pkg_t, conflicts), PKGCONF_PKG_FIELDF_DEPENDENCIES},
+	{"Description", pkgconf_pkg_parser_tuple_func, offsetof(pkgconf_pkg_t, description), 0},
+	{"LIBS", pkgconf_pkg_parser_fragment_func, offsetof(pkgconf_pkg_t, libs), PKGCONF_PKG_FIELDF_FRAGMENTS},
+	{"LIBS.private", pkgconf_pkg_parser_fragment_func, offsetof(pkgconf_pkg_t, libs_private), PKGCONF_PKG_FIELDF_FRAGMENTS},
+	{"Name", pkgconf_pkg_parser_tuple_func, offsetof(pkgconf_pkg_t, realname), 0},
+	{"Provides", pkgconf_pkg_parser_dependency_func, offsetof(pkgconf_pkg_t, provides), 0},
+	{"Requires", pkgconf_pkg_parser_dependency_func, offsetof(pkgconf_pkg_t, required), PKGCONF_PKG_FIELDF_DEPENDENCIES},
+	{"Requires.internal", pkgconf_pkg_parser_internal_dependency_func, offsetof(pkgconf_pkg_t, requires_private), PKGCONF_PKG_FIELDF_DEPENDENCIES},
+	{"Requires.private", pkgconf_pkg_parser_dependency_func, offsetof(pkgconf_pkg_t, requires_private), PKGCONF_PKG_FIELDF_DEPENDENCIES},
+	{"Version", pkgconf_pkg_parser_version_func, offsetof(pkgconf_pkg_t, version), 0},
 };
 
+/* keeps a field for pkgconf_pkg_materialize(), allocated along with the rest of the package */
+static bool
+pkgconf_pkg_parser_defer(pkgconf_client_t *client, pkgconf_pkg_t *pkg, const pkgconf_pkg_parser_keyword_pair_t *pair, const size_t lineno, const char *keyword, const char *value)
+{
+	pkgconf_pkg_deferred_t *field, **tail;
+	size_t keylen = strlen(keyword), valuelen = strlen(value);
+
+	field = pkgconf_client_alloc(client, PKGCONF_ALLOC_PARSER, sizeof(pkgconf_pkg_deferred_t) + keylen + valuelen + 2);
+	if (field == NULL)
+		return false;
+
+	field->pair = pair;
+	field->lineno = lineno;
+	field->keyword = (char *) (field + 1);
+	field->value = field->keyword + keylen + 1;
+
+	memcpy(field->keyword, keyword, keylen + 1);
+	memcpy(field->value, value, valuelen + 1);
+
+	/* fields are parsed in the order they appear in, as fields for the same list append to it */
+	for (tail = &pkg->deferred; *tail != NULL; tail = &(*tail)->next)
+		;
+
+	*tail = field;
+
+	return true;
+}
+
 static void
 pkgconf_pkg_parser_keyword_set(void *opaque, const size_t lineno, const char *keyword, const char *value)
 {
@@ -182,6 +217,10 @@ pkgconf_pkg_parser_keyword_set(void *opaque, const size_t lineno, const char *ke
 	if (pair == NULL || pair->func == NULL)
 		return;
 
+	if (pair->fields != 0 && (pkg->owner->flags & PKGCONF_PKG_PKGF_LAZY_PARSE) &&
+	    pkgconf_pkg_parser_defer(pkg->owner, pkg, pair, lineno, keyword, value))
+		return;
+
 	pair->func(pkg->owner, pkg, keyword, lineno, pair->offset, value);
 }
 
@@ -233,9 +272,9 @@ determine_prefix(const pkgconf_pkg_t *pkg, char *buf, size_t buflen)
  * "/foo bar/baz" -> "/foo\ bar/baz"
  */
 static char *
-convert_path_to_value(const char *path)
+convert_path_to_value(const pkgconf_client_t *client, const char *path)
 {
-	char *buf = calloc((strlen(path) + 1) * 2, 1);
+	char *buf = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_PARSER, (strlen(path) + 1) * 2);
 	char *bptr = buf;
 	const char *i;
 
@@ -298,6 +337,10 @@ pkgconf_pkg_parser_value_set(void *opaque, const size_t lineno, const char *keyw
 
 	(void) lineno;
 
+	/* fields are expanded with the variables defined before them, so a later variable ends deferral */
+	if (pkg->deferred != NULL)
+		pkgconf_pkg_materialize(pkg->owner, pkg, PKGCONF_PKG_FIELDF_ALL);
+
 	pkgconf_strlcpy(canonicalized_value, value, sizeof canonicalized_value);
 	canonicalize_path(canonicalized_value);
 
@@ -323,10 +366,10 @@ pkgconf_pkg_parser_value_set(void *opaque, const size_t lineno, const char *keyw
 
 		if (relvalue != NULL)
 		{
-			char *prefix_value = convert_path_to_value(relvalue);
+			char *prefix_value = convert_path_to_value(pkg->owner, relvalue);
 			pkg->orig_prefix = pkgconf_tuple_add(pkg->owner, &pkg->vars, "orig_prefix", canonicalized_value, true, pkg->flags);
 			pkg->prefix = pkgconf_tuple_add(pkg->owner, &pkg->vars, keyword, prefix_value, false, pkg->flags);
-			free(prefix_value);
+			pkgconf_alloc_free(&pkg->owner->allocator, PKGCONF_ALLOC_PARSER, prefix_value);
 		}
 		else
 			pkgconf_tuple_add(pkg->owner, &pkg->vars, keyword, value, true, pkg->flags);
@@ -384,35 +427,25 @@ pkgconf_pkg_validate(const pkgconf_client_t *client, const pkgconf_pkg_t *pkg)
 	return valid;
 }
 
-/*
- * !doc
- *
- * .. c:function:: pkgconf_pkg_t *pkgconf_pkg_new_from_file(const pkgconf_client_t *client, const char *filename, FILE *f, unsigned int flags)
- *
- *    Parse a .pc file into a pkgconf_pkg_t object structure.
- *
- *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
- *    :param char* filename: The filename of the package file (including full path).
- *    :param FILE* f: The file object to read from.
- *    :param uint flags: The flags to use when parsing.
- *    :returns: A ``pkgconf_pkg_t`` object which contains the package data.
- *    :rtype: pkgconf_pkg_t *
- */
-pkgconf_pkg_t *
-pkgconf_pkg_new_from_file(pkgconf_client_t *client, const char *filename, FILE *f, unsigned int flags)
+/* sets up a package for the operands of its .pc file to be parsed into */
+static pkgconf_pkg_t *
+pkg_parse_begin(pkgconf_client_t *client, const char *filename, unsigned int flags)
 {
 	pkgconf_pkg_t *pkg;
 	char *idptr;
 
-	pkg = calloc(sizeof(pkgconf_pkg_t), 1);
+	pkg = pkgconf_client_alloc(client, PKGCONF_ALLOC_PACKAGE, sizeof(pkgconf_pkg_t));
 	pkg->owner = client;
-	pkg->filename = strdup(filename);
+	pkg->filename = pkgconf_alloc_strdup(&client->allocator, PKGCONF_ALLOC_PACKAGE, filename);
 	pkg->pc_filedir = pkg_get_parent_dir(pkg);
 	pkg->flags = flags;
 
-	char *pc_filedir_value = convert_path_to_value(pkg->pc_filedir);
+	if (client->arena != NULL)
+		pkg->flags |= PKGCONF_PKG_PROPF_ARENA;
+
+	char *pc_filedir_value = convert_path_to_value(client, pkg->pc_filedir);
 	pkgconf_tuple_add(client, &pkg->vars, "pcfiledir", pc_filedir_value, true, pkg->flags);
-	free(pc_filedir_value);
+	pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_PARSER, pc_filedir_value);
 
 	/* If pc_filedir is outside of sysroot_dir, override sysroot_dir for this
 	 * package.
@@ -437,13 +470,17 @@ pkgconf_pkg_new_from_file(pkgconf_client_t *client, const char *filename, FILE *
 		idptr = ++mungeptr;
 #endif
 
-	pkg->id = strdup(idptr);
+	pkg->id = pkgconf_alloc_strdup(&client->allocator, PKGCONF_ALLOC_PACKAGE, idptr);
 	idptr = strrchr(pkg->id, '.');
 	if (idptr)
 		*idptr = '\0';
 
-	pkgconf_parser_parse(f, pkg, pkg_parser_funcs, (pkgconf_parser_warn_func_t) pkg_warn_func, pkg->filename);
+	return pkg;
+}
 
+static pkgconf_pkg_t *
+pkg_parse_finish(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
+{
 	if (!pkgconf_pkg_validate(client, pkg))
 	{
 		pkgconf_warn(client, "%s: warning: skipping invalid file\n", pkg->filename);
@@ -451,11 +488,175 @@ pkgconf_pkg_new_from_file(pkgconf_client_t *client, const char *filename, FILE *
 		return NULL;
 	}
 
+	pkg->version_key = pkgconf_intern_version(client->interns, pkg->version);
 	pkgconf_dependency_add(client, &pkg->provides, pkg->id, pkg->version, PKGCONF_CMP_EQUAL, 0);
 
 	return pkgconf_pkg_ref(client, pkg);
 }
 
+static pkgconf_pkg_t *
+pkg_parse_file(pkgconf_client_t *client, const char *filename, FILE *f, unsigned int flags)
+{
+	pkgconf_stats_phase_t phase = PKGCONF_STATS_ENTER(client, PKGCONF_STATS_PHASE_PARSE);
+	pkgconf_pkg_t *pkg;
+	struct stat st;
+
+	PKGCONF_TRACEEVENT_BEGIN(client, "pkgconf_pkg_new_from_file", "filename", filename);
+
+	pkg = pkg_parse_begin(client, filename, flags);
+
+	if (client->stats != NULL && fstat(fileno(f), &st) == 0)
+		client->stats->bytes_parsed += st.st_size;
+
+	pkgconf_parsecache_parse(client, f, pkg, pkg_parser_funcs, (pkgconf_parser_warn_func_t) pkg_warn_func, pkg->filename);
+
+	pkg = pkg_parse_finish(client, pkg);
+
+	PKGCONF_TRACEEVENT_END(client, "pkgconf_pkg_new_from_file");
+	PKGCONF_STATS_LEAVE(client, phase);
+
+	return pkg;
+}
+
+/*
+ * builds a package from the operands a prefetch worker parsed out of its .pc file.  like
+ * pkgconf_pkg_new_from_file(), the package is allocated from the client's allocator.
+ */
+static pkgconf_pkg_t *
+pkg_new_from_prefetch(pkgconf_client_t *client, pkgconf_prefetch_t *prefetch, size_t index)
+{
+	pkgconf_stats_phase_t phase = PKGCONF_STATS_ENTER(client, PKGCONF_STATS_PHASE_PARSE);
+	pkgconf_arena_t *query_arena = client->arena;
+	pkgconf_pkg_t *pkg;
+
+	/* the worker opened and read the file */
+	PKGCONF_STATS_COUNT(client, files_opened, 1);
+
+	client->arena = NULL;
+
+	PKGCONF_TRACEEVENT_BEGIN(client, "pkgconf_pkg_new_from_file", "filename", pkgconf_prefetch_path(prefetch, index));
+
+	pkg = pkg_parse_begin(client, pkgconf_prefetch_path(prefetch, index), 0);
+	pkgconf_prefetch_replay(prefetch, index, pkg, pkg_parser_funcs, (pkgconf_parser_warn_func_t) pkg_warn_func);
+	pkg = pkg_parse_finish(client, pkg);
+
+	PKGCONF_TRACEEVENT_END(client, "pkgconf_pkg_new_from_file");
+
+	client->arena = query_arena;
+
+	PKGCONF_STATS_LEAVE(client, phase);
+
+	return pkg;
+}
+
+/*
+ * loads a package with all of its objects allocated from `arena`, or from the client's
+ * allocator if it is NULL, regardless of the arena used by the query in progress.
+ */
+static pkgconf_pkg_t *
+pkg_new_from_file(pkgconf_client_t *client, const char *filename, FILE *f, unsigned int flags, pkgconf_arena_t *arena)
+{
+	pkgconf_arena_t *query_arena = client->arena;
+	pkgconf_pkg_t *pkg;
+
+	client->arena = arena;
+	pkg = pkg_parse_file(client, filename, f, flags);
+	client->arena = query_arena;
+
+	return pkg;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_pkg_t *pkgconf_pkg_new_from_file(const pkgconf_client_t *client, const char *filename, FILE *f, unsigned int flags)
+ *
+ *    Parse a .pc file into a pkgconf_pkg_t object structure.
+ *
+ *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
+ *    :param char* filename: The filename of the package file (including full path).
+ *    :param FILE* f: The file object to read from.
+ *    :param uint flags: The flags to use when parsing.
+ *    :returns: A ``pkgconf_pkg_t`` object which contains the package data.
+ *    :rtype: pkgconf_pkg_t *
+ */
+pkgconf_pkg_t *
+pkgconf_pkg_new_from_file(pkgconf_client_t *client, const char *filename, FILE *f, unsigned int flags)
+{
+	return pkg_new_from_file(client, filename, f, flags, NULL);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_pkg_materialize(pkgconf_client_t *client, pkgconf_pkg_t *pkg, unsigned int fields)
+ *
+ *    Parses the fields of a package which were left unparsed because the package was loaded while the
+ *    ``PKGCONF_PKG_PKGF_LAZY_PARSE`` client flag was set.  Such packages only have their name, version,
+ *    description, variables and ``Provides`` entries parsed up front.
+ *
+ *    ``PKGCONF_PKG_FIELDF_DEPENDENCIES`` selects the ``Requires``, ``Requires.private`` and ``Conflicts``
+ *    lists, which ``pkgconf_pkg_traverse()`` parses when it enters a package, and ``PKGCONF_PKG_FIELDF_FRAGMENTS``
+ *    selects the ``Libs`` and ``Cflags`` lists, which ``pkgconf_pkg_libs()`` and ``pkgconf_pkg_cflags()``
+ *    parse when they collect fragments.  Callers which read these lists of a package directly must
+ *    materialize them first.  Packages loaded without the flag are always fully parsed.
+ *
+ *    The fields are expanded with the client's global variables at the time they are materialized.
+ *
+ *    :param pkgconf_client_t* client: The client object which owns the package.
+ *    :param pkgconf_pkg_t* pkg: The package to materialize fields of.
+ *    :param uint fields: The ``PKGCONF_PKG_FIELDF_*`` groups of fields to parse.
+ *    :return: nothing
+ */
+void
+pkgconf_pkg_materialize(pkgconf_client_t *client, pkgconf_pkg_t *pkg, unsigned int fields)
+{
+	pkgconf_pkg_deferred_t **prev = &pkg->deferred, *field;
+	pkgconf_arena_t *query_arena = client->arena;
+
+	if (pkg->deferred == NULL)
+		return;
+
+	PKGCONF_TRACE(client, "%s: parsing deferred fields", pkg->id);
+
+	/* the fields are allocated from wherever the rest of the package was */
+	client->arena = (pkg->flags & PKGCONF_PKG_PROPF_ARENA) ? &client->cache_arena : NULL;
+
+	while ((field = *prev) != NULL)
+	{
+		if (!(field->pair->fields & fields))
+		{
+			prev = &field->next;
+			continue;
+		}
+
+		*prev = field->next;
+
+		field->pair->func(client, pkg, field->keyword, field->lineno, field->pair->offset, field->value);
+
+		if (client->arena == NULL)
+			pkgconf_client_dealloc(client, PKGCONF_ALLOC_PARSER, field);
+	}
+
+	client->arena = query_arena;
+}
+
+static void
+pkg_deferred_free(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
+{
+	pkgconf_pkg_deferred_t *field, *next;
+
+	for (field = pkg->deferred; field != NULL; field = next)
+	{
+		next = field->next;
+
+		if (!(pkg->flags & PKGCONF_PKG_PROPF_ARENA))
+			pkgconf_client_dealloc(client, PKGCONF_ALLOC_PARSER, field);
+	}
+
+	pkg->deferred = NULL;
+}
+
 /*
  * !doc
  *
@@ -477,6 +678,8 @@ pkgconf_pkg_free(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 		return;
 
 	pkgconf_cache_remove(client, pkg);
+	pkgconf_closure_free(client, pkg);
+	pkg_deferred_free(client, pkg);
 
 	pkgconf_dependency_free(&pkg->required);
 	pkgconf_dependency_free(&pkg->requires_private);
@@ -493,28 +696,19 @@ pkgconf_pkg_free(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 	if (pkg->flags & PKGCONF_PKG_PROPF_VIRTUAL)
 		return;
 
-	if (pkg->id != NULL)
-		free(pkg->id);
-
-	if (pkg->filename != NULL)
-		free(pkg->filename);
-
-	if (pkg->realname != NULL)
-		free(pkg->realname);
+	pkgconf_client_dealloc(client, PKGCONF_ALLOC_PACKAGE, pkg->id);
+	pkgconf_client_dealloc(client, PKGCONF_ALLOC_PACKAGE, pkg->filename);
 
-	if (pkg->version != NULL)
-		free(pkg->version);
+	/* the header fields are taken from pkgconf_tuple_parse_alloc() */
+	pkgconf_client_dealloc(client, PKGCONF_ALLOC_TUPLE, pkg->realname);
+	pkgconf_client_dealloc(client, PKGCONF_ALLOC_TUPLE, pkg->version);
+	pkgconf_client_dealloc(client, PKGCONF_ALLOC_TUPLE, pkg->description);
+	pkgconf_client_dealloc(client, PKGCONF_ALLOC_TUPLE, pkg->url);
 
-	if (pkg->description != NULL)
-		free(pkg->description);
+	pkgconf_client_dealloc(client, PKGCONF_ALLOC_PACKAGE, pkg->pc_filedir);
 
-	if (pkg->url != NULL)
-		free(pkg->url);
-
-	if (pkg->pc_filedir != NULL)
-		free(pkg->pc_filedir);
-
-	free(pkg);
+	if (!(pkg->flags & PKGCONF_PKG_PROPF_ARENA))
+		pkgconf_client_dealloc(pkg->owner, PKGCONF_ALLOC_PACKAGE, pkg);
 }
 
 /*
@@ -565,115 +759,416 @@ pkgconf_pkg_unref(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 		pkgconf_pkg_free(pkg->owner, pkg);
 }
 
-static inline pkgconf_pkg_t *
-pkgconf_pkg_try_specific_path(pkgconf_client_t *client, const char *path, const char *name)
-{
-	pkgconf_pkg_t *pkg = NULL;
-	FILE *f;
-	char locbuf[PKGCONF_ITEM_SIZE];
-	char uninst_locbuf[PKGCONF_ITEM_SIZE];
+/*
+ * Each search directory is read once and its .pc files are recorded in a per-directory
+ * index, keyed on the module name.  A file named foo-uninstalled.pc is recorded both as
+ * an installed copy of `foo-uninstalled` and as an uninstalled copy of `foo`.
+ */
+#define PKG_DIR_ENTRY_INSTALLED		0x1
+#define PKG_DIR_ENTRY_UNINSTALLED	0x2
 
-	PKGCONF_TRACE(client, "trying path: %s for %s", path, name);
+#define PKG_UNINSTALLED_SUFFIX		"-uninstalled"
+
+typedef struct {
+	char *name;
+	unsigned int flags;
+} pkg_dir_entry_t;
+
+typedef struct {
+	char *path;
+	pkgconf_hash_t entries;
+} pkg_dir_index_t;
 
-	snprintf(locbuf, sizeof locbuf, "%s%c%s" PKG_CONFIG_EXT, path, PKG_DIR_SEP_S, name);
-	snprintf(uninst_locbuf, sizeof uninst_locbuf, "%s%c%s-uninstalled" PKG_CONFIG_EXT, path, PKG_DIR_SEP_S, name);
+/* on case-insensitive filesystems, fopen() would find foo.pc as Foo.pc */
+#if defined(_WIN32) || defined(__APPLE__)
+# define PKG_DIR_INDEX_FOLD_CASE
+#endif
+
+static void
+pkg_dir_index_fold_name(char *buf, size_t bufsize, const char *name, size_t len)
+{
+	size_t i;
+
+	if (len >= bufsize)
+		len = bufsize - 1;
 
-	if (!(client->flags & PKGCONF_PKG_PKGF_NO_UNINSTALLED) && (f = fopen(uninst_locbuf, "r")) != NULL)
+	for (i = 0; i < len; i++)
 	{
-		PKGCONF_TRACE(client, "found (uninstalled): %s", uninst_locbuf);
-		pkg = pkgconf_pkg_new_from_file(client, uninst_locbuf, f, PKGCONF_PKG_PROPF_UNINSTALLED);
+#ifdef PKG_DIR_INDEX_FOLD_CASE
+		buf[i] = tolower((unsigned char) name[i]);
+#else
+		buf[i] = name[i];
+#endif
 	}
-	else if ((f = fopen(locbuf, "r")) != NULL)
+
+	buf[len] = '\0';
+}
+
+static void
+pkg_dir_index_add(const pkgconf_client_t *client, pkg_dir_index_t *idx, const char *name, size_t len, unsigned int flags)
+{
+	char namebuf[PKGCONF_ITEM_SIZE];
+	pkg_dir_entry_t *entry;
+
+	pkg_dir_index_fold_name(namebuf, sizeof namebuf, name, len);
+
+	entry = pkgconf_hash_lookup(&idx->entries, namebuf, strlen(namebuf));
+	if (entry == NULL)
 	{
-		PKGCONF_TRACE(client, "found: %s", locbuf);
-		pkg = pkgconf_pkg_new_from_file(client, locbuf, f, 0);
+		entry = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_CACHE, sizeof(pkg_dir_entry_t));
+		entry->name = pkgconf_alloc_strdup(&client->allocator, PKGCONF_ALLOC_CACHE, namebuf);
+		pkgconf_hash_insert(&idx->entries, entry->name, strlen(entry->name), entry);
 	}
 
-	return pkg;
+	entry->flags |= flags;
 }
 
-static pkgconf_pkg_t *
-pkgconf_pkg_scan_dir(pkgconf_client_t *client, const char *path, void *data, pkgconf_pkg_iteration_func_t func)
+static pkg_dir_index_t *
+pkg_dir_index_build(pkgconf_client_t *client, const char *path)
 {
+	pkg_dir_index_t *idx;
 	DIR *dir;
 	struct dirent *dirent;
-	pkgconf_pkg_t *outpkg = NULL;
+
+	idx = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_CACHE, sizeof(pkg_dir_index_t));
+	idx->path = pkgconf_alloc_strdup(&client->allocator, PKGCONF_ALLOC_CACHE, path);
+	pkgconf_hash_init(&idx->entries, &client->allocator, PKGCONF_ALLOC_CACHE);
 
 	dir = opendir(path);
 	if (dir == NULL)
-		return NULL;
-
-	PKGCONF_TRACE(client, "scanning dir [%s]", path);
+	{
+		PKGCONF_TRACE(client, "indexed dir [%s]: not readable", path);
+		return idx;
+	}
 
 	for (dirent = readdir(dir); dirent != NULL; dirent = readdir(dir))
 	{
-		char filebuf[PKGCONF_ITEM_SIZE];
-		pkgconf_pkg_t *pkg;
-		FILE *f;
-
-		pkgconf_strlcpy(filebuf, path, sizeof filebuf);
-		pkgconf_strlcat(filebuf, "/", sizeof filebuf);
-		pkgconf_strlcat(filebuf, dirent->d_name, sizeof filebuf);
+		const size_t ext_len = strlen(PKG_CONFIG_EXT), suffix_len = strlen(PKG_UNINSTALLED_SUFFIX);
+		size_t len = strlen(dirent->d_name);
 
-		if (!str_has_suffix(filebuf, PKG_CONFIG_EXT))
+		if (len <= ext_len || strcmp(dirent->d_name + len - ext_len, PKG_CONFIG_EXT))
 			continue;
 
-		PKGCONF_TRACE(client, "trying file [%s]", filebuf);
+		len -= ext_len;
+		pkg_dir_index_add(client, idx, dirent->d_name, len, PKG_DIR_ENTRY_INSTALLED);
 
-		f = fopen(filebuf, "r");
-		if (f == NULL)
-			continue;
+		if (len > suffix_len && !strncmp(dirent->d_name + len - suffix_len, PKG_UNINSTALLED_SUFFIX, suffix_len))
+			pkg_dir_index_add(client, idx, dirent->d_name, len - suffix_len, PKG_DIR_ENTRY_UNINSTALLED);
+	}
 
-		pkg = pkgconf_pkg_new_from_file(client, filebuf, f, 0);
-		if (pkg != NULL)
-		{
-			if (func(pkg, data))
-			{
-				outpkg = pkg;
-				goto out;
-			}
+	closedir(dir);
 
-			pkgconf_pkg_unref(client, pkg);
-		}
+	PKGCONF_TRACE(client, "indexed dir [%s]: %zu modules", path, idx->entries.count);
+
+	return idx;
+}
+
+static void
+pkg_dir_index_free(const pkgconf_client_t *client, pkg_dir_index_t *idx)
+{
+	pkg_dir_entry_t *entry;
+	size_t cursor = 0;
+
+	while ((entry = pkgconf_hash_next(&idx->entries, &cursor)) != NULL)
+	{
+		pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, entry->name);
+		pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, entry);
 	}
 
-out:
-	closedir(dir);
-	return outpkg;
+	pkgconf_hash_free(&idx->entries);
+	pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, idx->path);
+	pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, idx);
+}
+
+static pkg_dir_index_t *
+pkg_dir_index_get(pkgconf_client_t *client, const char *path)
+{
+	pkg_dir_index_t *idx;
+
+	idx = pkgconf_hash_lookup(&client->dir_index, path, strlen(path));
+	if (idx != NULL)
+		return idx;
+
+	idx = pkg_dir_index_build(client, path);
+	pkgconf_hash_insert(&client->dir_index, idx->path, strlen(idx->path), idx);
+
+	return idx;
 }
 
 /*
  * !doc
  *
- * .. c:function:: pkgconf_pkg_t *pkgconf_scan_all(pkgconf_client_t *client, void *data, pkgconf_pkg_iteration_func_t func)
+ * .. c:function:: void pkgconf_pkg_dir_index_free(pkgconf_client_t *client)
  *
- *    Iterates over all packages found in the `package directory list`, running ``func`` on them.  If ``func`` returns true,
- *    then stop iteration and return the last iterated package.
+ *    Releases the directory indexes built while searching for packages.  The indexes are
+ *    rebuilt on demand, so this may also be used to pick up packages which were added to
+ *    a search directory after it was first searched.
  *
- *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
- *    :param void* data: An opaque pointer to data to provide the iteration function with.
- *    :param pkgconf_pkg_iteration_func_t func: A function which is called for each package to determine if the package matches,
- *        always return ``false`` to iterate over all packages.
- *    :return: A package object reference if one is found by the scan function, else ``NULL``.
- *    :rtype: pkgconf_pkg_t *
+ *    :param pkgconf_client_t* client: The pkgconf client object which owns the directory indexes.
+ *    :return: nothing
  */
-pkgconf_pkg_t *
-pkgconf_scan_all(pkgconf_client_t *client, void *data, pkgconf_pkg_iteration_func_t func)
+void
+pkgconf_pkg_dir_index_free(pkgconf_client_t *client)
 {
-	pkgconf_node_t *n;
-	pkgconf_pkg_t *pkg;
+	pkg_dir_index_t *idx;
+	size_t cursor = 0;
 
-	PKGCONF_FOREACH_LIST_ENTRY(client->dir_list.head, n)
-	{
-		pkgconf_path_t *pnode = n->data;
+	while ((idx = pkgconf_hash_next(&client->dir_index, &cursor)) != NULL)
+		pkg_dir_index_free(client, idx);
 
-		PKGCONF_TRACE(client, "scanning directory: %s", pnode->path);
+	pkgconf_hash_free(&client->dir_index);
+}
 
-		if ((pkg = pkgconf_pkg_scan_dir(client, pnode->path, data, func)) != NULL)
-			return pkg;
-	}
+/*
+ * Returns the PKG_DIR_ENTRY_* flags for `name` in `path`, or -1 if the name cannot be
+ * answered from the index and the candidate files must be probed directly.
+ */
+static int
+pkg_dir_index_lookup(pkgconf_client_t *client, const char *path, const char *name)
+{
+	char namebuf[PKGCONF_ITEM_SIZE];
+	const pkg_dir_entry_t *entry;
+	size_t len = strlen(name);
 
-	return NULL;
+	if (len == 0 || len >= sizeof namebuf || strchr(name, '/') != NULL || strchr(name, PKG_DIR_SEP_S) != NULL)
+		return -1;
+
+	pkg_dir_index_fold_name(namebuf, sizeof namebuf, name, len);
+
+	entry = pkgconf_hash_lookup(&pkg_dir_index_get(client, path)->entries, namebuf, len);
+	return entry != NULL ? (int) entry->flags : 0;
+}
+
+/*
+ * packages found on the search path are cached, so while a query is using an arena they
+ * are allocated from the cache arena, which outlives the query.
+ */
+static inline pkgconf_arena_t *
+pkg_cache_arena(pkgconf_client_t *client)
+{
+	if (client->arena == NULL || (client->flags & PKGCONF_PKG_PKGF_NO_CACHE))
+		return NULL;
+
+	return &client->cache_arena;
+}
+
+static FILE *
+pkg_fopen(pkgconf_client_t *client, const char *path)
+{
+	pkgconf_stats_phase_t phase = PKGCONF_STATS_ENTER(client, PKGCONF_STATS_PHASE_OPEN);
+	FILE *f = fopen(path, "r");
+
+	if (f != NULL)
+		PKGCONF_STATS_COUNT(client, files_opened, 1);
+	else
+		PKGCONF_STATS_COUNT(client, probes_failed, 1);
+
+	PKGCONF_STATS_LEAVE(client, phase);
+
+	return f;
+}
+
+static inline pkgconf_pkg_t *
+pkgconf_pkg_try_specific_path(pkgconf_client_t *client, const char *path, const char *name)
+{
+	pkgconf_pkg_t *pkg = NULL;
+	FILE *f = NULL;
+	char locbuf[PKGCONF_ITEM_SIZE];
+	char uninst_locbuf[PKGCONF_ITEM_SIZE];
+	int flags, len;
+
+	PKGCONF_TRACE(client, "trying path: %s for %s", path, name);
+
+	flags = pkg_dir_index_lookup(client, path, name);
+	if (flags == 0)
+	{
+		PKGCONF_STATS_COUNT(client, probes_failed, 1);
+		return NULL;
+	}
+
+	/* a truncated path could name some other file, so candidates which do not fit are skipped */
+	len = snprintf(locbuf, sizeof locbuf, "%s%c%s" PKG_CONFIG_EXT, path, PKG_DIR_SEP_S, name);
+	if (len < 0 || (size_t) len >= sizeof locbuf)
+		flags &= ~PKG_DIR_ENTRY_INSTALLED;
+
+	len = snprintf(uninst_locbuf, sizeof uninst_locbuf, "%s%c%s" PKG_UNINSTALLED_SUFFIX PKG_CONFIG_EXT, path, PKG_DIR_SEP_S, name);
+	if (len < 0 || (size_t) len >= sizeof uninst_locbuf)
+		flags &= ~PKG_DIR_ENTRY_UNINSTALLED;
+
+	if (!(client->flags & PKGCONF_PKG_PKGF_NO_UNINSTALLED) && (flags & PKG_DIR_ENTRY_UNINSTALLED) &&
+	    (f = pkg_fopen(client, uninst_locbuf)) != NULL)
+	{
+		PKGCONF_TRACE(client, "found (uninstalled): %s", uninst_locbuf);
+		pkg = pkg_new_from_file(client, uninst_locbuf, f, PKGCONF_PKG_PROPF_UNINSTALLED, pkg_cache_arena(client));
+	}
+	else if ((flags & PKG_DIR_ENTRY_INSTALLED) && (f = pkg_fopen(client, locbuf)) != NULL)
+	{
+		PKGCONF_TRACE(client, "found: %s", locbuf);
+		pkg = pkg_new_from_file(client, locbuf, f, 0, pkg_cache_arena(client));
+	}
+
+	return pkg;
+}
+
+/*
+ * hands the .pc files of a directory to a pool of worker threads, and builds packages out of
+ * them in directory order as the workers are done with them.  returns false if no worker could
+ * be started, in which case the directory has to be scanned serially.
+ */
+static bool
+pkgconf_pkg_scan_dir_prefetch(pkgconf_client_t *client, DIR *dir, const char *path, void *data, pkgconf_pkg_iteration_func_t func, pkgconf_pkg_t **outpkg)
+{
+	pkgconf_prefetch_t *prefetch;
+	struct dirent *dirent;
+	size_t i;
+
+	if ((prefetch = pkgconf_prefetch_new(client->scan_threads)) == NULL)
+		return false;
+
+	for (dirent = readdir(dir); dirent != NULL; dirent = readdir(dir))
+	{
+		char filebuf[PKGCONF_ITEM_SIZE];
+
+		pkgconf_strlcpy(filebuf, path, sizeof filebuf);
+		pkgconf_strlcat(filebuf, "/", sizeof filebuf);
+		pkgconf_strlcat(filebuf, dirent->d_name, sizeof filebuf);
+
+		if (!str_has_suffix(filebuf, PKG_CONFIG_EXT))
+			continue;
+
+		if (!pkgconf_prefetch_add(prefetch, filebuf))
+			goto fallback;
+	}
+
+	if (!pkgconf_prefetch_start(prefetch))
+		goto fallback;
+
+	PKGCONF_TRACE(client, "parsing %zu files on %u threads", pkgconf_prefetch_count(prefetch), client->scan_threads);
+
+	for (i = 0; i < pkgconf_prefetch_count(prefetch); i++)
+	{
+		pkgconf_pkg_t *pkg;
+
+		PKGCONF_TRACE(client, "trying file [%s]", pkgconf_prefetch_path(prefetch, i));
+
+		if (!pkgconf_prefetch_wait(prefetch, i))
+			continue;
+
+		pkg = pkg_new_from_prefetch(client, prefetch, i);
+		if (pkg != NULL)
+		{
+			if (func(pkg, data))
+			{
+				*outpkg = pkg;
+				break;
+			}
+
+			pkgconf_pkg_unref(client, pkg);
+		}
+	}
+
+	pkgconf_prefetch_free(prefetch);
+	return true;
+
+fallback:
+	pkgconf_prefetch_free(prefetch);
+	rewinddir(dir);
+	return false;
+}
+
+static pkgconf_pkg_t *
+pkgconf_pkg_scan_dir(pkgconf_client_t *client, const char *path, void *data, pkgconf_pkg_iteration_func_t func)
+{
+	DIR *dir;
+	struct dirent *dirent;
+	pkgconf_pkg_t *outpkg = NULL;
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return NULL;
+
+	PKGCONF_TRACE(client, "scanning dir [%s]", path);
+
+	/* the parse cache already saves tokenizing the files, and is only updated when parsing serially */
+	if (client->scan_threads > 1 && client->parse_cache == NULL &&
+	    pkgconf_pkg_scan_dir_prefetch(client, dir, path, data, func, &outpkg))
+		goto out;
+
+	for (dirent = readdir(dir); dirent != NULL; dirent = readdir(dir))
+	{
+		char filebuf[PKGCONF_ITEM_SIZE];
+		pkgconf_pkg_t *pkg;
+		FILE *f;
+
+		pkgconf_strlcpy(filebuf, path, sizeof filebuf);
+		pkgconf_strlcat(filebuf, "/", sizeof filebuf);
+		pkgconf_strlcat(filebuf, dirent->d_name, sizeof filebuf);
+
+		if (!str_has_suffix(filebuf, PKG_CONFIG_EXT))
+			continue;
+
+		PKGCONF_TRACE(client, "trying file [%s]", filebuf);
+
+		f = pkg_fopen(client, filebuf);
+		if (f == NULL)
+			continue;
+
+		pkg = pkgconf_pkg_new_from_file(client, filebuf, f, 0);
+		if (pkg != NULL)
+		{
+			if (func(pkg, data))
+			{
+				outpkg = pkg;
+				goto out;
+			}
+
+			pkgconf_pkg_unref(client, pkg);
+		}
+	}
+
+out:
+	closedir(dir);
+	return outpkg;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_pkg_t *pkgconf_scan_all(pkgconf_client_t *client, void *data, pkgconf_pkg_iteration_func_t func)
+ *
+ *    Iterates over all packages found in the `package directory list`, running ``func`` on them.  If ``func`` returns true,
+ *    then stop iteration and return the last iterated package.
+ *
+ *    Packages are visited in directory order, even if their `.pc` files are parsed by worker threads, see
+ *    ``pkgconf_client_set_scan_threads()``.
+ *
+ *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
+ *    :param void* data: An opaque pointer to data to provide the iteration function with.
+ *    :param pkgconf_pkg_iteration_func_t func: A function which is called for each package to determine if the package matches,
+ *        always return ``false`` to iterate over all packages.
+ *    :return: A package object reference if one is found by the scan function, else ``NULL``.
+ *    :rtype: pkgconf_pkg_t *
+ */
+pkgconf_pkg_t *
+pkgconf_scan_all(pkgconf_client_t *client, void *data, pkgconf_pkg_iteration_func_t func)
+{
+	pkgconf_stats_phase_t phase = PKGCONF_STATS_ENTER(client, PKGCONF_STATS_PHASE_SEARCH);
+	pkgconf_node_t *n;
+	pkgconf_pkg_t *pkg = NULL;
+
+	PKGCONF_FOREACH_LIST_ENTRY(client->dir_list.head, n)
+	{
+		pkgconf_path_t *pnode = n->data;
+
+		PKGCONF_TRACE(client, "scanning directory: %s", pnode->path);
+
+		if ((pkg = pkgconf_pkg_scan_dir(client, pnode->path, data, func)) != NULL)
+			break;
+	}
+
+	PKGCONF_STATS_LEAVE(client, phase);
+
+	return pkg;
 }
 
 #ifdef _WIN32
@@ -714,20 +1209,8 @@ pkgconf_pkg_find_in_registry_key(pkgconf_client_t *client, HKEY hkey, const char
 }
 #endif
 
-/*
- * !doc
- *
- * .. c:function:: pkgconf_pkg_t *pkgconf_pkg_find(pkgconf_client_t *client, const char *name)
- *
- *    Search for a package.
- *
- *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
- *    :param char* name: The name of the package `atom` to use for searching.
- *    :return: A package object reference if the package was found, else ``NULL``.
- *    :rtype: pkgconf_pkg_t *
- */
-pkgconf_pkg_t *
-pkgconf_pkg_find(pkgconf_client_t *client, const char *name)
+static pkgconf_pkg_t *
+pkg_find(pkgconf_client_t *client, const char *name)
 {
 	pkgconf_pkg_t *pkg = NULL;
 	pkgconf_node_t *n;
@@ -738,7 +1221,7 @@ pkgconf_pkg_find(pkgconf_client_t *client, const char *name)
 	/* name might actually be a filename. */
 	if (str_has_suffix(name, PKG_CONFIG_EXT))
 	{
-		if ((f = fopen(name, "r")) != NULL)
+		if ((f = pkg_fopen(client, name)) != NULL)
 		{
 			pkgconf_pkg_t *pkg;
 
@@ -795,136 +1278,29 @@ out:
 /*
  * !doc
  *
- * .. c:function:: int pkgconf_compare_version(const char *a, const char *b)
+ * .. c:function:: pkgconf_pkg_t *pkgconf_pkg_find(pkgconf_client_t *client, const char *name)
  *
- *    Compare versions using RPM version comparison rules as described in the LSB.
+ *    Search for a package.
  *
- *    :param char* a: The first version to compare in the pair.
- *    :param char* b: The second version to compare in the pair.
- *    :return: -1 if the first version is greater, 0 if both versions are equal, 1 if the second version is greater.
- *    :rtype: int
+ *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
+ *    :param char* name: The name of the package `atom` to use for searching.
+ *    :return: A package object reference if the package was found, else ``NULL``.
+ *    :rtype: pkgconf_pkg_t *
  */
-int
-pkgconf_compare_version(const char *a, const char *b)
+pkgconf_pkg_t *
+pkgconf_pkg_find(pkgconf_client_t *client, const char *name)
 {
-	char oldch1, oldch2;
-	char buf1[PKGCONF_ITEM_SIZE], buf2[PKGCONF_ITEM_SIZE];
-	char *str1, *str2;
-	char *one, *two;
-	int ret;
-	bool isnum;
-
-	/* optimization: if version matches then it's the same version. */
-	if (a == NULL)
-		return 1;
-
-	if (b == NULL)
-		return -1;
-
-	if (!strcasecmp(a, b))
-		return 0;
-
-	pkgconf_strlcpy(buf1, a, sizeof buf1);
-	pkgconf_strlcpy(buf2, b, sizeof buf2);
-
-	one = str1 = buf1;
-	two = str2 = buf2;
-
-	while (*one || *two)
-	{
-		while (*one && !isalnum((unsigned int)*one) && *one != '~')
-			one++;
-		while (*two && !isalnum((unsigned int)*two) && *two != '~')
-			two++;
-
-		if (*one == '~' || *two == '~')
-		{
-			if (*one != '~')
-				return -1;
-			if (*two != '~')
-				return 1;
-
-			one++;
-			two++;
-			continue;
-		}
-
-		if (!(*one && *two))
-			break;
-
-		str1 = one;
-		str2 = two;
-
-		if (isdigit((unsigned int)*str1))
-		{
-			while (*str1 && isdigit((unsigned int)*str1))
-				str1++;
-
-			while (*str2 && isdigit((unsigned int)*str2))
-				str2++;
-
-			isnum = true;
-		}
-		else
-		{
-			while (*str1 && isalpha((unsigned int)*str1))
-				str1++;
-
-			while (*str2 && isalpha((unsigned int)*str2))
-				str2++;
-
-			isnum = false;
-		}
-
-		oldch1 = *str1;
-		oldch2 = *str2;
-
-		*str1 = '\0';
-		*str2 = '\0';
-
-		if (one == str1)
-			return -1;
-
-		if (two == str2)
-			return (isnum ? 1 : -1);
-
-		if (isnum)
-		{
-			int onelen, twolen;
-
-			while (*one == '0')
-				one++;
-
-			while (*two == '0')
-				two++;
-
-			onelen = strlen(one);
-			twolen = strlen(two);
-
-			if (onelen > twolen)
-				return 1;
-			else if (twolen > onelen)
-				return -1;
-		}
-
-		ret = strcmp(one, two);
-		if (ret != 0)
-			return ret < 0 ? -1 : 1;
-
-		*str1 = oldch1;
-		*str2 = oldch2;
+	pkgconf_stats_phase_t phase = PKGCONF_STATS_ENTER(client, PKGCONF_STATS_PHASE_SEARCH);
+	pkgconf_pkg_t *pkg;
 
-		one = str1;
-		two = str2;
-	}
+	PKGCONF_TRACEEVENT_BEGIN(client, "pkgconf_pkg_find", "package", name);
 
-	if ((!*one) && (!*two))
-		return 0;
+	pkg = pkg_find(client, name);
 
-	if (!*one)
-		return -1;
+	PKGCONF_TRACEEVENT_END(client, "pkgconf_pkg_find");
+	PKGCONF_STATS_LEAVE(client, phase);
 
-	return 1;
+	return pkg;
 }
 
 static pkgconf_pkg_t pkg_config_virtual = {
@@ -1025,7 +1401,7 @@ pkgconf_builtin_pkg_get(const char *name)
 	return (pair != NULL) ? pair->pkg : NULL;
 }
 
-typedef bool (*pkgconf_vercmp_res_func_t)(const char *a, const char *b);
+typedef bool (*pkgconf_vercmp_res_func_t)(const pkgconf_version_t *a, const pkgconf_version_t *b);
 
 typedef struct {
 	const char *name;
@@ -1048,37 +1424,37 @@ static int pkgconf_pkg_comparator_pair_namecmp(const void *key, const void *ptr)
 	return strcmp(key, pair->name);
 }
 
-static bool pkgconf_pkg_comparator_lt(const char *a, const char *b)
+static bool pkgconf_pkg_comparator_lt(const pkgconf_version_t *a, const pkgconf_version_t *b)
 {
-	return (pkgconf_compare_version(a, b) < 0);
+	return (pkgconf_version_compare(a, b) < 0);
 }
 
-static bool pkgconf_pkg_comparator_gt(const char *a, const char *b)
+static bool pkgconf_pkg_comparator_gt(const pkgconf_version_t *a, const pkgconf_version_t *b)
 {
-	return (pkgconf_compare_version(a, b) > 0);
+	return (pkgconf_version_compare(a, b) > 0);
 }
 
-static bool pkgconf_pkg_comparator_lte(const char *a, const char *b)
+static bool pkgconf_pkg_comparator_lte(const pkgconf_version_t *a, const pkgconf_version_t *b)
 {
-	return (pkgconf_compare_version(a, b) <= 0);
+	return (pkgconf_version_compare(a, b) <= 0);
 }
 
-static bool pkgconf_pkg_comparator_gte(const char *a, const char *b)
+static bool pkgconf_pkg_comparator_gte(const pkgconf_version_t *a, const pkgconf_version_t *b)
 {
-	return (pkgconf_compare_version(a, b) >= 0);
+	return (pkgconf_version_compare(a, b) >= 0);
 }
 
-static bool pkgconf_pkg_comparator_eq(const char *a, const char *b)
+static bool pkgconf_pkg_comparator_eq(const pkgconf_version_t *a, const pkgconf_version_t *b)
 {
-	return (pkgconf_compare_version(a, b) == 0);
+	return (pkgconf_version_compare(a, b) == 0);
 }
 
-static bool pkgconf_pkg_comparator_ne(const char *a, const char *b)
+static bool pkgconf_pkg_comparator_ne(const pkgconf_version_t *a, const pkgconf_version_t *b)
 {
-	return (pkgconf_compare_version(a, b) != 0);
+	return (pkgconf_version_compare(a, b) != 0);
 }
 
-static bool pkgconf_pkg_comparator_any(const char *a, const char *b)
+static bool pkgconf_pkg_comparator_any(const pkgconf_version_t *a, const pkgconf_version_t *b)
 {
 	(void) a;
 	(void) b;
@@ -1086,7 +1462,7 @@ static bool pkgconf_pkg_comparator_any(const char *a, const char *b)
 	return true;
 }
 
-static bool pkgconf_pkg_comparator_none(const char *a, const char *b)
+static bool pkgconf_pkg_comparator_none(const pkgconf_version_t *a, const pkgconf_version_t *b)
 {
 	(void) a;
 	(void) b;
@@ -1146,10 +1522,6 @@ pkgconf_pkg_comparator_lookup_by_name(const char *name)
 	return (p != NULL) ? p->compare : PKGCONF_CMP_ANY;
 }
 
-typedef struct {
-	pkgconf_dependency_t *pkgdep;
-} pkgconf_pkg_scan_providers_ctx_t;
-
 typedef struct {
 	const pkgconf_vercmp_res_func_t rulecmp[PKGCONF_CMP_COUNT];
 	const pkgconf_vercmp_res_func_t depcmp[PKGCONF_CMP_COUNT];
@@ -1267,55 +1639,236 @@ pkgconf_pkg_scan_provides_vercmp(const pkgconf_dependency_t *pkgdep, const pkgco
 	const pkgconf_pkg_provides_vermatch_rule_t *rule = &pkgconf_pkg_provides_vermatch_rules[pkgdep->compare];
 
 	if (rule->depcmp[provider->compare] != NULL &&
-	    !rule->depcmp[provider->compare](provider->version, pkgdep->version))
+	    !rule->depcmp[provider->compare](provider->version_key, pkgdep->version_key))
 		return false;
 
 	if (rule->rulecmp[provider->compare] != NULL &&
-	    !rule->rulecmp[provider->compare](pkgdep->version, provider->version))
+	    !rule->rulecmp[provider->compare](pkgdep->version_key, provider->version_key))
 		return false;
 
 	return true;
 }
 
 /*
- * pkgconf_pkg_scan_provides_entry(pkg, ctx)
- *
- * attempt to match a single package's Provides rules against the requested dependency node.
+ * The provides index maps each provided name to the packages providing it, in the order
+ * pkgconf_scan_all() visits them.  Only the first Provides entry of a package for a given
+ * name is recorded, since a package is only offered once for each name it provides.
  */
+typedef struct {
+	char *name;
+	pkgconf_list_t providers;
+} pkgconf_pkg_provides_index_entry_t;
+
+typedef struct {
+	pkgconf_node_t iter;
+
+	char *filename;
+	pkgconf_pkg_comparator_t compare;
+	const pkgconf_version_t *version;
+} pkgconf_pkg_provider_t;
+
+typedef struct {
+	pkgconf_client_t *client;
+	size_t packages;
+	size_t providers;
+	bool failed;
+} pkgconf_pkg_provides_index_ctx_t;
+
 static bool
-pkgconf_pkg_scan_provides_entry(const pkgconf_pkg_t *pkg, const pkgconf_pkg_scan_providers_ctx_t *ctx)
+pkgconf_pkg_provides_index_add(const pkgconf_pkg_t *pkg, void *data)
 {
-	const pkgconf_dependency_t *pkgdep = ctx->pkgdep;
+	pkgconf_pkg_provides_index_ctx_t *ctx = data;
+	pkgconf_client_t *client = ctx->client;
 	pkgconf_node_t *node;
 
+	ctx->packages++;
+
 	PKGCONF_FOREACH_LIST_ENTRY(pkg->provides.head, node)
 	{
-		const pkgconf_dependency_t *provider = node->data;
-		if (!strcmp(provider->package, pkgdep->package))
-			return pkgconf_pkg_scan_provides_vercmp(pkgdep, provider);
-	}
+		const pkgconf_dependency_t *provides = node->data;
+		pkgconf_pkg_provides_index_entry_t *entry;
+		pkgconf_pkg_provider_t *provider;
 
-	return false;
-}
+		entry = pkgconf_hash_lookup(&client->provides_index, provides->package, strlen(provides->package));
+		if (entry == NULL)
+		{
+			if (!pkgconf_hash_reserve(&client->provides_index, client->provides_index.count + 1))
+				goto fail;
 
-/*
- * pkgconf_pkg_scan_providers(client, pkgdep, eflags)
- *
- * scan all available packages to see if a Provides rule matches the pkgdep.
+			entry = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_CACHE, sizeof(pkgconf_pkg_provides_index_entry_t));
+			if (entry == NULL)
+				goto fail;
+
+			entry->name = pkgconf_alloc_strdup(&client->allocator, PKGCONF_ALLOC_CACHE, provides->package);
+			if (entry->name == NULL)
+			{
+				pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, entry);
+				goto fail;
+			}
+
+			pkgconf_hash_insert(&client->provides_index, entry->name, strlen(entry->name), entry);
+		}
+		else if (entry->providers.tail != NULL &&
+			 !strcmp(((pkgconf_pkg_provider_t *) entry->providers.tail->data)->filename, pkg->filename))
+			continue;
+
+		provider = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_CACHE, sizeof(pkgconf_pkg_provider_t));
+		if (provider == NULL)
+			goto fail;
+
+		provider->filename = pkgconf_alloc_strdup(&client->allocator, PKGCONF_ALLOC_CACHE, pkg->filename);
+		if (provider->filename == NULL)
+		{
+			pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, provider);
+			goto fail;
+		}
+
+		provider->compare = provides->compare;
+		provider->version = provides->version_key;
+
+		pkgconf_node_insert_tail(&provider->iter, provider, &entry->providers);
+		ctx->providers++;
+	}
+
+	return false;
+
+fail:
+	/* returning true stops the scan */
+	ctx->failed = true;
+	return true;
+}
+
+static bool
+pkgconf_pkg_provides_index_build(pkgconf_client_t *client)
+{
+	pkgconf_pkg_provides_index_ctx_t ctx = {
+		.client = client,
+	};
+	pkgconf_error_handler_func_t warn_handler = client->warn_handler;
+	void *warn_handler_data = client->warn_handler_data;
+	uint64_t start = pkgconf_stats_clock();
+
+	/*
+	 * every package in the search path is parsed here, and problems with packages which
+	 * have nothing to do with the query are not worth reporting; those which matter are
+	 * reported when the packages are loaded again to satisfy a dependency.
+	 */
+	client->warn_handler = pkgconf_default_error_handler;
+	client->warn_handler_data = NULL;
+
+	pkgconf_scan_all(client, &ctx, pkgconf_pkg_provides_index_add);
+
+	client->warn_handler = warn_handler;
+	client->warn_handler_data = warn_handler_data;
+
+	if (ctx.failed)
+	{
+		PKGCONF_TRACE(client, "ran out of memory while building the provides index");
+		pkgconf_pkg_provides_index_free(client);
+		return false;
+	}
+
+	client->provides_indexed = true;
+
+	PKGCONF_STATS_COUNT(client, provides_names, client->provides_index.count);
+	PKGCONF_STATS_COUNT(client, provides_providers, ctx.providers);
+
+	PKGCONF_TRACE(client, "built provides index in %llu usec: %zu names, %zu providers from %zu packages",
+		(unsigned long long) ((pkgconf_stats_clock() - start) / 1000),
+		client->provides_index.count, ctx.providers, ctx.packages);
+
+	return true;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_pkg_provides_index_free(pkgconf_client_t *client)
+ *
+ *    Releases the index of `Provides` rules built when a dependency could not be found by name.
+ *    The index is rebuilt on demand.  ``pkgconf_client_dir_list_build()`` and changes to the global
+ *    variables release it already, so this only needs to be called if the search path is edited
+ *    directly or the contents of the search directories change after it was built.
+ *
+ *    :param pkgconf_client_t* client: The pkgconf client object which owns the provides index.
+ *    :return: nothing
+ */
+void
+pkgconf_pkg_provides_index_free(pkgconf_client_t *client)
+{
+	pkgconf_pkg_provides_index_entry_t *entry;
+	size_t cursor = 0;
+
+	while ((entry = pkgconf_hash_next(&client->provides_index, &cursor)) != NULL)
+	{
+		pkgconf_node_t *node, *next;
+
+		PKGCONF_FOREACH_LIST_ENTRY_SAFE(entry->providers.head, next, node)
+		{
+			pkgconf_pkg_provider_t *provider = node->data;
+
+			pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, provider->filename);
+			pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, provider);
+		}
+
+		pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, entry->name);
+		pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_CACHE, entry);
+	}
+
+	pkgconf_hash_free(&client->provides_index);
+	client->provides_indexed = false;
+}
+
+/*
+ * pkgconf_pkg_scan_providers(client, pkgdep, eflags)
+ *
+ * look up the packages whose Provides rules match the pkgdep, building the provides index
+ * on first use.
  */
 static pkgconf_pkg_t *
 pkgconf_pkg_scan_providers(pkgconf_client_t *client, pkgconf_dependency_t *pkgdep, unsigned int *eflags)
 {
-	pkgconf_pkg_t *pkg;
-	pkgconf_pkg_scan_providers_ctx_t ctx = {
-		.pkgdep = pkgdep,
-	};
+	pkgconf_pkg_provides_index_entry_t *entry;
+	pkgconf_node_t *node;
 
-	pkg = pkgconf_scan_all(client, &ctx, (pkgconf_pkg_iteration_func_t) pkgconf_pkg_scan_provides_entry);
-	if (pkg != NULL)
+	if (!client->provides_indexed && !pkgconf_pkg_provides_index_build(client))
 	{
-		pkgdep->match = pkgconf_pkg_ref(client, pkg);
-		return pkg;
+		if (eflags != NULL)
+			*eflags |= PKGCONF_PKG_ERRF_DEPGRAPH_BREAK;
+
+		return NULL;
+	}
+
+	entry = pkgconf_hash_lookup(&client->provides_index, pkgdep->package, strlen(pkgdep->package));
+	if (entry != NULL)
+	{
+		PKGCONF_FOREACH_LIST_ENTRY(entry->providers.head, node)
+		{
+			const pkgconf_pkg_provider_t *provider = node->data;
+			const pkgconf_dependency_t provides = {
+				.package = entry->name,
+				.compare = provider->compare,
+				.version = provider->version != NULL ? provider->version->str : NULL,
+				.version_key = provider->version,
+			};
+			pkgconf_pkg_t *pkg;
+			FILE *f;
+
+			if (!pkgconf_pkg_scan_provides_vercmp(pkgdep, &provides))
+				continue;
+
+			PKGCONF_TRACE(client, "provides index: %s is provided by %s", pkgdep->package, provider->filename);
+
+			if ((f = pkg_fopen(client, provider->filename)) == NULL)
+				continue;
+
+			pkg = pkgconf_pkg_new_from_file(client, provider->filename, f, 0);
+			if (pkg != NULL)
+			{
+				pkgdep->match = pkgconf_pkg_ref(client, pkg);
+				return pkg;
+			}
+		}
 	}
 
 	if (eflags != NULL)
@@ -1324,6 +1877,19 @@ pkgconf_pkg_scan_providers(pkgconf_client_t *client, pkgconf_dependency_t *pkgde
 	return NULL;
 }
 
+/*
+ * the parsed version of a package.  built-in packages are not parsed, and are shared between
+ * clients, so their versions are looked up in the client's intern table instead.
+ */
+static inline const pkgconf_version_t *
+pkgconf_pkg_version_key(pkgconf_client_t *client, const pkgconf_pkg_t *pkg)
+{
+	if (pkg->version_key != NULL || pkg->version == NULL)
+		return pkg->version_key;
+
+	return pkgconf_intern_version(client->interns, pkg->version);
+}
+
 /*
  * !doc
  *
@@ -1369,9 +1935,9 @@ pkgconf_pkg_verify_dependency(pkgconf_client_t *client, pkgconf_dependency_t *pk
 	}
 
 	if (pkg->id == NULL)
-		pkg->id = strdup(pkgdep->package);
+		pkg->id = pkgconf_alloc_strdup(&client->allocator, PKGCONF_ALLOC_PACKAGE, pkgdep->package);
 
-	if (pkgconf_pkg_comparator_impls[pkgdep->compare](pkg->version, pkgdep->version) != true)
+	if (pkgconf_pkg_comparator_impls[pkgdep->compare](pkgconf_pkg_version_key(client, pkg), pkgdep->version_key) != true)
 	{
 		if (eflags != NULL)
 			*eflags |= PKGCONF_PKG_ERRF_PACKAGE_VER_MISMATCH;
@@ -1434,62 +2000,6 @@ pkgconf_pkg_report_graph_error(pkgconf_client_t *client, pkgconf_pkg_t *parent,
 	return eflags;
 }
 
-static inline unsigned int
-pkgconf_pkg_walk_list(pkgconf_client_t *client,
-	pkgconf_pkg_t *parent,
-	pkgconf_list_t *deplist,
-	pkgconf_pkg_traverse_func_t func,
-	void *data,
-	int depth,
-	unsigned int skip_flags)
-{
-	unsigned int eflags = PKGCONF_PKG_ERRF_OK;
-	pkgconf_node_t *node;
-
-	PKGCONF_FOREACH_LIST_ENTRY(deplist->head, node)
-	{
-		unsigned int eflags_local = PKGCONF_PKG_ERRF_OK;
-		pkgconf_dependency_t *depnode = node->data;
-		pkgconf_pkg_t *pkgdep;
-
-		if (*depnode->package == '\0')
-			continue;
-
-		pkgdep = pkgconf_pkg_verify_dependency(client, depnode, &eflags_local);
-
-		eflags |= eflags_local;
-		if (eflags_local != PKGCONF_PKG_ERRF_OK && !(client->flags & PKGCONF_PKG_PKGF_SKIP_ERRORS))
-		{
-			pkgconf_pkg_report_graph_error(client, parent, pkgdep, depnode, eflags_local);
-			continue;
-		}
-		if (pkgdep == NULL)
-			continue;
-
-		if (pkgdep->serial == client->serial)
-		{
-			pkgdep->hits++;
-			pkgconf_pkg_unref(client, pkgdep);
-			continue;
-		}
-
-		if (skip_flags && (depnode->flags & skip_flags) == skip_flags)
-		{
-			pkgconf_pkg_unref(client, pkgdep);
-			continue;
-		}
-
-		pkgconf_audit_log_dependency(client, pkgdep, depnode);
-
-		pkgdep->hits++;
-		pkgdep->serial = client->serial;
-		eflags |= pkgconf_pkg_traverse_main(client, pkgdep, func, data, depth - 1, skip_flags);
-		pkgconf_pkg_unref(client, pkgdep);
-	}
-
-	return eflags;
-}
-
 static inline unsigned int
 pkgconf_pkg_walk_conflicts_list(pkgconf_client_t *client,
 	pkgconf_pkg_t *root, pkgconf_list_t *deplist)
@@ -1538,70 +2048,388 @@ pkgconf_pkg_walk_conflicts_list(pkgconf_client_t *client,
 }
 
 /*
- * !doc
- *
- * .. c:function:: unsigned int pkgconf_pkg_traverse(pkgconf_client_t *client, pkgconf_pkg_t *root, pkgconf_pkg_traverse_func_t func, void *data, int maxdepth, unsigned int skip_flags)
+ * The dependency graph is walked depth-first with an explicit stack of frames, one for each
+ * package being traversed, so that deep dependency chains do not exhaust the C stack.  A frame
+ * holds the dependency list of the package being walked, the dependency node reached in it and
+ * the error flags collected from the list so far.
  *
- *    Walk and resolve the dependency graph up to `maxdepth` levels.
- *
- *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
- *    :param pkgconf_pkg_t* root: The root of the dependency graph.
- *    :param pkgconf_pkg_traverse_func_t func: A traversal function to call for each resolved node in the dependency graph.
- *    :param void* data: An opaque pointer to data to be passed to the traversal function.
- *    :param int maxdepth: The maximum depth to walk the dependency graph for.  -1 means infinite recursion.
- *    :param uint skip_flags: Skip over dependency nodes containing the specified flags.  A setting of 0 skips no dependency nodes.
- *    :return: ``PKGCONF_PKG_ERRF_OK`` on success, else an error code.
- *    :rtype: unsigned int
+ * The steps taken by the walk are logged as well, so that the closure of a package can be
+ * recorded once its frame is done, see closure.c.  A frame remembers where its steps start in
+ * the log, and what it takes for them to be replayed by another traversal.
  */
-static unsigned int
-pkgconf_pkg_traverse_main(pkgconf_client_t *client,
+typedef enum {
+	PKGCONF_TRAVERSE_REQUIRES,
+	PKGCONF_TRAVERSE_REQUIRES_PRIVATE
+} pkgconf_traverse_stage_t;
+
+typedef struct {
+	pkgconf_pkg_t *pkg;
+	int depth;
+	pkgconf_traverse_stage_t stage;
+	pkgconf_node_t *node;
+	unsigned int eflags;
+
+	unsigned int flags;
+	size_t first_step;
+	uint64_t first_visit;
+	int levels;
+	bool truncated;
+} pkgconf_traverse_frame_t;
+
+typedef struct {
+	const pkgconf_allocator_t *allocator;
+
+	pkgconf_traverse_frame_t *frames;
+	size_t count;
+	size_t alloc;
+
+	pkgconf_closure_step_t *steps;
+	size_t step_count;
+	size_t step_alloc;
+	bool recording;
+} pkgconf_traverse_stack_t;
+
+static void
+pkgconf_pkg_traverse_log(pkgconf_traverse_stack_t *stack, pkgconf_closure_step_type_t type, pkgconf_pkg_t *pkg, void *ptr, bool is_private)
+{
+	pkgconf_closure_step_t *step;
+
+	if (!stack->recording)
+		return;
+
+	if (stack->step_count == stack->step_alloc)
+	{
+		size_t alloc = stack->step_alloc ? stack->step_alloc * 2 : 64;
+		pkgconf_closure_step_t *steps = pkgconf_alloc_realloc(stack->allocator, PKGCONF_ALLOC_QUERY, stack->steps, alloc * sizeof(pkgconf_closure_step_t));
+
+		/* a log with a step missing must not be recorded, so stop logging altogether */
+		if (steps == NULL)
+		{
+			stack->recording = false;
+			return;
+		}
+
+		stack->steps = steps;
+		stack->step_alloc = alloc;
+	}
+
+	step = &stack->steps[stack->step_count++];
+	step->type = type;
+	step->is_private = is_private;
+	step->pkg = pkg;
+	step->dep = type == PKGCONF_CLOSURE_VISIT ? ptr : NULL;
+	step->closure = type == PKGCONF_CLOSURE_REPLAY ? ptr : NULL;
+}
+
+/* the dependency lists of virtual packages, such as the world package of a queue, are not fixed */
+static inline bool
+pkgconf_pkg_traverse_can_record(const pkgconf_pkg_t *pkg)
+{
+	return !(pkg->flags & (PKGCONF_PKG_PROPF_STATIC | PKGCONF_PKG_PROPF_VIRTUAL));
+}
+
+/*
+ * visits a package and checks its conflicts, then pushes a frame to walk its dependencies.
+ * returns false if there is nothing to walk, with the result of the traversal in eflags.
+ */
+static bool
+pkgconf_pkg_traverse_enter(pkgconf_client_t *client,
+	pkgconf_traverse_stack_t *stack,
 	pkgconf_pkg_t *root,
 	pkgconf_pkg_traverse_func_t func,
 	void *data,
 	int maxdepth,
-	unsigned int skip_flags)
+	unsigned int *eflags)
 {
-	unsigned int eflags = PKGCONF_PKG_ERRF_OK;
+	pkgconf_traverse_frame_t *frame;
+	unsigned int flags = client->flags;
+	size_t first_step = stack->step_count;
+
+	*eflags = PKGCONF_PKG_ERRF_OK;
 
 	if (maxdepth == 0)
-		return eflags;
+		return false;
+
+	/* the span of the node ends when its frame is popped, see pkgconf_pkg_traverse_main() */
+	PKGCONF_TRACEEVENT_BEGIN(client, "pkgconf_pkg_traverse_main", "package", root->id);
+
+	pkgconf_pkg_materialize(client, root, PKGCONF_PKG_FIELDF_DEPENDENCIES);
 
 	PKGCONF_TRACE(client, "%s: level %d, serial %lu", root->id, maxdepth, client->serial);
 
 	if ((root->flags & PKGCONF_PKG_PROPF_VIRTUAL) != PKGCONF_PKG_PROPF_VIRTUAL || (client->flags & PKGCONF_PKG_PKGF_SKIP_ROOT_VIRTUAL) != PKGCONF_PKG_PKGF_SKIP_ROOT_VIRTUAL)
 	{
+		pkgconf_pkg_traverse_log(stack, PKGCONF_CLOSURE_FUNC, root, NULL, (client->flags & PKGCONF_PKG_PKGF_ITER_PKG_IS_PRIVATE) != 0);
+
 		if (func != NULL)
 			func(client, root, data);
 	}
 
 	if (!(client->flags & PKGCONF_PKG_PKGF_SKIP_CONFLICTS))
 	{
-		eflags = pkgconf_pkg_walk_conflicts_list(client, root, &root->conflicts);
-		if (eflags != PKGCONF_PKG_ERRF_OK)
-			return eflags;
+		*eflags = pkgconf_pkg_walk_conflicts_list(client, root, &root->conflicts);
+		if (*eflags != PKGCONF_PKG_ERRF_OK)
+		{
+			PKGCONF_TRACEEVENT_END(client, "pkgconf_pkg_traverse_main");
+			return false;
+		}
+	}
+
+	if (stack->count == stack->alloc)
+	{
+		size_t alloc = stack->alloc ? stack->alloc * 2 : 16;
+		pkgconf_traverse_frame_t *frames = pkgconf_alloc_realloc(stack->allocator, PKGCONF_ALLOC_QUERY, stack->frames, alloc * sizeof(pkgconf_traverse_frame_t));
+
+		if (frames == NULL)
+		{
+			*eflags = PKGCONF_PKG_ERRF_DEPGRAPH_BREAK;
+			PKGCONF_TRACEEVENT_END(client, "pkgconf_pkg_traverse_main");
+			return false;
+		}
+
+		stack->frames = frames;
+		stack->alloc = alloc;
 	}
 
 	PKGCONF_TRACE(client, "%s: walking requires list", root->id);
-	eflags = pkgconf_pkg_walk_list(client, root, &root->required, func, data, maxdepth, skip_flags);
-	if (eflags != PKGCONF_PKG_ERRF_OK)
+
+	frame = &stack->frames[stack->count++];
+	frame->pkg = root;
+	frame->depth = maxdepth;
+	frame->stage = PKGCONF_TRAVERSE_REQUIRES;
+	frame->node = root->required.head;
+	frame->eflags = PKGCONF_PKG_ERRF_OK;
+	frame->flags = flags;
+	frame->first_step = first_step;
+	frame->first_visit = UINT64_MAX;
+	frame->levels = 1;
+	frame->truncated = false;
+
+	return true;
+}
+
+/*
+ * replays the closure of a package the frame descends into, if one was recorded which
+ * this traversal can use.
+ */
+static bool
+pkgconf_pkg_traverse_replay(pkgconf_client_t *client,
+	pkgconf_traverse_stack_t *stack,
+	pkgconf_traverse_frame_t *frame,
+	pkgconf_pkg_t *pkg,
+	pkgconf_pkg_traverse_func_t func,
+	void *data,
+	unsigned int skip_flags)
+{
+	pkgconf_closure_t *closure;
+
+	if (frame->depth - 1 == 0 || !pkgconf_pkg_traverse_can_record(pkg))
+		return false;
+
+	closure = pkgconf_closure_lookup(client, pkg, client->flags, skip_flags, frame->depth - 1);
+	if (closure == NULL)
+		return false;
+
+	PKGCONF_TRACE(client, "%s: level %d, serial %lu, replaying closure", pkg->id, frame->depth - 1, client->serial);
+
+	if (!pkgconf_closure_replay(client, closure, func, data, &frame->first_visit))
+		return false;
+
+	pkgconf_pkg_traverse_log(stack, PKGCONF_CLOSURE_REPLAY, pkg, closure, false);
+
+	if (closure->levels + 1 > frame->levels)
+		frame->levels = closure->levels + 1;
+
+	return true;
+}
+
+/*
+ * records the closure of a package once its frame is done, if the walk below it did not depend
+ * on anything else: it succeeded, it did not reach the depth limit and it did not run into a
+ * package which was visited before the package itself.  the steps of the closure are replaced
+ * by a single step in the log.
+ */
+static void
+pkgconf_pkg_traverse_record(pkgconf_client_t *client,
+	pkgconf_traverse_stack_t *stack,
+	const pkgconf_traverse_frame_t *frame,
+	unsigned int skip_flags)
+{
+	pkgconf_closure_t *closure;
+
+	if (!stack->recording || frame->eflags != PKGCONF_PKG_ERRF_OK || frame->truncated)
+		return;
+
+	if (!pkgconf_pkg_traverse_can_record(frame->pkg) || frame->first_visit < frame->pkg->visit)
+		return;
+
+	/* there is nothing to gain from recording a package without dependencies */
+	if (stack->step_count - frame->first_step <= 1)
+		return;
+
+	closure = pkgconf_closure_new(client, frame->pkg, frame->flags, skip_flags, frame->levels,
+		stack->steps + frame->first_step, stack->step_count - frame->first_step);
+	if (closure == NULL)
+		return;
+
+	stack->step_count = frame->first_step;
+	pkgconf_pkg_traverse_log(stack, PKGCONF_CLOSURE_REPLAY, frame->pkg, closure, false);
+}
+
+
+static unsigned int
+pkgconf_pkg_traverse_main(pkgconf_client_t *client,
+	pkgconf_pkg_t *root,
+	pkgconf_pkg_traverse_func_t func,
+	void *data,
+	int maxdepth,
+	unsigned int skip_flags)
+{
+	pkgconf_traverse_stack_t stack = {.allocator = &client->allocator, .recording = true};
+	pkgconf_traverse_frame_t *frame;
+	unsigned int eflags;
+
+	if (!pkgconf_pkg_traverse_enter(client, &stack, root, func, data, maxdepth, &eflags))
 		return eflags;
 
-	if (client->flags & PKGCONF_PKG_PKGF_SEARCH_PRIVATE)
+	while (stack.count > 0)
 	{
-		PKGCONF_TRACE(client, "%s: walking requires.private list", root->id);
+		frame = &stack.frames[stack.count - 1];
+
+		if (frame->node != NULL)
+		{
+			unsigned int eflags_local = PKGCONF_PKG_ERRF_OK;
+			pkgconf_dependency_t *depnode = frame->node->data;
+			pkgconf_pkg_t *pkgdep;
+
+			if (*depnode->package == '\0')
+				goto next;
+
+			pkgdep = pkgconf_pkg_verify_dependency(client, depnode, &eflags_local);
+
+			frame->eflags |= eflags_local;
+			if (eflags_local != PKGCONF_PKG_ERRF_OK && !(client->flags & PKGCONF_PKG_PKGF_SKIP_ERRORS))
+			{
+				pkgconf_pkg_report_graph_error(client, frame->pkg, pkgdep, depnode, eflags_local);
+				goto next;
+			}
+			if (pkgdep == NULL)
+				goto next;
+
+			if (pkgdep->serial == client->serial)
+			{
+				pkgconf_pkg_traverse_log(&stack, PKGCONF_CLOSURE_HIT, pkgdep, NULL, false);
+
+				if (pkgdep->visit < frame->first_visit)
+					frame->first_visit = pkgdep->visit;
+
+				pkgdep->hits++;
+				pkgconf_pkg_unref(client, pkgdep);
+				goto next;
+			}
+
+			if (skip_flags && (depnode->flags & skip_flags) == skip_flags)
+			{
+				pkgconf_pkg_traverse_log(&stack, PKGCONF_CLOSURE_SKIP, pkgdep, NULL, false);
+				pkgconf_pkg_unref(client, pkgdep);
+				goto next;
+			}
+
+			pkgconf_audit_log_dependency(client, pkgdep, depnode);
+
+			pkgdep->hits++;
+			pkgdep->serial = client->serial;
+			pkgdep->visit = ++client->visits;
+
+			PKGCONF_STATS_COUNT(client, nodes_visited, 1);
+
+			pkgconf_pkg_traverse_log(&stack, PKGCONF_CLOSURE_VISIT, pkgdep, depnode, false);
+
+			if (pkgconf_pkg_traverse_replay(client, &stack, frame, pkgdep, func, data, skip_flags))
+			{
+				pkgconf_pkg_unref(client, pkgdep);
+				goto next;
+			}
+
+			if (pkgconf_pkg_traverse_enter(client, &stack, pkgdep, func, data, frame->depth - 1, &eflags))
+				continue;
+
+			if (frame->depth - 1 == 0)
+				frame->truncated = true;
+
+			frame->eflags |= eflags;
+			pkgconf_pkg_unref(client, pkgdep);
+next:
+			frame->node = frame->node->next;
+			continue;
+		}
 
-		/* XXX: ugly */
-		client->flags |= PKGCONF_PKG_PKGF_ITER_PKG_IS_PRIVATE;
-		eflags = pkgconf_pkg_walk_list(client, root, &root->requires_private, func, data, maxdepth, skip_flags);
-		client->flags &= ~PKGCONF_PKG_PKGF_ITER_PKG_IS_PRIVATE;
+		if (frame->stage == PKGCONF_TRAVERSE_REQUIRES && frame->eflags == PKGCONF_PKG_ERRF_OK &&
+		    (client->flags & PKGCONF_PKG_PKGF_SEARCH_PRIVATE))
+		{
+			PKGCONF_TRACE(client, "%s: walking requires.private list", frame->pkg->id);
+
+			/* XXX: ugly */
+			client->flags |= PKGCONF_PKG_PKGF_ITER_PKG_IS_PRIVATE;
+			frame->stage = PKGCONF_TRAVERSE_REQUIRES_PRIVATE;
+			frame->node = frame->pkg->requires_private.head;
+			continue;
+		}
+
+		if (frame->stage == PKGCONF_TRAVERSE_REQUIRES_PRIVATE)
+			client->flags &= ~PKGCONF_PKG_PKGF_ITER_PKG_IS_PRIVATE;
+
+		/* the package is done, return its result to the frame which descended into it */
+		eflags = frame->eflags;
+		stack.count--;
+
+		PKGCONF_TRACEEVENT_END(client, "pkgconf_pkg_traverse_main");
+
+		if (stack.count > 0)
+		{
+			pkgconf_traverse_frame_t *child = frame;
+
+			frame = &stack.frames[stack.count - 1];
+			frame->eflags |= eflags;
 
-		if (eflags != PKGCONF_PKG_ERRF_OK)
-			return eflags;
+			if (child->levels + 1 > frame->levels)
+				frame->levels = child->levels + 1;
+			if (child->first_visit < frame->first_visit)
+				frame->first_visit = child->first_visit;
+			frame->truncated |= child->truncated;
+
+			pkgconf_pkg_traverse_record(client, &stack, child, skip_flags);
+
+			pkgconf_pkg_unref(client, child->pkg);
+			frame->node = frame->node->next;
+		}
 	}
 
+	pkgconf_alloc_free(stack.allocator, PKGCONF_ALLOC_QUERY, stack.frames);
+	pkgconf_alloc_free(stack.allocator, PKGCONF_ALLOC_QUERY, stack.steps);
+
 	return eflags;
 }
 
+/*
+ * !doc
+ *
+ * .. c:function:: unsigned int pkgconf_pkg_traverse(pkgconf_client_t *client, pkgconf_pkg_t *root, pkgconf_pkg_traverse_func_t func, void *data, int maxdepth, unsigned int skip_flags)
+ *
+ *    Walk and resolve the dependency graph up to `maxdepth` levels.
+ *
+ *    The walks below packages are recorded, and replayed when a later traversal reaches the same
+ *    package with the same flags, see the `closure` module.
+ *
+ *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
+ *    :param pkgconf_pkg_t* root: The root of the dependency graph.
+ *    :param pkgconf_pkg_traverse_func_t func: A traversal function to call for each resolved node in the dependency graph.
+ *    :param void* data: An opaque pointer to data to be passed to the traversal function.
+ *    :param int maxdepth: The maximum depth to walk the dependency graph for.  -1 means infinite recursion.
+ *    :param uint skip_flags: Skip over dependency nodes containing the specified flags.  A setting of 0 skips no dependency nodes.
+ *    :return: ``PKGCONF_PKG_ERRF_OK`` on success, else an error code.
+ *    :rtype: unsigned int
+ */
 unsigned int
 pkgconf_pkg_traverse(pkgconf_client_t *client,
 	pkgconf_pkg_t *root,
@@ -1610,9 +2438,16 @@ pkgconf_pkg_traverse(pkgconf_client_t *client,
 	int maxdepth,
 	unsigned int skip_flags)
 {
+	pkgconf_stats_phase_t phase = PKGCONF_STATS_ENTER(client, PKGCONF_STATS_PHASE_TRAVERSE);
+	unsigned int eflags;
+
 	client->serial++;
 
-	return pkgconf_pkg_traverse_main(client, root, func, data, maxdepth, skip_flags);
+	eflags = pkgconf_pkg_traverse_main(client, root, func, data, maxdepth, skip_flags);
+
+	PKGCONF_STATS_LEAVE(client, phase);
+
+	return eflags;
 }
 
 static void
@@ -1621,6 +2456,8 @@ pkgconf_pkg_cflags_collect(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *d
 	pkgconf_list_t *list = data;
 	pkgconf_node_t *node;
 
+	pkgconf_pkg_materialize(client, pkg, PKGCONF_PKG_FIELDF_FRAGMENTS);
+
 	PKGCONF_FOREACH_LIST_ENTRY(pkg->cflags.head, node)
 	{
 		pkgconf_fragment_t *frag = node->data;
@@ -1634,6 +2471,8 @@ pkgconf_pkg_cflags_private_collect(pkgconf_client_t *client, pkgconf_pkg_t *pkg,
 	pkgconf_list_t *list = data;
 	pkgconf_node_t *node;
 
+	pkgconf_pkg_materialize(client, pkg, PKGCONF_PKG_FIELDF_FRAGMENTS);
+
 	PKGCONF_FOREACH_LIST_ENTRY(pkg->cflags_private.head, node)
 	{
 		pkgconf_fragment_t *frag = node->data;
@@ -1685,6 +2524,8 @@ pkgconf_pkg_libs_collect(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *dat
 	pkgconf_list_t *list = data;
 	pkgconf_node_t *node;
 
+	pkgconf_pkg_materialize(client, pkg, PKGCONF_PKG_FIELDF_FRAGMENTS);
+
 	PKGCONF_FOREACH_LIST_ENTRY(pkg->libs.head, node)
 	{
 		pkgconf_fragment_t *frag = node->data;
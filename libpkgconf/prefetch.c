@@ -0,0 +1,527 @@
+/*
+ * prefetch.c
+ * parallel parsing of .pc files
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/config.h>
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+/*
+ * !doc
+ *
+ * libpkgconf `prefetch` module
+ * ============================
+ *
+ * The libpkgconf `prefetch` module reads and tokenizes a list of `.pc` files on a pool of
+ * worker threads, so that scanning a large package directory is not bound to reading one
+ * file at a time.
+ *
+ * Workers only run the client independent part of ``pkgconf_parser_parse()``: they record
+ * the operands and warnings produced by the parser into structures of their own.  The
+ * operands are replayed into package objects on the calling thread, one file at a time and
+ * in the order the files were added, so the result is the same as parsing the files
+ * serially.
+ *
+ * The module is only available if libpkgconf was built with POSIX threads; otherwise
+ * ``pkgconf_prefetch_new()`` always fails and callers parse the files themselves.
+ */
+
+#ifdef HAVE_PTHREAD
+
+/* op is the parser operator character, or 0 for a warning whose message is stored in value */
+typedef struct prefetch_record_ {
+	struct prefetch_record_ *next;
+
+	char op;
+	size_t lineno;
+	char *key;
+	char *value;
+} prefetch_record_t;
+
+typedef struct {
+	char *path;
+
+	prefetch_record_t *records;
+	prefetch_record_t *last;
+
+	/* set by the worker which parsed the file, under the prefetch mutex */
+	bool done;
+	bool found;
+} prefetch_file_t;
+
+/* records are allocated from the arena of the worker which parsed the file */
+typedef struct {
+	pkgconf_prefetch_t *prefetch;
+	pthread_t thread;
+	pkgconf_arena_t arena;
+	bool running;
+} prefetch_worker_t;
+
+typedef struct {
+	prefetch_worker_t *worker;
+	prefetch_file_t *file;
+} prefetch_recorder_t;
+
+struct pkgconf_prefetch_ {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	prefetch_file_t *files;
+	size_t count;
+	size_t capacity;
+
+	/* the next file to hand out to a worker */
+	size_t next;
+	bool cancelled;
+
+	prefetch_worker_t *workers;
+	unsigned int threads;
+
+	/* file paths are allocated from this arena, before the workers are started */
+	pkgconf_arena_t arena;
+};
+
+static void
+prefetch_record(prefetch_recorder_t *recorder, char op, size_t lineno, const char *key, const char *value)
+{
+	prefetch_record_t *rec;
+
+	rec = pkgconf_arena_alloc(&recorder->worker->arena, sizeof(prefetch_record_t));
+	if (rec == NULL)
+		return;
+
+	rec->op = op;
+	rec->lineno = lineno;
+	rec->key = key != NULL ? pkgconf_arena_strdup(&recorder->worker->arena, key) : NULL;
+	rec->value = pkgconf_arena_strdup(&recorder->worker->arena, value);
+
+	if ((key != NULL && rec->key == NULL) || rec->value == NULL)
+		return;
+
+	if (recorder->file->last != NULL)
+		recorder->file->last->next = rec;
+	else
+		recorder->file->records = rec;
+
+	recorder->file->last = rec;
+}
+
+static void
+prefetch_record_keyword(void *data, const size_t lineno, const char *key, const char *value)
+{
+	prefetch_record(data, ':', lineno, key, value);
+}
+
+static void
+prefetch_record_value(void *data, const size_t lineno, const char *key, const char *value)
+{
+	prefetch_record(data, '=', lineno, key, value);
+}
+
+static void prefetch_record_warning(void *data, const char *fmt, ...) PRINTFLIKE(2, 3);
+
+static void
+prefetch_record_warning(void *data, const char *fmt, ...)
+{
+	char buf[PKGCONF_ITEM_SIZE];
+	va_list va;
+
+	va_start(va, fmt);
+	vsnprintf(buf, sizeof buf, fmt, va);
+	va_end(va);
+
+	prefetch_record(data, '\0', 0, NULL, buf);
+}
+
+/* only the keyword and variable operators of the .pc format are recorded, like the parse cache does */
+static const pkgconf_parser_operand_func_t prefetch_record_funcs[256] = {
+	[':'] = prefetch_record_keyword,
+	['='] = prefetch_record_value,
+};
+
+static void *
+prefetch_worker(void *data)
+{
+	prefetch_worker_t *worker = data;
+	pkgconf_prefetch_t *prefetch = worker->prefetch;
+
+	pthread_mutex_lock(&prefetch->mutex);
+
+	while (!prefetch->cancelled && prefetch->next < prefetch->count)
+	{
+		prefetch_file_t *file = &prefetch->files[prefetch->next++];
+		prefetch_recorder_t recorder = { worker, file };
+		FILE *f;
+
+		pthread_mutex_unlock(&prefetch->mutex);
+
+		if ((f = fopen(file->path, "r")) != NULL)
+			pkgconf_parser_parse(f, &recorder, prefetch_record_funcs, prefetch_record_warning, file->path);
+
+		pthread_mutex_lock(&prefetch->mutex);
+
+		file->found = f != NULL;
+		file->done = true;
+		pthread_cond_broadcast(&prefetch->cond);
+	}
+
+	pthread_mutex_unlock(&prefetch->mutex);
+
+	return NULL;
+}
+
+#endif
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_prefetch_t *pkgconf_prefetch_new(unsigned int threads)
+ *
+ *    Creates an empty list of files to be parsed by `threads` worker threads.
+ *
+ *    :param uint threads: The number of worker threads to use.
+ *    :return: the prefetch object, else ``NULL`` if fewer than two threads were requested or threads are not supported.
+ *    :rtype: pkgconf_prefetch_t *
+ */
+pkgconf_prefetch_t *
+pkgconf_prefetch_new(unsigned int threads)
+{
+#ifdef HAVE_PTHREAD
+	pkgconf_prefetch_t *prefetch;
+
+	if (threads < 2)
+		return NULL;
+
+	prefetch = calloc(1, sizeof(pkgconf_prefetch_t));
+	if (prefetch == NULL)
+		return NULL;
+
+	if (pthread_mutex_init(&prefetch->mutex, NULL) != 0)
+	{
+		free(prefetch);
+		return NULL;
+	}
+
+	if (pthread_cond_init(&prefetch->cond, NULL) != 0)
+	{
+		pthread_mutex_destroy(&prefetch->mutex);
+		free(prefetch);
+		return NULL;
+	}
+
+	prefetch->threads = threads;
+
+	return prefetch;
+#else
+	(void) threads;
+
+	return NULL;
+#endif
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_prefetch_add(pkgconf_prefetch_t *prefetch, const char *path)
+ *
+ *    Appends a file to the list of files to parse.  Files can only be added before
+ *    ``pkgconf_prefetch_start()`` is called.
+ *
+ *    :param pkgconf_prefetch_t* prefetch: The prefetch object to modify.
+ *    :param char* path: The path of the file.
+ *    :return: true if the file was added, else false.
+ *    :rtype: bool
+ */
+bool
+pkgconf_prefetch_add(pkgconf_prefetch_t *prefetch, const char *path)
+{
+#ifdef HAVE_PTHREAD
+	prefetch_file_t *files, *file;
+
+	if (prefetch->workers != NULL)
+		return false;
+
+	/* the array is only ever resized while no worker is running */
+	if (prefetch->count == prefetch->capacity)
+	{
+		size_t capacity = prefetch->capacity ? prefetch->capacity * 2 : 64;
+
+		files = pkgconf_reallocarray(prefetch->files, capacity, sizeof(prefetch_file_t));
+		if (files == NULL)
+			return false;
+
+		prefetch->files = files;
+		prefetch->capacity = capacity;
+	}
+
+	file = &prefetch->files[prefetch->count];
+	memset(file, 0, sizeof *file);
+
+	if ((file->path = pkgconf_arena_strdup(&prefetch->arena, path)) == NULL)
+		return false;
+
+	prefetch->count++;
+
+	return true;
+#else
+	(void) prefetch;
+	(void) path;
+
+	return false;
+#endif
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: size_t pkgconf_prefetch_count(const pkgconf_prefetch_t *prefetch)
+ *
+ *    Returns the number of files added to a prefetch object.
+ *
+ *    :param pkgconf_prefetch_t* prefetch: The prefetch object to query.
+ *    :return: the number of files
+ *    :rtype: size_t
+ */
+size_t
+pkgconf_prefetch_count(const pkgconf_prefetch_t *prefetch)
+{
+#ifdef HAVE_PTHREAD
+	return prefetch->count;
+#else
+	(void) prefetch;
+
+	return 0;
+#endif
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: const char *pkgconf_prefetch_path(const pkgconf_prefetch_t *prefetch, size_t index)
+ *
+ *    Returns the path of a file added to a prefetch object.
+ *
+ *    :param pkgconf_prefetch_t* prefetch: The prefetch object to query.
+ *    :param size_t index: The index of the file, in the order the files were added.
+ *    :return: the path of the file, else ``NULL``.
+ *    :rtype: const char *
+ */
+const char *
+pkgconf_prefetch_path(const pkgconf_prefetch_t *prefetch, size_t index)
+{
+#ifdef HAVE_PTHREAD
+	if (index >= prefetch->count)
+		return NULL;
+
+	return prefetch->files[index].path;
+#else
+	(void) prefetch;
+	(void) index;
+
+	return NULL;
+#endif
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_prefetch_start(pkgconf_prefetch_t *prefetch)
+ *
+ *    Starts the worker threads, which parse the files in the order they were added.  No more
+ *    worker threads than files are started.
+ *
+ *    :param pkgconf_prefetch_t* prefetch: The prefetch object to start.
+ *    :return: true if at least one worker thread was started, else false.
+ *    :rtype: bool
+ */
+bool
+pkgconf_prefetch_start(pkgconf_prefetch_t *prefetch)
+{
+#ifdef HAVE_PTHREAD
+	unsigned int threads = prefetch->threads, i;
+
+	if (prefetch->workers != NULL || prefetch->count == 0)
+		return false;
+
+	if (threads > prefetch->count)
+		threads = prefetch->count;
+
+	prefetch->workers = calloc(threads, sizeof(prefetch_worker_t));
+	if (prefetch->workers == NULL)
+		return false;
+
+	prefetch->threads = threads;
+
+	for (i = 0; i < threads; i++)
+	{
+		prefetch_worker_t *worker = &prefetch->workers[i];
+
+		worker->prefetch = prefetch;
+		worker->running = pthread_create(&worker->thread, NULL, prefetch_worker, worker) == 0;
+
+		if (!worker->running)
+			break;
+	}
+
+	if (i == 0)
+	{
+		free(prefetch->workers);
+		prefetch->workers = NULL;
+		return false;
+	}
+
+	return true;
+#else
+	(void) prefetch;
+
+	return false;
+#endif
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_prefetch_wait(pkgconf_prefetch_t *prefetch, size_t index)
+ *
+ *    Waits until a worker thread has parsed the file at `index` in the list.
+ *
+ *    :param pkgconf_prefetch_t* prefetch: The prefetch object to wait on.
+ *    :param size_t index: The index of the file, in the order the files were added.
+ *    :return: true if the file was parsed, false if it could not be opened.
+ *    :rtype: bool
+ */
+bool
+pkgconf_prefetch_wait(pkgconf_prefetch_t *prefetch, size_t index)
+{
+#ifdef HAVE_PTHREAD
+	prefetch_file_t *file;
+	bool found;
+
+	if (prefetch->workers == NULL || index >= prefetch->count)
+		return false;
+
+	file = &prefetch->files[index];
+
+	pthread_mutex_lock(&prefetch->mutex);
+
+	while (!file->done)
+		pthread_cond_wait(&prefetch->cond, &prefetch->mutex);
+
+	found = file->found;
+
+	pthread_mutex_unlock(&prefetch->mutex);
+
+	return found;
+#else
+	(void) prefetch;
+	(void) index;
+
+	return false;
+#endif
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_prefetch_replay(pkgconf_prefetch_t *prefetch, size_t index, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc)
+ *
+ *    Calls the operand and warning functions the way ``pkgconf_parser_parse()`` would have
+ *    called them while parsing the file at `index`.  The file must have been waited on with
+ *    ``pkgconf_prefetch_wait()``.
+ *
+ *    :param pkgconf_prefetch_t* prefetch: The prefetch object which parsed the file.
+ *    :param size_t index: The index of the file, in the order the files were added.
+ *    :param void* data: An opaque pointer passed to the operand and warning functions.
+ *    :param pkgconf_parser_operand_func_t* ops: The operand function table.
+ *    :param pkgconf_parser_warn_func_t warnfunc: The warning function.
+ *    :return: nothing
+ */
+void
+pkgconf_prefetch_replay(pkgconf_prefetch_t *prefetch, size_t index, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc)
+{
+#ifdef HAVE_PTHREAD
+	const prefetch_record_t *rec;
+
+	if (index >= prefetch->count)
+		return;
+
+	for (rec = prefetch->files[index].records; rec != NULL; rec = rec->next)
+	{
+		if (rec->op == '\0')
+			warnfunc(data, "%s", rec->value);
+		else if (ops[(unsigned char) rec->op] != NULL)
+			ops[(unsigned char) rec->op](data, rec->lineno, rec->key, rec->value);
+	}
+#else
+	(void) prefetch;
+	(void) index;
+	(void) data;
+	(void) ops;
+	(void) warnfunc;
+#endif
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_prefetch_free(pkgconf_prefetch_t *prefetch)
+ *
+ *    Stops the worker threads of a prefetch object, once they are done with the file they are
+ *    parsing, and releases it along with everything they parsed.
+ *
+ *    :param pkgconf_prefetch_t* prefetch: The prefetch object to release, or ``NULL``.
+ *    :return: nothing
+ */
+void
+pkgconf_prefetch_free(pkgconf_prefetch_t *prefetch)
+{
+#ifdef HAVE_PTHREAD
+	unsigned int i;
+
+	if (prefetch == NULL)
+		return;
+
+	pthread_mutex_lock(&prefetch->mutex);
+	prefetch->cancelled = true;
+	pthread_mutex_unlock(&prefetch->mutex);
+
+	if (prefetch->workers != NULL)
+	{
+		for (i = 0; i < prefetch->threads; i++)
+		{
+			prefetch_worker_t *worker = &prefetch->workers[i];
+
+			if (worker->running)
+				pthread_join(worker->thread, NULL);
+
+			pkgconf_arena_free(&worker->arena);
+		}
+
+		free(prefetch->workers);
+	}
+
+	pthread_cond_destroy(&prefetch->cond);
+	pthread_mutex_destroy(&prefetch->mutex);
+
+	pkgconf_arena_free(&prefetch->arena);
+	free(prefetch->files);
+	free(prefetch);
+#else
+	(void) prefetch;
+#endif
+}
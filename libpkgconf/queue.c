@@ -15,6 +15,7 @@
 
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
 
 /*
  * !doc
@@ -107,51 +108,144 @@ pkgconf_queue_free(pkgconf_list_t *list)
 	}
 }
 
+/*
+ * the lists of the world package refer to the dependency nodes of the packages collected into
+ * it, rather than to copies of them.  a dependency node can only be linked into the list of its
+ * own package, so the world lists are linked through list nodes of their own, which are carved
+ * out of blocks holding a reference on their dependency node.
+ */
+#define PKGCONF_QUEUE_NODE_BLOCK	256
+
+typedef struct pkgconf_queue_node_block_ pkgconf_queue_node_block_t;
+
+struct pkgconf_queue_node_block_ {
+	pkgconf_queue_node_block_t *next;
+	size_t count;
+	pkgconf_node_t nodes[PKGCONF_QUEUE_NODE_BLOCK];
+};
+
+typedef struct {
+	pkgconf_pkg_t *world;
+	pkgconf_queue_node_block_t *blocks;
+} pkgconf_queue_world_t;
+
 static void
-pkgconf_queue_collect_dependents(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *data)
+pkgconf_queue_world_link(pkgconf_client_t *client, pkgconf_queue_world_t *qw, pkgconf_dependency_t *dep, pkgconf_list_t *list)
 {
-	pkgconf_node_t *node;
-	pkgconf_pkg_t *world = data;
+	pkgconf_queue_node_block_t *block = qw->blocks;
+	pkgconf_dependency_t *copy;
 
-	if (pkg == world)
-		return;
-
-	PKGCONF_FOREACH_LIST_ENTRY(pkg->required.head, node)
+	if (block == NULL || block->count == PKGCONF_QUEUE_NODE_BLOCK)
 	{
-		pkgconf_dependency_t *flattened_dep;
+		block = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_QUERY, sizeof(pkgconf_queue_node_block_t));
+		if (block == NULL)
+			goto copy;
+
+		block->next = qw->blocks;
+		qw->blocks = block;
+	}
+
+	/* dependency nodes of another client can not be shared */
+	if (pkgconf_dependency_ref(client, dep) == NULL)
+		goto copy;
 
-		flattened_dep = pkgconf_dependency_copy(client, node->data);
+	pkgconf_node_insert(&block->nodes[block->count++], dep, list);
+	return;
+
+copy:
+	copy = pkgconf_dependency_copy(client, dep);
+	pkgconf_node_insert(&copy->iter, copy, list);
+}
 
-		pkgconf_node_insert(&flattened_dep->iter, flattened_dep, &world->required);
+/* the dependency nodes owned by the world package are released along with it */
+static void
+pkgconf_queue_world_unlink(pkgconf_list_t *list)
+{
+	pkgconf_node_t *node, *next;
+
+	PKGCONF_FOREACH_LIST_ENTRY_SAFE(list->head, next, node)
+	{
+		pkgconf_dependency_t *dep = node->data;
+
+		if (node != &dep->iter)
+			pkgconf_node_delete(node, list);
 	}
+}
 
-	PKGCONF_FOREACH_LIST_ENTRY(pkg->requires_private.head, node)
+static void
+pkgconf_queue_world_release(pkgconf_client_t *client, pkgconf_queue_world_t *qw)
+{
+	pkgconf_queue_node_block_t *block, *next;
+	size_t i;
+
+	pkgconf_queue_world_unlink(&qw->world->required);
+	pkgconf_queue_world_unlink(&qw->world->requires_private);
+
+	for (block = qw->blocks; block != NULL; block = next)
 	{
-		pkgconf_dependency_t *flattened_dep;
+		next = block->next;
 
-		flattened_dep = pkgconf_dependency_copy(client, node->data);
+		for (i = 0; i < block->count; i++)
+			pkgconf_dependency_unref(client, block->nodes[i].data);
 
-		pkgconf_node_insert(&flattened_dep->iter, flattened_dep, &world->requires_private);
+		pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_QUERY, block);
 	}
+
+	qw->blocks = NULL;
 }
 
+static void
+pkgconf_queue_collect_dependents(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *data)
+{
+	pkgconf_node_t *node;
+	pkgconf_queue_world_t *qw = data;
+
+	if (pkg == qw->world)
+		return;
+
+	PKGCONF_FOREACH_LIST_ENTRY(pkg->required.head, node)
+		pkgconf_queue_world_link(client, qw, node->data, &qw->world->required);
+
+	PKGCONF_FOREACH_LIST_ENTRY(pkg->requires_private.head, node)
+		pkgconf_queue_world_link(client, qw, node->data, &qw->world->requires_private);
+}
+
+/* ties keep the order the dependencies were collected in */
+typedef struct {
+	pkgconf_node_t *node;
+	pkgconf_dependency_t *dep;
+	size_t index;
+} pkgconf_queue_slot_t;
+
 static int
 dep_sort_cmp(const void *a, const void *b)
 {
-	const pkgconf_dependency_t *depA = *(void **) a;
-	const pkgconf_dependency_t *depB = *(void **) b;
+	const pkgconf_queue_slot_t *slotA = a;
+	const pkgconf_queue_slot_t *slotB = b;
 
-	return depB->match->hits - depA->match->hits;
+	if (slotA->dep->match->hits != slotB->dep->match->hits)
+		return slotA->dep->match->hits < slotB->dep->match->hits ? 1 : -1;
+
+	return slotA->index < slotB->index ? -1 : slotA->index > slotB->index;
 }
 
-static inline void
+/* the list is left as it was if it can not be flattened */
+static inline bool
 flatten_dependency_set(pkgconf_client_t *client, pkgconf_list_t *list)
 {
-	pkgconf_node_t *node;
-	pkgconf_dependency_t **deps = NULL;
+	pkgconf_node_t *node, *next;
+	pkgconf_queue_slot_t *deps;
+	pkgconf_hash_t seen;
 	size_t dep_count = 0, i;
 
-	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
+	/* the flattened set can not be larger than the list */
+	deps = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_QUERY, (list->length ? list->length : 1) * sizeof(pkgconf_queue_slot_t));
+	if (deps == NULL)
+		return false;
+
+	pkgconf_hash_init(&seen, &client->allocator, PKGCONF_ALLOC_QUERY);
+
+	PKGCONF_FOREACH_LIST_ENTRY_SAFE(list->head, next, node)
 	{
 		pkgconf_dependency_t *dep = node->data;
 		pkgconf_pkg_t *pkg = pkgconf_pkg_verify_dependency(client, dep, NULL);
@@ -168,76 +262,79 @@ flatten_dependency_set(pkgconf_client_t *client, pkgconf_list_t *list)
 			abort();
 		}
 
-		/* for virtuals, we need to check to see if there are dupes */
-		for (i = 0; i < dep_count; i++)
+		/* for virtuals, we need to check to see if there are dupes.
+		 * package names are interned, so the name pointer identifies the package name.
+		 */
+		if (pkgconf_hash_lookup(&seen, (const char *) &dep->package, sizeof dep->package) != NULL)
 		{
-			pkgconf_dependency_t *other_dep = deps[i];
-
-			PKGCONF_TRACE(client, "dedup %s = %s?", dep->package, other_dep->package);
-
-			if (!strcmp(dep->package, other_dep->package))
-			{
-				PKGCONF_TRACE(client, "skipping, %zu deps", dep_count);
-				goto next;
-			}
+			PKGCONF_TRACE(client, "skipping %s, %zu deps", dep->package, dep_count);
+			continue;
 		}
 
+		pkgconf_hash_insert(&seen, (const char *) &dep->package, sizeof dep->package, dep);
+
 		pkg->serial = client->serial;
 
 		/* copy to the deps table */
+		deps[dep_count].node = node;
+		deps[dep_count].dep = dep;
+		deps[dep_count].index = dep_count;
 		dep_count++;
-		deps = pkgconf_reallocarray(deps, dep_count, sizeof (void *));
-		deps[dep_count - 1] = dep;
 
 		PKGCONF_TRACE(client, "added %s to dep table", dep->package);
-
-next:;
 	}
 
-	qsort(deps, dep_count, sizeof (void *), dep_sort_cmp);
+	pkgconf_hash_free(&seen);
 
-	/* zero the list and start readding */
+	qsort(deps, dep_count, sizeof(pkgconf_queue_slot_t), dep_sort_cmp);
+
+	/* zero the list and start readding, only the list nodes are moved around */
 	pkgconf_list_zero(list);
 
 	for (i = 0; i < dep_count; i++)
 	{
-		pkgconf_dependency_t *dep = deps[i];
+		pkgconf_dependency_t *dep = deps[i].dep;
 
-		memset(&dep->iter, '\0', sizeof (dep->iter));
-		pkgconf_node_insert(&dep->iter, dep, list);
+		memset(deps[i].node, '\0', sizeof (pkgconf_node_t));
+		pkgconf_node_insert(deps[i].node, dep, list);
 
 		PKGCONF_TRACE(client, "slot %zu: dep %s matched to %p<%s> hits %lu", i, dep->package, dep->match, dep->match == NULL ? "NULL" : dep->match->id, dep->match->hits);
 	}
 
-	free(deps);
+	pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_QUERY, deps);
+
+	return true;
 }
 
 static inline unsigned int
-pkgconf_queue_verify(pkgconf_client_t *client, pkgconf_pkg_t *world, pkgconf_list_t *list, int maxdepth)
+pkgconf_queue_verify(pkgconf_client_t *client, pkgconf_queue_world_t *qw, pkgconf_list_t *list, int maxdepth)
 {
+	pkgconf_pkg_t *world = qw->world;
 	unsigned int result;
 
 	if (!pkgconf_queue_compile(client, world, list))
 		return PKGCONF_PKG_ERRF_DEPGRAPH_BREAK;
 
 	/* collect all the dependencies */
-	result = pkgconf_pkg_traverse(client, world, pkgconf_queue_collect_dependents, world, maxdepth, 0);
+	result = pkgconf_pkg_traverse(client, world, pkgconf_queue_collect_dependents, qw, maxdepth, 0);
 	if (result != PKGCONF_PKG_ERRF_OK)
 		return result;
 
 	/* flatten the dependency set using serials.
-	 * we copy the dependencies to a vector, and then erase the list.
-	 * then we copy them back to the list.
+	 * we copy the list nodes to a vector, and then erase the list.
+	 * then we link them back into the list.
 	 */
 	++client->serial;
 
 	PKGCONF_TRACE(client, "flattening requires deps");
-	flatten_dependency_set(client, &world->required);
+	if (!flatten_dependency_set(client, &world->required))
+		return PKGCONF_PKG_ERRF_DEPGRAPH_BREAK;
 
 	++client->serial;
 
 	PKGCONF_TRACE(client, "flattening requires.private deps");
-	flatten_dependency_set(client, &world->requires_private);
+	if (!flatten_dependency_set(client, &world->requires_private))
+		return PKGCONF_PKG_ERRF_DEPGRAPH_BREAK;
 
 	return PKGCONF_PKG_ERRF_OK;
 }
@@ -266,21 +363,30 @@ pkgconf_queue_apply(pkgconf_client_t *client, pkgconf_list_t *list, pkgconf_queu
 		.realname = "virtual world package",
 		.flags = PKGCONF_PKG_PROPF_STATIC | PKGCONF_PKG_PROPF_VIRTUAL,
 	};
+	pkgconf_queue_world_t qw = {
+		.world = &world,
+	};
 
 	/* if maxdepth is one, then we will not traverse deeper than our virtual package. */
 	if (!maxdepth)
 		maxdepth = -1;
 
-	if (pkgconf_queue_verify(client, &world, list, maxdepth) != PKGCONF_PKG_ERRF_OK)
+	if (pkgconf_queue_verify(client, &qw, list, maxdepth) != PKGCONF_PKG_ERRF_OK)
+	{
+		pkgconf_queue_world_release(client, &qw);
+		pkgconf_pkg_free(client, &world);
 		return false;
+	}
 
 	/* the world dependency set is flattened after it is returned from pkgconf_queue_verify */
 	if (!func(client, &world, data, maxdepth))
 	{
+		pkgconf_queue_world_release(client, &qw);
 		pkgconf_pkg_free(client, &world);
 		return false;
 	}
 
+	pkgconf_queue_world_release(client, &qw);
 	pkgconf_pkg_free(client, &world);
 
 	return true;
@@ -308,14 +414,18 @@ pkgconf_queue_validate(pkgconf_client_t *client, pkgconf_list_t *list, int maxde
 		.realname = "virtual world package",
 		.flags = PKGCONF_PKG_PROPF_STATIC | PKGCONF_PKG_PROPF_VIRTUAL,
 	};
+	pkgconf_queue_world_t qw = {
+		.world = &world,
+	};
 
 	/* if maxdepth is one, then we will not traverse deeper than our virtual package. */
 	if (!maxdepth)
 		maxdepth = -1;
 
-	if (pkgconf_queue_verify(client, &world, list, maxdepth) != PKGCONF_PKG_ERRF_OK)
+	if (pkgconf_queue_verify(client, &qw, list, maxdepth) != PKGCONF_PKG_ERRF_OK)
 		retval = false;
 
+	pkgconf_queue_world_release(client, &qw);
 	pkgconf_pkg_free(client, &world);
 
 	return retval;
@@ -0,0 +1,168 @@
+/*
+ * stats.c
+ * phase timing and counters
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
+
+/*
+ * !doc
+ *
+ * libpkgconf `stats` module
+ * =========================
+ *
+ * The libpkgconf `stats` module measures where a client spends its time, and counts the work
+ * it does along the way, such as the files it opens and the dependency nodes it visits.
+ *
+ * Statistics are only collected while a ``pkgconf_stats_t`` object is attached to a client with
+ * ``pkgconf_client_set_stats()``.  Otherwise, every point of measurement costs a single test.
+ *
+ * The time of a client is split into `phases`, which nest: a .pc file is parsed while searching
+ * for a package, which may happen while traversing the dependency graph.  Time is accounted to
+ * the innermost phase only, so the times of all phases add up to the time the statistics were
+ * collected over.  Time spent outside of any phase, such as in the caller, is accounted to
+ * ``PKGCONF_STATS_PHASE_OTHER``.
+ */
+
+static const char *stats_phase_names[PKGCONF_STATS_PHASE_COUNT] = {
+	[PKGCONF_STATS_PHASE_OTHER] = "other",
+	[PKGCONF_STATS_PHASE_INIT] = "init",
+	[PKGCONF_STATS_PHASE_SEARCH] = "search",
+	[PKGCONF_STATS_PHASE_OPEN] = "open",
+	[PKGCONF_STATS_PHASE_PARSE] = "parse",
+	[PKGCONF_STATS_PHASE_EXPAND] = "expand",
+	[PKGCONF_STATS_PHASE_TRAVERSE] = "traverse",
+	[PKGCONF_STATS_PHASE_RENDER] = "render",
+};
+
+/*
+ * !doc
+ *
+ * .. c:function:: uint64_t pkgconf_stats_clock(void)
+ *
+ *    Reads the monotonic clock used to time phases.
+ *
+ *    :return: the time elapsed since an unspecified starting point, in nanoseconds.
+ *    :rtype: uint64_t
+ */
+uint64_t
+pkgconf_stats_clock(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+
+	return (uint64_t) (count.QuadPart / freq.QuadPart) * 1000000000 +
+		(uint64_t) (count.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: const char *pkgconf_stats_phase_name(pkgconf_stats_phase_t phase)
+ *
+ *    Returns a short, human-readable name for a phase.
+ *
+ *    :param pkgconf_stats_phase_t phase: The phase to name.
+ *    :return: the name of the phase, or ``"unknown"``.
+ *    :rtype: const char *
+ */
+const char *
+pkgconf_stats_phase_name(pkgconf_stats_phase_t phase)
+{
+	if ((unsigned int) phase >= PKGCONF_STATS_PHASE_COUNT)
+		return "unknown";
+
+	return stats_phase_names[phase];
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_stats_reset(pkgconf_stats_t *stats)
+ *
+ *    Clears the times and counters of a statistics object, and starts timing the
+ *    ``PKGCONF_STATS_PHASE_OTHER`` phase.
+ *
+ *    :param pkgconf_stats_t* stats: The statistics object to reset.
+ *    :return: nothing
+ */
+void
+pkgconf_stats_reset(pkgconf_stats_t *stats)
+{
+	memset(stats, 0, sizeof *stats);
+
+	stats->phase = PKGCONF_STATS_PHASE_OTHER;
+	stats->mark = pkgconf_stats_clock();
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_stats_phase_t pkgconf_stats_enter(pkgconf_stats_t *stats, pkgconf_stats_phase_t phase)
+ *
+ *    Accounts the time elapsed so far to the phase in progress, and starts timing `phase`.
+ *    Use the ``PKGCONF_STATS_ENTER()`` macro to only do so while statistics are collected.
+ *
+ *    :param pkgconf_stats_t* stats: The statistics object to update.
+ *    :param pkgconf_stats_phase_t phase: The phase being entered.
+ *    :return: the phase which was in progress, to be passed to ``pkgconf_stats_leave()``.
+ *    :rtype: pkgconf_stats_phase_t
+ */
+pkgconf_stats_phase_t
+pkgconf_stats_enter(pkgconf_stats_t *stats, pkgconf_stats_phase_t phase)
+{
+	pkgconf_stats_phase_t prev = stats->phase;
+	uint64_t now;
+
+	/* phases which recurse into themselves do not need to read the clock */
+	if (phase == prev)
+		return prev;
+
+	now = pkgconf_stats_clock();
+
+	stats->phase_nsec[prev] += now - stats->mark;
+	stats->mark = now;
+	stats->phase = phase;
+
+	return prev;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_stats_leave(pkgconf_stats_t *stats, pkgconf_stats_phase_t phase)
+ *
+ *    Accounts the time elapsed so far to the phase in progress, and resumes timing `phase`.
+ *    Use the ``PKGCONF_STATS_LEAVE()`` macro to only do so while statistics are collected.
+ *
+ *    :param pkgconf_stats_t* stats: The statistics object to update.
+ *    :param pkgconf_stats_phase_t phase: The phase returned by the matching ``pkgconf_stats_enter()``.
+ *    :return: nothing
+ */
+void
+pkgconf_stats_leave(pkgconf_stats_t *stats, pkgconf_stats_phase_t phase)
+{
+	(void) pkgconf_stats_enter(stats, phase);
+}
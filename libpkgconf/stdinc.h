@@ -25,6 +25,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <stdint.h>
+#include <time.h>
 
 #ifdef _WIN32
 # define WIN32_LEAN_AND_MEAN
@@ -0,0 +1,171 @@
+/*
+ * traceevent.c
+ * trace-event export of the spans of a client
+ *
+ * Copyright (c) 2022 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+
+/*
+ * !doc
+ *
+ * libpkgconf `traceevent` module
+ * ==============================
+ *
+ * The libpkgconf `traceevent` module writes the time spans of the work done by a client, such as
+ * searching for a package, parsing a .pc file or entering a node of the dependency graph, as a
+ * JSON array of trace events.  The output is in the Trace Event Format used by ``chrome://tracing``
+ * and can be loaded as is into trace viewers such as Perfetto.
+ *
+ * Spans are only written while a trace-event sink is attached to a client with
+ * ``pkgconf_traceevent_open()``.  Otherwise, every span costs a single test.  Spans nest, and
+ * their timestamps are taken from ``pkgconf_stats_clock()`` relative to when the sink was attached.
+ */
+
+static void
+traceevent_write_string(FILE *out, const char *str)
+{
+	const unsigned char *p;
+
+	fputc('"', out);
+
+	for (p = (const unsigned char *) str; *p != '\0'; p++)
+	{
+		if (*p == '"' || *p == '\\')
+			fprintf(out, "\\%c", *p);
+		else if (*p < 0x20)
+			fprintf(out, "\\u%04x", *p);
+		else
+			fputc(*p, out);
+	}
+
+	fputc('"', out);
+}
+
+static void
+traceevent_write(pkgconf_traceevent_sink_t *sink, const char *name, char phase, const char *key, const char *value)
+{
+	uint64_t nsec = pkgconf_stats_clock() - sink->epoch;
+
+	fprintf(sink->out, "%s\n{\"name\":", sink->count++ ? "," : "");
+	traceevent_write_string(sink->out, name);
+	fprintf(sink->out, ",\"cat\":\"pkgconf\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":1",
+		phase, (unsigned long long) (nsec / 1000), (unsigned int) (nsec % 1000));
+
+	if (key != NULL && value != NULL)
+	{
+		fprintf(sink->out, ",\"args\":{");
+		traceevent_write_string(sink->out, key);
+		fputc(':', sink->out);
+		traceevent_write_string(sink->out, value);
+		fputc('}', sink->out);
+	}
+
+	fputc('}', sink->out);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_traceevent_open(pkgconf_client_t *client, FILE *out)
+ *
+ *    Attaches a trace-event sink writing to `out` to a client, replacing any sink attached before.
+ *    The file is not closed by the sink, and must remain open until the sink is closed.
+ *
+ *    :param pkgconf_client_t* client: The client object to attach the sink to.
+ *    :param FILE* out: The already open file to write the trace events to.
+ *    :return: true if the sink was attached, else false.
+ *    :rtype: bool
+ */
+bool
+pkgconf_traceevent_open(pkgconf_client_t *client, FILE *out)
+{
+	pkgconf_traceevent_sink_t *sink;
+
+	pkgconf_traceevent_close(client);
+
+	sink = calloc(1, sizeof(pkgconf_traceevent_sink_t));
+	if (sink == NULL)
+		return false;
+
+	sink->out = out;
+	sink->epoch = pkgconf_stats_clock();
+
+	fputc('[', out);
+
+	client->traceevents = sink;
+
+	return true;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_traceevent_close(pkgconf_client_t *client)
+ *
+ *    Terminates the array of trace events written by the sink attached to a client, if any, and
+ *    detaches the sink.  ``pkgconf_client_deinit()`` closes the sink of the client as well.
+ *
+ *    :param pkgconf_client_t* client: The client object to detach the sink from.
+ *    :return: nothing
+ */
+void
+pkgconf_traceevent_close(pkgconf_client_t *client)
+{
+	pkgconf_traceevent_sink_t *sink = client->traceevents;
+
+	if (sink == NULL)
+		return;
+
+	fprintf(sink->out, "\n]\n");
+	fflush(sink->out);
+
+	free(sink);
+	client->traceevents = NULL;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_traceevent_begin(const pkgconf_client_t *client, const char *name, const char *key, const char *value)
+ *
+ *    Begins a span.  Use the ``PKGCONF_TRACEEVENT_BEGIN()`` macro to only do so while a sink is attached.
+ *
+ *    :param pkgconf_client_t* client: The client object the span belongs to.
+ *    :param char* name: The name of the span.
+ *    :param char* key: The name of an argument to show along with the span, or ``NULL``.
+ *    :param char* value: The value of the argument, or ``NULL``.
+ *    :return: nothing
+ */
+void
+pkgconf_traceevent_begin(const pkgconf_client_t *client, const char *name, const char *key, const char *value)
+{
+	traceevent_write(client->traceevents, name, 'B', key, value);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_traceevent_end(const pkgconf_client_t *client, const char *name)
+ *
+ *    Ends the span begun last.  Use the ``PKGCONF_TRACEEVENT_END()`` macro to only do so while a sink is attached.
+ *
+ *    :param pkgconf_client_t* client: The client object the span belongs to.
+ *    :param char* name: The name of the span.
+ *    :return: nothing
+ */
+void
+pkgconf_traceevent_end(const pkgconf_client_t *client, const char *name)
+{
+	traceevent_write(client->traceevents, name, 'E', NULL, NULL);
+}
@@ -15,6 +15,7 @@
 
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
 
 /*
  * !doc
@@ -23,13 +24,99 @@
  * =========================
  *
  * The `tuple` module provides key-value mappings backed by a linked list.  The key-value
- * mapping is mainly used for variable substitution when parsing .pc files.
+ * mapping is mainly used for variable substitution when parsing .pc files.  Lists which
+ * define more than a few variables are also indexed by a hash table, so that lookups do
+ * not depend on the number of variables; the list itself keeps the definition order.
+ * When a variable is referenced, its expansion is remembered until a variable in the same
+ * list, or a global variable, is defined or deleted.
  *
  * There are two sets of mappings: a ``pkgconf_pkg_t`` specific mapping, and a `global` mapping.
  * The `tuple` module provides convenience wrappers for managing the `global` mapping, which is
  * attached to a given client object.
  */
 
+/* lists shorter than this are searched linearly */
+#define PKGCONF_TUPLE_INDEX_MIN	8
+
+typedef struct {
+	/* key -> tuple, filled once the list reaches PKGCONF_TUPLE_INDEX_MIN entries */
+	pkgconf_hash_t table;
+
+	/* bumped whenever a variable in the list is defined or deleted */
+	unsigned int serial;
+} pkgconf_tuple_index_t;
+
+/* a variable whose expansion is in progress, used to detect circular references */
+typedef struct pkgconf_tuple_expansion_ {
+	struct pkgconf_tuple_expansion_ *parent;
+	const pkgconf_tuple_t *tuple;
+	bool cyclic;
+} pkgconf_tuple_expansion_t;
+
+static char *tuple_parse(const pkgconf_client_t *client, const pkgconf_allocator_t *allocator, pkgconf_list_t *vars, const char *value, unsigned int flags, pkgconf_tuple_expansion_t *chain);
+
+/* the table is only trusted while it describes every entry of the list */
+static inline pkgconf_hash_t *
+tuple_index(const pkgconf_list_t *list)
+{
+	pkgconf_tuple_index_t *idx = list->index;
+
+	if (idx != NULL && idx->table.count == list->length)
+		return &idx->table;
+
+	return NULL;
+}
+
+static void
+tuple_index_free(pkgconf_list_t *list)
+{
+	pkgconf_tuple_index_t *idx = list->index;
+
+	if (idx == NULL)
+		return;
+
+	/* the table keeps the allocator the index was obtained from */
+	pkgconf_hash_free(&idx->table);
+	pkgconf_alloc_free(idx->table.allocator, PKGCONF_ALLOC_TUPLE, idx);
+
+	list->index = NULL;
+}
+
+static void
+tuple_index_rebuild(pkgconf_tuple_index_t *idx, const pkgconf_list_t *list)
+{
+	pkgconf_node_t *node;
+
+	pkgconf_hash_free(&idx->table);
+
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
+	{
+		pkgconf_tuple_t *tuple = node->data;
+
+		pkgconf_hash_insert(&idx->table, tuple->key, strlen(tuple->key), tuple);
+	}
+}
+
+static pkgconf_tuple_t *
+tuple_lookup(const pkgconf_list_t *list, const char *key)
+{
+	pkgconf_hash_t *idx = tuple_index(list);
+	pkgconf_node_t *node;
+
+	if (idx != NULL)
+		return pkgconf_hash_lookup(idx, key, strlen(key));
+
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
+	{
+		pkgconf_tuple_t *tuple = node->data;
+
+		if (!strcmp(tuple->key, key))
+			return tuple;
+	}
+
+	return NULL;
+}
+
 /*
  * !doc
  *
@@ -46,6 +133,8 @@ void
 pkgconf_tuple_add_global(pkgconf_client_t *client, const char *key, const char *value)
 {
 	pkgconf_tuple_add(client, &client->global_vars, key, value, false, 0);
+	/* Provides versions may be written in terms of global variables */
+	pkgconf_pkg_provides_index_free(client);
 }
 
 /*
@@ -63,17 +152,9 @@ pkgconf_tuple_add_global(pkgconf_client_t *client, const char *key, const char *
 char *
 pkgconf_tuple_find_global(const pkgconf_client_t *client, const char *key)
 {
-	pkgconf_node_t *node;
-
-	PKGCONF_FOREACH_LIST_ENTRY(client->global_vars.head, node)
-	{
-		pkgconf_tuple_t *tuple = node->data;
+	pkgconf_tuple_t *tuple = tuple_lookup(&client->global_vars, key);
 
-		if (!strcmp(tuple->key, key))
-			return tuple->value;
-	}
-
-	return NULL;
+	return tuple != NULL ? tuple->value : NULL;
 }
 
 /*
@@ -90,6 +171,8 @@ void
 pkgconf_tuple_free_global(pkgconf_client_t *client)
 {
 	pkgconf_tuple_free(&client->global_vars);
+	/* Provides versions may be written in terms of global variables */
+	pkgconf_pkg_provides_index_free(client);
 }
 
 /*
@@ -106,9 +189,12 @@ pkgconf_tuple_free_global(pkgconf_client_t *client)
 void
 pkgconf_tuple_define_global(pkgconf_client_t *client, const char *kv)
 {
-	char *workbuf = strdup(kv);
+	char *workbuf = pkgconf_alloc_strdup(&client->allocator, PKGCONF_ALLOC_TUPLE, kv);
 	char *value;
 
+	if (workbuf == NULL)
+		return;
+
 	value = strchr(workbuf, '=');
 	if (value == NULL)
 		goto out;
@@ -116,30 +202,22 @@ pkgconf_tuple_define_global(pkgconf_client_t *client, const char *kv)
 	*value++ = '\0';
 	pkgconf_tuple_add_global(client, workbuf, value);
 out:
-	free(workbuf);
+	pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_TUPLE, workbuf);
 }
 
 static void
 pkgconf_tuple_find_delete(pkgconf_list_t *list, const char *key)
 {
-	pkgconf_node_t *node, *next;
+	pkgconf_tuple_t *tuple = tuple_lookup(list, key);
 
-	PKGCONF_FOREACH_LIST_ENTRY_SAFE(list->head, next, node)
-	{
-		pkgconf_tuple_t *tuple = node->data;
-
-		if (!strcmp(tuple->key, key))
-		{
-			pkgconf_tuple_free_entry(tuple, list);
-			return;
-		}
-	}
+	if (tuple != NULL)
+		pkgconf_tuple_free_entry(tuple, list);
 }
 
 static char *
-dequote(const char *value)
+dequote(const pkgconf_client_t *client, const char *value)
 {
-	char *buf = calloc((strlen(value) + 1) * 2, 1);
+	char *buf = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_TUPLE, (strlen(value) + 1) * 2);
 	char *bptr = buf;
 	const char *i;
 	char quote = 0;
@@ -200,6 +278,24 @@ should_rewrite_sysroot(const pkgconf_client_t *client, pkgconf_list_t *vars, con
 	return true;
 }
 
+static inline void *
+tuple_alloc(const pkgconf_client_t *client, pkgconf_arena_t *arena, size_t size)
+{
+	if (arena != NULL)
+		return pkgconf_arena_alloc(arena, size);
+
+	return pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_TUPLE, size);
+}
+
+static inline char *
+tuple_strdup(const pkgconf_client_t *client, pkgconf_arena_t *arena, const char *str)
+{
+	if (arena != NULL)
+		return pkgconf_arena_strdup(arena, str);
+
+	return pkgconf_alloc_strdup(&client->allocator, PKGCONF_ALLOC_TUPLE, str);
+}
+
 /*
  * !doc
  *
@@ -219,23 +315,49 @@ pkgconf_tuple_t *
 pkgconf_tuple_add(const pkgconf_client_t *client, pkgconf_list_t *list, const char *key, const char *value, bool parse, unsigned int flags)
 {
 	char *dequote_value;
-	pkgconf_tuple_t *tuple = calloc(sizeof(pkgconf_tuple_t), 1);
+	pkgconf_tuple_index_t *idx;
+	pkgconf_tuple_t *tuple;
+	/* global variables outlive any query, so they never come from an arena */
+	pkgconf_arena_t *arena = list != &client->global_vars ? client->arena : NULL;
 
 	pkgconf_tuple_find_delete(list, key);
 
-	dequote_value = dequote(value);
+	dequote_value = dequote(client, value);
 
-	tuple->key = strdup(key);
+	tuple = tuple_alloc(client, arena, sizeof(pkgconf_tuple_t));
+	tuple->arena_owned = arena != NULL;
+	tuple->owner = client;
+	tuple->key = tuple_strdup(client, arena, key);
 	if (parse)
-		tuple->value = pkgconf_tuple_parse(client, list, dequote_value, flags);
+	{
+		char *parsed = pkgconf_tuple_parse_alloc(client, list, dequote_value, flags);
+
+		tuple->value = tuple_strdup(client, arena, parsed);
+		pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_TUPLE, parsed);
+	}
 	else
-		tuple->value = strdup(dequote_value);
+		tuple->value = tuple_strdup(client, arena, dequote_value);
 
 	PKGCONF_TRACE(client, "adding tuple to @%p: %s => %s (parsed? %d)", list, key, tuple->value, parse);
 
 	pkgconf_node_insert(&tuple->iter, tuple, list);
 
-	free(dequote_value);
+	if (list->index == NULL)
+	{
+		idx = pkgconf_alloc(&client->allocator, PKGCONF_ALLOC_TUPLE, sizeof(pkgconf_tuple_index_t));
+		pkgconf_hash_init(&idx->table, &client->allocator, PKGCONF_ALLOC_TUPLE);
+		list->index = idx;
+	}
+
+	idx = list->index;
+	idx->serial++;
+
+	if (idx->table.count > 0 && idx->table.count + 1 == list->length)
+		pkgconf_hash_insert(&idx->table, tuple->key, strlen(tuple->key), tuple);
+	else if (list->length >= PKGCONF_TUPLE_INDEX_MIN)
+		tuple_index_rebuild(idx, list);
+
+	pkgconf_alloc_free(&client->allocator, PKGCONF_ALLOC_TUPLE, dequote_value);
 
 	return tuple;
 }
@@ -256,19 +378,32 @@ pkgconf_tuple_add(const pkgconf_client_t *client, pkgconf_list_t *list, const ch
 char *
 pkgconf_tuple_find(const pkgconf_client_t *client, pkgconf_list_t *list, const char *key)
 {
-	pkgconf_node_t *node;
+	pkgconf_tuple_t *tuple = tuple_lookup(list, key);
 
-	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
-	{
-		pkgconf_tuple_t *tuple = node->data;
+	PKGCONF_STATS_COUNT(client, tuple_lookups, 1);
 
-		if (!strcmp(tuple->key, key))
-			return tuple->value;
-	}
+	if (tuple != NULL)
+		return tuple->value;
 
 	return pkgconf_tuple_find_global(client, key);
 }
 
+static char *
+tuple_parse_traced(const pkgconf_client_t *client, const pkgconf_allocator_t *allocator, pkgconf_list_t *vars, const char *value, unsigned int flags)
+{
+	pkgconf_stats_phase_t phase = PKGCONF_STATS_ENTER(client, PKGCONF_STATS_PHASE_EXPAND);
+	char *ret;
+
+	PKGCONF_TRACEEVENT_BEGIN(client, "pkgconf_tuple_parse", "value", value);
+
+	ret = tuple_parse(client, allocator, vars, value, flags, NULL);
+
+	PKGCONF_TRACEEVENT_END(client, "pkgconf_tuple_parse");
+	PKGCONF_STATS_LEAVE(client, phase);
+
+	return ret;
+}
+
 /*
  * !doc
  *
@@ -285,6 +420,88 @@ pkgconf_tuple_find(const pkgconf_client_t *client, pkgconf_list_t *list, const c
  */
 char *
 pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *value, unsigned int flags)
+{
+	return tuple_parse_traced(client, NULL, vars, value, flags);
+}
+
+/*
+ * Like pkgconf_tuple_parse(), but the result comes from the client's allocator, for the
+ * expansions which the library keeps to itself.
+ */
+char *
+pkgconf_tuple_parse_alloc(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *value, unsigned int flags)
+{
+	return tuple_parse_traced(client, &client->allocator, vars, value, flags);
+}
+
+/* memoized expansions depend on both the variable list and the global variables */
+static inline uint64_t
+tuple_serial(const pkgconf_client_t *client, const pkgconf_list_t *vars)
+{
+	const pkgconf_tuple_index_t *idx = vars->index;
+	const pkgconf_tuple_index_t *global_idx = client->global_vars.index;
+
+	return ((uint64_t) (global_idx != NULL ? global_idx->serial : 0) << 32) | idx->serial;
+}
+
+/*
+ * Expands a variable from the list being parsed.  The result is memoized on the tuple
+ * unless the list has no index to version it with, in which case it is returned through
+ * owned and must be released by the caller to the allocator of the tuple's client.  A
+ * variable which refers back to itself expands to nothing.
+ */
+static const char *
+tuple_expand(const pkgconf_client_t *client, pkgconf_list_t *vars, pkgconf_tuple_t *tuple, unsigned int flags, pkgconf_tuple_expansion_t *chain, char **owned)
+{
+	pkgconf_tuple_expansion_t frame = {
+		.parent = chain,
+		.tuple = tuple,
+	};
+	pkgconf_tuple_expansion_t *iter;
+	char *expanded;
+
+	for (iter = chain; iter != NULL; iter = iter->parent)
+	{
+		if (iter->tuple != tuple)
+			continue;
+
+		pkgconf_warn(client, "warning: variable '%s' is defined in terms of itself, ignoring the circular reference\n", tuple->key);
+
+		/* everything being expanded now depends on where the cycle was entered */
+		for (iter = chain; iter != NULL; iter = iter->parent)
+			iter->cyclic = true;
+
+		return NULL;
+	}
+
+	if (vars->index != NULL && tuple->expanded != NULL &&
+	    tuple->expanded_serial == tuple_serial(client, vars) &&
+	    tuple->expanded_flags == flags &&
+	    tuple->expanded_client_flags == client->flags)
+	{
+		PKGCONF_TRACE(client, "reusing expansion of tuple %s", tuple->key);
+		return tuple->expanded;
+	}
+
+	expanded = tuple_parse(client, &tuple->owner->allocator, vars, tuple->value, flags, &frame);
+
+	if (vars->index == NULL || frame.cyclic)
+	{
+		*owned = expanded;
+		return expanded;
+	}
+
+	pkgconf_alloc_free(&tuple->owner->allocator, PKGCONF_ALLOC_TUPLE, tuple->expanded);
+	tuple->expanded = expanded;
+	tuple->expanded_serial = tuple_serial(client, vars);
+	tuple->expanded_flags = flags;
+	tuple->expanded_client_flags = client->flags;
+
+	return expanded;
+}
+
+static char *
+tuple_parse(const pkgconf_client_t *client, const pkgconf_allocator_t *allocator, pkgconf_list_t *vars, const char *value, unsigned int flags, pkgconf_tuple_expansion_t *chain)
 {
 	char buf[PKGCONF_BUFSIZE];
 	const char *ptr;
@@ -306,8 +523,8 @@ pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const
 			char varname[PKGCONF_ITEM_SIZE];
 			char *vend = varname + PKGCONF_ITEM_SIZE - 1;
 			char *vptr = varname;
-			const char *pptr;
-			char *kv, *parsekv;
+			const char *pptr, *kv;
+			char *parsekv;
 
 			*vptr = '\0';
 
@@ -331,6 +548,7 @@ pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const
 			}
 
 			PKGCONF_TRACE(client, "lookup tuple %s", varname);
+			PKGCONF_STATS_COUNT(client, tuple_lookups, 1);
 
 			ptr += (pptr - ptr);
 			kv = pkgconf_tuple_find_global(client, varname);
@@ -341,18 +559,26 @@ pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const
 			}
 			else
 			{
-				kv = pkgconf_tuple_find(client, vars, varname);
+				pkgconf_tuple_t *tuple = tuple_lookup(vars, varname);
 
-				if (kv != NULL)
+				if (tuple != NULL)
 				{
-					parsekv = pkgconf_tuple_parse(client, vars, kv, flags);
+					parsekv = NULL;
+					kv = tuple_expand(client, vars, tuple, flags, chain, &parsekv);
 
-					strncpy(bptr, parsekv, PKGCONF_BUFSIZE - (bptr - buf));
-					bptr += strlen(parsekv);
+					if (kv != NULL)
+					{
+						strncpy(bptr, kv, PKGCONF_BUFSIZE - (bptr - buf));
+						bptr += strlen(kv);
+					}
 
-					free(parsekv);
+					pkgconf_alloc_free(&tuple->owner->allocator, PKGCONF_ALLOC_TUPLE, parsekv);
 				}
 			}
+
+			/* an unterminated reference runs up to the end of the value */
+			if (*ptr == '\0')
+				break;
 		}
 	}
 
@@ -383,10 +609,10 @@ pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const
 		pkgconf_strlcpy(cleanpath, buf + strlen(sysroot_dir), sizeof cleanpath);
 		pkgconf_path_relocate(cleanpath, sizeof cleanpath);
 
-		return strdup(cleanpath);
+		return pkgconf_alloc_strdup(allocator, PKGCONF_ALLOC_TUPLE, cleanpath);
 	}
 
-	return strdup(buf);
+	return pkgconf_alloc_strdup(allocator, PKGCONF_ALLOC_TUPLE, buf);
 }
 
 /*
@@ -404,11 +630,30 @@ pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const
 void
 pkgconf_tuple_free_entry(pkgconf_tuple_t *tuple, pkgconf_list_t *list)
 {
+	pkgconf_tuple_index_t *idx = list->index;
+
+	if (idx != NULL)
+	{
+		pkgconf_hash_t *table = tuple_index(list);
+
+		if (table != NULL && pkgconf_hash_lookup(table, tuple->key, strlen(tuple->key)) == tuple)
+			pkgconf_hash_delete(table, tuple->key, strlen(tuple->key));
+		else
+			pkgconf_hash_free(&idx->table);
+
+		idx->serial++;
+	}
+
 	pkgconf_node_delete(&tuple->iter, list);
 
-	free(tuple->key);
-	free(tuple->value);
-	free(tuple);
+	pkgconf_alloc_free(&tuple->owner->allocator, PKGCONF_ALLOC_TUPLE, tuple->expanded);
+
+	if (tuple->arena_owned)
+		return;
+
+	pkgconf_client_dealloc(tuple->owner, PKGCONF_ALLOC_TUPLE, tuple->key);
+	pkgconf_client_dealloc(tuple->owner, PKGCONF_ALLOC_TUPLE, tuple->value);
+	pkgconf_client_dealloc(tuple->owner, PKGCONF_ALLOC_TUPLE, tuple);
 }
 
 /*
@@ -426,6 +671,8 @@ pkgconf_tuple_free(pkgconf_list_t *list)
 {
 	pkgconf_node_t *node, *next;
 
+	tuple_index_free(list);
+
 	PKGCONF_FOREACH_LIST_ENTRY_SAFE(list->head, next, node)
 		pkgconf_tuple_free_entry(node->data, list);
 
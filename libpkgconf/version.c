@@ -0,0 +1,301 @@
+/*
+ * version.c
+ * version parsing and comparison
+ *
+ * Copyright (c) 2011, 2012, 2013 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+#include <libpkgconf/libpkgconf-internal.h>
+
+/*
+ * !doc
+ *
+ * libpkgconf `version` module
+ * ===========================
+ *
+ * The libpkgconf `version` module compares versions using RPM version comparison rules as
+ * described in the LSB.  A version is compared as a sequence of `segments`: runs of digits,
+ * runs of letters and tildes, with any other character acting as a separator.
+ *
+ * Splitting a version into segments is the expensive part of a comparison, so versions can
+ * be parsed once with ``pkgconf_version_parse()`` and compared any number of times with
+ * ``pkgconf_version_compare()``.  Packages and dependency nodes carry a parsed copy of their
+ * version, which is shared through the intern table of the client which owns them.
+ */
+
+/* versions are compared as if they were truncated to this many bytes */
+#define PKGCONF_VERSION_MAX	(PKGCONF_ITEM_SIZE - 1)
+
+/*
+ * splits off the segment at *p, skipping the separators in front of it.  a character which
+ * is neither a separator, a digit nor a letter forms an empty letter segment, which sorts
+ * below anything.
+ */
+static bool
+version_next_segment(const char **p, const char *end, pkgconf_version_segment_t *seg)
+{
+	const char *s = *p;
+
+	while (s < end && !isalnum((unsigned char) *s) && *s != '~')
+		s++;
+
+	if (s == end)
+	{
+		*p = s;
+		return false;
+	}
+
+	seg->text = s;
+
+	if (*s == '~')
+	{
+		seg->type = PKGCONF_VERSION_SEGMENT_TILDE;
+		seg->len = 1;
+		*p = s + 1;
+		return true;
+	}
+
+	if (isdigit((unsigned char) *s))
+	{
+		seg->type = PKGCONF_VERSION_SEGMENT_NUMERIC;
+
+		while (s < end && isdigit((unsigned char) *s))
+			s++;
+
+		/* leading zeroes are not significant */
+		while (seg->text < s && *seg->text == '0')
+			seg->text++;
+	}
+	else
+	{
+		seg->type = PKGCONF_VERSION_SEGMENT_ALPHA;
+
+		while (s < end && isalpha((unsigned char) *s))
+			s++;
+	}
+
+	seg->len = s - seg->text;
+
+	/* step over a character which forms an empty segment, so that splitting makes progress */
+	*p = (seg->type == PKGCONF_VERSION_SEGMENT_ALPHA && seg->len == 0) ? s + 1 : s;
+
+	return true;
+}
+
+static inline const char *
+version_end(const char *str)
+{
+	size_t len = strlen(str);
+
+	return str + (len > PKGCONF_VERSION_MAX ? PKGCONF_VERSION_MAX : len);
+}
+
+/*
+ * compares two segments which are not tildes.  when the segments are of different types,
+ * the first one decides: a number sorts above letters and letters sort below a number.
+ */
+static int
+version_segment_compare(const pkgconf_version_segment_t *a, const pkgconf_version_segment_t *b)
+{
+	size_t len;
+	int ret;
+
+	if (a->type == PKGCONF_VERSION_SEGMENT_ALPHA && a->len == 0)
+		return -1;
+
+	if (a->type != b->type || (b->type == PKGCONF_VERSION_SEGMENT_ALPHA && b->len == 0))
+		return a->type == PKGCONF_VERSION_SEGMENT_NUMERIC ? 1 : -1;
+
+	/* without leading zeroes, the longer number is the larger one */
+	if (a->type == PKGCONF_VERSION_SEGMENT_NUMERIC && a->len != b->len)
+		return a->len > b->len ? 1 : -1;
+
+	len = a->len < b->len ? a->len : b->len;
+	if ((ret = memcmp(a->text, b->text, len)) != 0)
+		return ret < 0 ? -1 : 1;
+
+	if (a->len != b->len)
+		return a->len < b->len ? -1 : 1;
+
+	return 0;
+}
+
+/* walks the segments of a parsed version, or of a version string which is split on the fly */
+typedef struct {
+	const pkgconf_version_t *version;
+	size_t index;
+
+	const char *p;
+	const char *end;
+} version_cursor_t;
+
+static inline bool
+version_cursor_next(version_cursor_t *cursor, pkgconf_version_segment_t *seg)
+{
+	if (cursor->version == NULL)
+		return version_next_segment(&cursor->p, cursor->end, seg);
+
+	if (cursor->index == cursor->version->count)
+		return false;
+
+	*seg = cursor->version->segments[cursor->index++];
+	return true;
+}
+
+static int
+version_compare_segments(version_cursor_t *one, version_cursor_t *two)
+{
+	pkgconf_version_segment_t a, b;
+	int ret;
+
+	for (;;)
+	{
+		bool has_a = version_cursor_next(one, &a);
+		bool has_b = version_cursor_next(two, &b);
+
+		if (!has_a && !has_b)
+			return 0;
+
+		if ((has_a && a.type == PKGCONF_VERSION_SEGMENT_TILDE) || (has_b && b.type == PKGCONF_VERSION_SEGMENT_TILDE))
+		{
+			if (!has_a || a.type != PKGCONF_VERSION_SEGMENT_TILDE)
+				return -1;
+			if (!has_b || b.type != PKGCONF_VERSION_SEGMENT_TILDE)
+				return 1;
+
+			continue;
+		}
+
+		if (!has_a)
+			return -1;
+		if (!has_b)
+			return 1;
+
+		if ((ret = version_segment_compare(&a, &b)) != 0)
+			return ret;
+	}
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: int pkgconf_compare_version(const char *a, const char *b)
+ *
+ *    Compare versions using RPM version comparison rules as described in the LSB.
+ *
+ *    :param char* a: The first version to compare in the pair.
+ *    :param char* b: The second version to compare in the pair.
+ *    :return: -1 if the first version is greater, 0 if both versions are equal, 1 if the second version is greater.
+ *    :rtype: int
+ */
+int
+pkgconf_compare_version(const char *a, const char *b)
+{
+	version_cursor_t one = {0}, two = {0};
+
+	/* optimization: if version matches then it's the same version. */
+	if (a == NULL)
+		return 1;
+
+	if (b == NULL)
+		return -1;
+
+	if (!strcasecmp(a, b))
+		return 0;
+
+	one.p = a;
+	one.end = version_end(a);
+	two.p = b;
+	two.end = version_end(b);
+
+	return version_compare_segments(&one, &two);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_version_t *pkgconf_version_parse(pkgconf_arena_t *arena, const char *str)
+ *
+ *    Splits a version into segments, for use with ``pkgconf_version_compare()``.  The parsed
+ *    version refers to `str`, which must remain valid for as long as the parsed version is used.
+ *
+ *    :param pkgconf_arena_t* arena: The arena to allocate the parsed version from.
+ *    :param char* str: The version to parse.
+ *    :return: the parsed version, else ``NULL``.
+ *    :rtype: pkgconf_version_t *
+ */
+pkgconf_version_t *
+pkgconf_version_parse(pkgconf_arena_t *arena, const char *str)
+{
+	pkgconf_version_segment_t seg;
+	pkgconf_version_t *version;
+	const char *end = version_end(str);
+	const char *p;
+	size_t count = 0;
+
+	for (p = str; version_next_segment(&p, end, &seg); )
+		count++;
+
+	version = pkgconf_arena_alloc(arena, sizeof(pkgconf_version_t) + count * sizeof(pkgconf_version_segment_t));
+	if (version == NULL)
+		return NULL;
+
+	version->str = str;
+	version->len = strlen(str);
+	version->segments = (pkgconf_version_segment_t *) (version + 1);
+
+	for (p = str; version_next_segment(&p, end, &version->segments[version->count]); )
+		version->count++;
+
+	for (p = str; *p != '\0' && !version->has_upper; p++)
+		version->has_upper = isupper((unsigned char) *p) != 0;
+
+	return version;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: int pkgconf_version_compare(const pkgconf_version_t *a, const pkgconf_version_t *b)
+ *
+ *    Compares parsed versions.  The result is the same as the result of ``pkgconf_compare_version()``
+ *    on the versions they were parsed from.
+ *
+ *    :param pkgconf_version_t* a: The first version to compare in the pair.
+ *    :param pkgconf_version_t* b: The second version to compare in the pair.
+ *    :return: -1 if the first version is greater, 0 if both versions are equal, 1 if the second version is greater.
+ *    :rtype: int
+ */
+int
+pkgconf_version_compare(const pkgconf_version_t *a, const pkgconf_version_t *b)
+{
+	version_cursor_t one = {.version = a}, two = {.version = b};
+	int ret;
+
+	if (a == NULL)
+		return 1;
+
+	if (b == NULL)
+		return -1;
+
+	if (a == b)
+		return 0;
+
+	ret = version_compare_segments(&one, &two);
+
+	/* versions which only differ in case are equal, as far as pkgconf_compare_version() is concerned */
+	if (ret != 0 && (a->has_upper || b->has_upper) && a->len == b->len && !strcasecmp(a->str, b->str))
+		return 0;
+
+	return ret;
+}
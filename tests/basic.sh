@@ -35,7 +35,16 @@ tests_init \
 	arbitary_path \
 	with_path \
 	relocatable \
-	single_depth_selectors
+	relocatable_circular_variable \
+	single_depth_selectors \
+	batch \
+	batch_options \
+	batch_repeated \
+	batch_lazy \
+	batch_long_line \
+	json \
+	stats \
+	trace_events
 
 noargs_body()
 {
@@ -300,6 +309,17 @@ relocatable_body()
 		pkgconf --define-prefix --variable=prefix ${basedir}/lib-relocatable/lib/pkgconfig/foo.pc
 }
 
+relocatable_circular_variable_body()
+{
+	basedir=$(pkgconf --relocate ${selfdir})
+	atf_check \
+		-o inline:"-L${basedir}/lib-relocatable/circular -lcircular \n" \
+		pkgconf --define-prefix --libs ${basedir}/lib-relocatable/lib/pkgconfig/circular.pc
+	atf_check \
+		-o match:"variable 'libdir' is defined in terms of itself" \
+		pkgconf --define-prefix --validate ${basedir}/lib-relocatable/lib/pkgconfig/circular.pc
+}
+
 single_depth_selectors_body()
 {
 	export PKG_CONFIG_MAXIMUM_TRAVERSE_DEPTH=1
@@ -307,3 +327,142 @@ single_depth_selectors_body()
 		-o inline:"foo\n" \
 		pkgconf --with-path=${selfdir}/lib3 --print-requires bar
 }
+
+batch_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	printf -- '--libs foo\n\n--modversion foo\n--exists nonexistent\n' > queries
+	printf -- '--define-variable=libdir=/opt/lib --variable=typelibdir typelibdir\n' >> queries
+	printf -- '--variable=typelibdir typelibdir\n' >> queries
+	atf_check \
+		-o inline:"-L/test/lib -lfoo \n#0\n1.2.3\n#0\n#1\n/opt/lib/typelibdir\n#0\n/test/lib/typelibdir\n#0\n" \
+		-x "pkgconf --batch < queries | tr '\\036' '#'"
+	atf_check \
+		-s exit:1 \
+		-o ignore \
+		-x "pkgconf --batch < queries"
+}
+
+batch_options_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	printf -- 'foo\nbar\n' > queries
+	atf_check \
+		-o inline:"-fPIC -I/test/include/foo -DFOO_STATIC -L/test/lib -lfoo \n#0\n-fPIC -I/test/include/foo -DFOO_STATIC -L/test/lib -lbar -lfoo \n#0\n" \
+		-x "pkgconf --batch --static --cflags --libs < queries | tr '\\036' '#'"
+}
+
+batch_repeated_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	printf -- '--libs bar\n--maximum-traverse-depth=2 --libs bar\n--static --libs bar\n--libs bar\n' > queries
+	atf_check \
+		-o inline:"-L/test/lib -lbar -lfoo \n#0\n-L/test/lib -lbar \n#0\n-L/test/lib -lbar -lfoo \n#0\n-L/test/lib -lbar -lfoo \n#0\n" \
+		-x "pkgconf --batch < queries | tr '\\036' '#'"
+}
+
+batch_lazy_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	printf -- '--exists bar\n--static --libs bar\n--modversion foo\n--cflags --libs foo\n--print-requires bar\n' > queries
+	atf_check \
+		-o inline:"#0\n-L/test/lib -lbar -lfoo \n#0\n1.2.3\n#0\n-fPIC -I/test/include/foo -L/test/lib -lfoo \n#0\nfoo\n#0\n" \
+		-x "pkgconf --batch < queries | tr '\\036' '#'"
+}
+
+batch_long_line_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	printf -- '--libs %070000d foo\n--modversion foo\n' 0 > queries
+	atf_check \
+		-o inline:"#1\n1.2.3\n#0\n" \
+		-e inline:"Query too long: lines are limited to 65533 characters\n" \
+		-x "pkgconf --batch < queries | tr '\\036' '#'"
+}
+
+json_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"{
+  \"packages\": [
+    {
+      \"id\": \"foo\",
+      \"name\": \"foo\",
+      \"description\": \"A testing pkg-config file\",
+      \"version\": \"1.2.3\",
+      \"path\": \"${selfdir}/lib1/foo.pc\",
+      \"requires\": [],
+      \"requires_private\": [],
+      \"provides\": [{\"package\": \"foo\", \"comparator\": \"=\", \"version\": \"1.2.3\"}],
+      \"variables\": {\"includedir\": \"/test/include\", \"libdir\": \"/test/lib\", \"exec_prefix\": \"/test\", \"prefix\": \"/test\", \"pcfiledir\": \"${selfdir}/lib1\"},
+      \"cflags\": [\"-fPIC\", \"-I/test/include/foo\"],
+      \"libs\": [\"-L/test/lib\", \"-lfoo\"],
+      \"libs_static\": [\"-L/test/lib\", \"-lfoo\"]
+    }
+  ],
+  \"cflags\": [\"-fPIC\", \"-I/test/include/foo\"],
+  \"libs\": [\"-L/test/lib\", \"-lfoo\"],
+  \"libs_static\": [\"-L/test/lib\", \"-lfoo\"]
+}
+" \
+		pkgconf --json foo
+	atf_check \
+		-o match:'^  "libs": \["-lbar", "-lfoo"\],$' \
+		pkgconf --json --libs-only-l bar
+	atf_check \
+		-o inline:"1\n" \
+		-x "pkgconf --json bar | grep -c '\"id\":'"
+	mkdir long
+	awk 'BEGIN { d = "/"; for (i = 0; i < 400; i++) d = d "directory/"; printf "Name: long\nDescription: a package with a long fragment\nVersion: 1.0\nLibs: -L%s -llong\n", d > "long/long.pc" }'
+	atf_check \
+		-o match:'^  "libs": \["-L/(directory/){400}", "-llong"\],$' \
+		pkgconf --with-path=long --json long
+	atf_check \
+		-s exit:1 \
+		-e ignore \
+		pkgconf --json nonexistent
+}
+
+stats_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"-L/test/lib -lbar -lfoo \n" \
+		-e match:'^stats: parse  *[0-9.]* ms$' \
+		-e match:'^stats: total  *[0-9.]* ms$' \
+		-e match:'^stats: files-opened  *2$' \
+		-e match:'^stats: nodes-visited  *[1-9][0-9]*$' \
+		-e match:'^stats: alloc-parser  *[1-9][0-9]*$' \
+		-e match:'^stats: alloc-tuple  *[1-9][0-9]*$' \
+		-e match:'^stats: alloc-query  *[1-9][0-9]*$' \
+		-e match:'^stats: alloc-package  *[1-9][0-9]*$' \
+		-e match:'^stats: alloc-peak-bytes  *[1-9][0-9]*$' \
+		pkgconf --stats --libs bar
+	atf_check \
+		-o inline:"-L/test/lib -lbar -lfoo \n" \
+		-e empty \
+		pkgconf --libs bar
+}
+
+trace_events_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"-L/test/lib -lbar -lfoo \n" \
+		pkgconf --trace-events=trace.json --libs bar
+	atf_check \
+		-o match:'^\[$' \
+		-o match:'^\{"name":"pkgconf_pkg_find","cat":"pkgconf","ph":"B","ts":[0-9.]*,"pid":1,"tid":1,"args":\{"package":"bar"\}\},$' \
+		-o match:'^\{"name":"pkgconf_pkg_traverse_main",.*"args":\{"package":"foo"\}\},$' \
+		-o match:'^\{"name":"pkgconf_fragment_render","cat":"pkgconf","ph":"E",' \
+		-o match:'^\]$' \
+		cat trace.json
+	export PKG_CONFIG_TRACE_EVENTS="env.json"
+	atf_check \
+		-o inline:"1.2.3\n" \
+		pkgconf --modversion foo
+	atf_check \
+		-o match:'"args":\{"filename":"[^"]*/lib1/foo.pc"\}' \
+		cat env.json
+}
@@ -7,6 +7,7 @@ tests_init \
 	comments_in_fields \
 	dos \
 	no_trailing_newline \
+	comment_no_trailing_newline \
 	argv_parse \
 	bad_option \
 	argv_parse_3 \
@@ -21,6 +22,7 @@ tests_init \
 	flag_order_4 \
 	quoted \
 	variable_whitespace \
+	variable_unterminated \
 	fragment_escaping_1 \
 	fragment_escaping_2 \
 	fragment_escaping_3 \
@@ -35,7 +37,10 @@ tests_init \
 	tuple_dequote \
 	version_with_whitespace \
 	version_with_whitespace_2 \
-	version_with_whitespace_diagnostic
+	version_with_whitespace_diagnostic \
+	parse_cache \
+	parse_cache_diagnostic \
+	scan_threads
 
 comments_body()
 {
@@ -69,6 +74,14 @@ no_trailing_newline_body()
 		pkgconf --cflags no-trailing-newline
 }
 
+comment_no_trailing_newline_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"-I/test/include/comment-no-trailing-newline \n" \
+		pkgconf --cflags comment-no-trailing-newline
+}
+
 argv_parse_body()
 {
 	export PKG_CONFIG_PATH="${selfdir}/lib1"
@@ -186,6 +199,20 @@ variable_whitespace_body()
 		pkgconf --cflags variable-whitespace
 }
 
+variable_unterminated_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"/test/include /test/lib\n" \
+		pkgconf --variable=unterminated variable-unterminated
+	atf_check \
+		-o inline:"/test/include \n" \
+		pkgconf --variable=dangling variable-unterminated
+	atf_check \
+		-o inline:"-L/test/lib -lfoo /test \n" \
+		pkgconf --libs variable-unterminated
+}
+
 fragment_quoting_body()
 {
 	export PKG_CONFIG_PATH="${selfdir}/lib1"
@@ -316,3 +343,73 @@ version_with_whitespace_diagnostic_body()
 		-o match:warning \
 		pkgconf --with-path="${selfdir}/lib1" --validate malformed-version
 }
+
+parse_cache_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"-fPIC -I/test/include/foo -DFOO_STATIC -L/test/lib -lbaz -L/test/lib -lzee -L/test/lib -lfoo \n" \
+		-e match:'^stats: parse-cache-hits  *0$' \
+		-e match:'^stats: parse-cache-misses  *2$' \
+		pkgconf --stats --parse-cache=parse.cache --cflags --libs --static baz
+	atf_check -s exit:0 test -s parse.cache
+	atf_check \
+		-o inline:"-fPIC -I/test/include/foo -DFOO_STATIC -L/test/lib -lbaz -L/test/lib -lzee -L/test/lib -lfoo \n" \
+		-e match:'^stats: parse-cache-hits  *2$' \
+		-e match:'^stats: parse-cache-misses  *0$' \
+		pkgconf --stats --parse-cache=parse.cache --cflags --libs --static baz
+	atf_check \
+		-o inline:"-fPIC -I/test/include/foo -L/test/lib -lfoo \n" \
+		-e match:'^stats: parse-cache-hits  *1$' \
+		pkgconf --stats --parse-cache=parse.cache --cflags --libs foo
+
+	# an entry is not replayed once its .pc file is edited
+	mkdir pc
+	cp "${selfdir}/lib1/foo.pc" pc/
+	export PKG_CONFIG_PATH="pc"
+	atf_check \
+		-o inline:"-L/test/lib -lfoo \n" \
+		pkgconf --parse-cache=parse.cache --libs foo
+	sed 's/-lfoo$/-lfoo -lfoo-extra/' "${selfdir}/lib1/foo.pc" > pc/foo.pc
+	atf_check \
+		-o inline:"-L/test/lib -lfoo -lfoo-extra \n" \
+		-e match:'^stats: parse-cache-hits  *0$' \
+		-e match:'^stats: parse-cache-misses  *1$' \
+		pkgconf --stats --parse-cache=parse.cache --libs foo
+
+	# entries for files which are gone are dropped when the cache is next written
+	sed 's/^Name: .*/Name: gone/' "${selfdir}/lib1/foo.pc" > pc/gone.pc
+	atf_check \
+		-o inline:"-L/test/lib -lfoo \n" \
+		pkgconf --parse-cache=parse.cache --libs gone
+	atf_check grep -a -q gone.pc parse.cache
+	rm pc/gone.pc
+	cp "${selfdir}/lib1/bar.pc" pc/
+	atf_check \
+		-o inline:"-L/test/lib -lbar -lfoo -lfoo-extra \n" \
+		pkgconf --parse-cache=parse.cache --libs bar
+	atf_check -s exit:1 grep -a -q gone.pc parse.cache
+}
+
+parse_cache_diagnostic_body()
+{
+	atf_check \
+		-o match:warning \
+		pkgconf --parse-cache=parse.cache --with-path="${selfdir}/lib1" --validate malformed-version
+	atf_check \
+		-o match:warning \
+		pkgconf --parse-cache=parse.cache --with-path="${selfdir}/lib1" --validate malformed-version
+}
+
+scan_threads_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1:${selfdir}/lib2"
+	pkgconf --list-all > list.out 2> list.err
+	atf_check \
+		-o file:list.out \
+		-e file:list.err \
+		pkgconf --scan-threads=4 --list-all
+	atf_check \
+		-o inline:"-lfoo \n" \
+		pkgconf --scan-threads=4 --libs provides-request-simple
+}
@@ -29,6 +29,13 @@ provides = 1.2.3
 	atf_check \
 		-o inline:"-lfoo \n" \
 		pkgconf --libs provides-request-simple
+	atf_check \
+		pkgconf --validate provides-request-simple
+	atf_check \
+		-o inline:"-lfoo \n" \
+		-e match:'^stats: provides-names  *[1-9][0-9]*$' \
+		-e match:'^stats: provides-providers  *[1-9][0-9]*$' \
+		pkgconf --stats --libs provides-request-simple
 	atf_check \
 		-e ignore \
 		-s exit:1 \
@@ -9,6 +9,7 @@ tests_init \
 	depgraph_break_3 \
 	define_variable \
 	variable \
+	many_variables \
 	keep_system_libs \
 	libs \
 	libs_only \
@@ -28,7 +29,8 @@ tests_init \
 	malformed_1 \
 	malformed_quoting \
 	explicit_sysroot \
-	empty_tuple
+	empty_tuple \
+	deep_requires_chain
 
 #	sysroot_munge \
 
@@ -79,6 +81,20 @@ variable_body()
 		pkgconf --variable=includedir foo
 }
 
+many_variables_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"includedir\nplugindir\npkglibdir\npkgincludedir\nlocalstatedir\nsysconfdir\ndatadir\ndatarootdir\nlibdir\nexec_prefix\nprefix\npcfiledir\n" \
+		pkgconf --print-variables many-variables
+	atf_check \
+		-o inline:"-I/test/include/many-variables -I/test/usr/include -L/test/lib/many-variables -lmany-variables \n" \
+		pkgconf --cflags --libs many-variables
+	atf_check \
+		-o inline:"/other/lib/many-variables/plugins\n" \
+		pkgconf --define-variable=prefix=/other --variable=plugindir many-variables
+}
+
 keep_system_libs_body()
 {
 	export PKG_CONFIG_PATH="${selfdir}/lib1"
@@ -251,3 +267,23 @@ empty_tuple_body()
 	atf_check -o inline:"\n" \
 		pkgconf --with-path="${selfdir}/lib1" --cflags empty-tuple
 }
+
+# the dependency graph used to be walked recursively, which overflowed the stack of
+# long Requires chains, so walk a chain deep enough to do so on a small stack
+deep_requires_chain_body()
+{
+	mkdir chain
+	awk 'BEGIN {
+		for (i = 1; i <= 5000; i++) {
+			f = sprintf("chain/chain%d.pc", i)
+			printf "Name: chain%d\nDescription: link %d of a dependency chain\nVersion: 1.0\nLibs: -lchain%d\n", i, i, i > f
+			if (i < 5000)
+				printf "Requires: chain%d\n", i + 1 > f
+			close(f)
+		}
+	}'
+	ulimit -s 1024
+	atf_check \
+		-o match:'^-lchain1 -lchain2 .* -lchain4999 -lchain5000 $' \
+		pkgconf --with-path=chain --maximum-traverse-depth=6000 --libs chain1
+}
@@ -15,7 +15,10 @@ tests_init \
 	requires_internal \
 	requires_internal_missing \
 	requires_internal_collision \
-	orphaned_requires_private
+	orphaned_requires_private \
+	exists_print_requires \
+	modversion_print_requires \
+	exists_print_requires_private
 
 libs_body()
 {
@@ -122,3 +125,27 @@ orphaned_requires_private_body()
 		-o ignore \
 		pkgconf --with-path="${selfdir}/lib1" --cflags --libs orphaned-requires-private
 }
+
+exists_print_requires_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"foo\n" \
+		pkgconf --exists --print-requires --maximum-traverse-depth=1 bar
+}
+
+modversion_print_requires_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"1.3\nfoo\n" \
+		pkgconf --modversion --print-requires --maximum-traverse-depth=1 bar
+}
+
+exists_print_requires_private_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"foo\n" \
+		pkgconf --exists --print-requires-private --maximum-traverse-depth=1 baz
+}
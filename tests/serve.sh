@@ -0,0 +1,105 @@
+#!/usr/bin/env atf-sh
+
+. $(atf_get_srcdir)/test_env.sh
+
+tests_init \
+	fallback \
+	forward \
+	forward_errors \
+	invalidate \
+	stopped
+
+start_server()
+{
+	pkgconf --serve="${PWD}/sock" &
+	server_pid=$!
+	trap 'kill ${server_pid} 2>/dev/null' EXIT
+
+	i=0
+	while [ ! -S sock ] && [ $i -lt 50 ]; do
+		sleep 0.1
+		i=$((i + 1))
+	done
+
+	export PKG_CONFIG_SERVER="${PWD}/sock"
+}
+
+stop_server()
+{
+	kill ${server_pid}
+	wait ${server_pid}
+	trap - EXIT
+}
+
+fallback_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	export PKG_CONFIG_SERVER="${PWD}/nonexistent"
+	atf_check \
+		-o inline:"-L/test/lib -lbar -lfoo \n" \
+		pkgconf --libs bar
+}
+
+forward_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	start_server
+	atf_check \
+		-o inline:"-L/test/lib -lbar -lfoo \n" \
+		pkgconf --libs bar
+	atf_check \
+		-o inline:"-fPIC -I/test/include/foo -DFOO_STATIC -L/test/lib -lfoo \n" \
+		pkgconf --static --cflags --libs foo
+	export PKG_CONFIG_PATH="${selfdir}/lib2"
+	atf_check \
+		-o inline:"-L/test/lib -lfoo \n" \
+		pkgconf --libs foo
+	stop_server
+	atf_check -s exit:1 test -e sock
+}
+
+forward_errors_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	start_server
+	atf_check \
+		-s exit:1 \
+		-e inline:"Package 'nonexistent', required by 'virtual:world', not found\n" \
+		pkgconf --short-errors --print-errors --libs nonexistent
+	stop_server
+}
+
+invalidate_body()
+{
+	mkdir pc
+	cp ${selfdir}/lib1/foo.pc pc/
+	export PKG_CONFIG_PATH="${PWD}/pc"
+	start_server
+	atf_check \
+		-o inline:"-L/test/lib -lfoo \n" \
+		pkgconf --libs foo
+	sed 's/-lfoo/-lfoo2/' ${selfdir}/lib1/foo.pc > pc/foo.pc
+	atf_check \
+		-o inline:"-L/test/lib -lfoo2 \n" \
+		pkgconf --libs foo
+	cp ${selfdir}/lib1/bar.pc pc/
+	atf_check \
+		-o inline:"-L/test/lib -lbar -lfoo2 \n" \
+		pkgconf --libs bar
+	stop_server
+}
+
+stopped_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	start_server
+	kill -STOP ${server_pid}
+	atf_check \
+		-o inline:"-L/test/lib -lbar -lfoo \n" \
+		pkgconf --libs bar
+	kill -CONT ${server_pid}
+	atf_check \
+		-o inline:"-L/test/lib -lfoo \n" \
+		pkgconf --libs foo
+	stop_server
+}
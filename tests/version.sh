@@ -5,7 +5,8 @@
 tests_init \
 	atleast \
 	exact \
-	max
+	max \
+	requires
 
 atleast_body()
 {
@@ -36,3 +37,20 @@ max_body()
 	atf_check \
 		pkgconf --max-version 2.0 foo
 }
+
+requires_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		pkgconf --exists 'foo >= 1.2.3'
+	atf_check \
+		pkgconf --exists 'foo = 1.02.03'
+	atf_check \
+		pkgconf --exists 'foo < 1.10'
+	atf_check \
+		-s exit:1 \
+		pkgconf --exists 'foo > 1.2.3'
+	atf_check \
+		-s exit:1 \
+		pkgconf --exists 'foo >= 1.2.3a'
+}